@@ -1,4 +1,4 @@
-// g++ -Wall -std=c++0x -I../src -O3 benchmark_sha1.cpp ../src/pushoversha1.cpp ../src/s11nsha.cpp -lcryptopp -lboost_serialization
+// g++ -Wall -std=c++0x -I../src -O3 benchmark_sha1.cpp ../src/pushoversha1.cpp ../src/s11nsha.cpp ../src/s11nsha_dispatch.cpp ../src/s11nsha_shani.cpp ../src/s11nsha_simd.cpp -lcryptopp -lboost_serialization
 
 #include <iostream>
 #include <fstream>
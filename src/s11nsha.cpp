@@ -2,10 +2,32 @@
 // implementation of s11nsha.hpp
 
 #include "s11nsha.hpp"
+#include "s11nsha_kernels.hpp"
 
-// fopen, fread, fclose
+// printf
 #include <cstdio>
 
+// posix_memalign, free
+#include <cstdlib>
+
+// errno, EINTR
+#include <cerrno>
+
+// SIZE_MAX
+#include <cstdint>
+
+// open, O_RDONLY
+#include <fcntl.h>
+
+// mmap, madvise, munmap
+#include <sys/mman.h>
+
+// fstat, S_ISREG
+#include <sys/stat.h>
+
+// read, lseek, close
+#include <unistd.h>
+
 // size_t, std::memset, std::memcpy
 #include <cstring>
 
@@ -51,108 +73,119 @@ void s11nSHA::SHA1::init()
 }
 #endif
 
-void s11nSHA::SHA1::process( const unsigned char data[BLOCK_BYTES] )
+void s11nSHA::process_scalar( uint32_t state[DIGEST_INTS],
+                              const unsigned char *data, size_t blocks )
 {
     uint32_t temp, W[16], A, B, C, D, E;
 
-    GET_UINT32_BE( W[ 0], data,  0 ); GET_UINT32_BE( W[ 1], data,  4 );
-    GET_UINT32_BE( W[ 2], data,  8 ); GET_UINT32_BE( W[ 3], data, 12 );
-    GET_UINT32_BE( W[ 4], data, 16 ); GET_UINT32_BE( W[ 5], data, 20 );
-    GET_UINT32_BE( W[ 6], data, 24 ); GET_UINT32_BE( W[ 7], data, 28 );
-    GET_UINT32_BE( W[ 8], data, 32 ); GET_UINT32_BE( W[ 9], data, 36 );
-    GET_UINT32_BE( W[10], data, 40 ); GET_UINT32_BE( W[11], data, 44 );
-    GET_UINT32_BE( W[12], data, 48 ); GET_UINT32_BE( W[13], data, 52 );
-    GET_UINT32_BE( W[14], data, 56 ); GET_UINT32_BE( W[15], data, 60 );
-
-    #define S(x,n) ((x << n) | ((x & 0xFFFFFFFF) >> (32 - n)))
-
-    #define R(t)                                         \
-    (                                                    \
-     temp = W[(t -  3) & 0x0F] ^ W[(t - 8) & 0x0F] ^     \
-            W[(t - 14) & 0x0F] ^ W[ t      & 0x0F],      \
-     ( W[t & 0x0F] = S(temp,1) )                         \
-    )
-
-    #define P(a,b,c,d,e,x)                               \
-    {                                                    \
-     e += S(a,5) + F(b,c,d) + K + x; b = S(b,30);        \
+    for( ; blocks > 0; --blocks, data += BLOCK_BYTES )
+    {
+        GET_UINT32_BE( W[ 0], data,  0 ); GET_UINT32_BE( W[ 1], data,  4 );
+        GET_UINT32_BE( W[ 2], data,  8 ); GET_UINT32_BE( W[ 3], data, 12 );
+        GET_UINT32_BE( W[ 4], data, 16 ); GET_UINT32_BE( W[ 5], data, 20 );
+        GET_UINT32_BE( W[ 6], data, 24 ); GET_UINT32_BE( W[ 7], data, 28 );
+        GET_UINT32_BE( W[ 8], data, 32 ); GET_UINT32_BE( W[ 9], data, 36 );
+        GET_UINT32_BE( W[10], data, 40 ); GET_UINT32_BE( W[11], data, 44 );
+        GET_UINT32_BE( W[12], data, 48 ); GET_UINT32_BE( W[13], data, 52 );
+        GET_UINT32_BE( W[14], data, 56 ); GET_UINT32_BE( W[15], data, 60 );
+
+        #define S(x,n) ((x << n) | ((x & 0xFFFFFFFF) >> (32 - n)))
+
+        #define R(t)                                         \
+        (                                                    \
+         temp = W[(t -  3) & 0x0F] ^ W[(t - 8) & 0x0F] ^     \
+                W[(t - 14) & 0x0F] ^ W[ t      & 0x0F],      \
+         ( W[t & 0x0F] = S(temp,1) )                         \
+        )
+
+        #define P(a,b,c,d,e,x)                               \
+        {                                                    \
+         e += S(a,5) + F(b,c,d) + K + x; b = S(b,30);        \
+        }
+
+        A = state[0]; B = state[1]; C = state[2]; D = state[3]; E = state[4];
+
+        #define F(x,y,z) (z ^ (x & (y ^ z)))
+        #define K 0x5A827999
+
+        P( A, B, C, D, E, W[0]  ); P( E, A, B, C, D, W[1]  );
+        P( D, E, A, B, C, W[2]  ); P( C, D, E, A, B, W[3]  );
+        P( B, C, D, E, A, W[4]  ); P( A, B, C, D, E, W[5]  );
+        P( E, A, B, C, D, W[6]  ); P( D, E, A, B, C, W[7]  );
+        P( C, D, E, A, B, W[8]  ); P( B, C, D, E, A, W[9]  );
+        P( A, B, C, D, E, W[10] ); P( E, A, B, C, D, W[11] );
+        P( D, E, A, B, C, W[12] ); P( C, D, E, A, B, W[13] );
+        P( B, C, D, E, A, W[14] ); P( A, B, C, D, E, W[15] );
+        P( E, A, B, C, D, R(16) ); P( D, E, A, B, C, R(17) );
+        P( C, D, E, A, B, R(18) ); P( B, C, D, E, A, R(19) );
+
+        #undef K
+        #undef F
+
+        #define F(x,y,z) (x ^ y ^ z)
+        #define K 0x6ED9EBA1
+
+        P( A, B, C, D, E, R(20) ); P( E, A, B, C, D, R(21) );
+        P( D, E, A, B, C, R(22) ); P( C, D, E, A, B, R(23) );
+        P( B, C, D, E, A, R(24) ); P( A, B, C, D, E, R(25) );
+        P( E, A, B, C, D, R(26) ); P( D, E, A, B, C, R(27) );
+        P( C, D, E, A, B, R(28) ); P( B, C, D, E, A, R(29) );
+        P( A, B, C, D, E, R(30) ); P( E, A, B, C, D, R(31) );
+        P( D, E, A, B, C, R(32) ); P( C, D, E, A, B, R(33) );
+        P( B, C, D, E, A, R(34) ); P( A, B, C, D, E, R(35) );
+        P( E, A, B, C, D, R(36) ); P( D, E, A, B, C, R(37) );
+        P( C, D, E, A, B, R(38) ); P( B, C, D, E, A, R(39) );
+
+        #undef K
+        #undef F
+
+        #define F(x,y,z) ((x & y) | (z & (x | y)))
+        #define K 0x8F1BBCDC
+
+        P( A, B, C, D, E, R(40) ); P( E, A, B, C, D, R(41) );
+        P( D, E, A, B, C, R(42) ); P( C, D, E, A, B, R(43) );
+        P( B, C, D, E, A, R(44) ); P( A, B, C, D, E, R(45) );
+        P( E, A, B, C, D, R(46) ); P( D, E, A, B, C, R(47) );
+        P( C, D, E, A, B, R(48) ); P( B, C, D, E, A, R(49) );
+        P( A, B, C, D, E, R(50) ); P( E, A, B, C, D, R(51) );
+        P( D, E, A, B, C, R(52) ); P( C, D, E, A, B, R(53) );
+        P( B, C, D, E, A, R(54) ); P( A, B, C, D, E, R(55) );
+        P( E, A, B, C, D, R(56) ); P( D, E, A, B, C, R(57) );
+        P( C, D, E, A, B, R(58) ); P( B, C, D, E, A, R(59) );
+
+        #undef K
+        #undef F
+
+        #define F(x,y,z) (x ^ y ^ z)
+        #define K 0xCA62C1D6
+
+        P( A, B, C, D, E, R(60) ); P( E, A, B, C, D, R(61) );
+        P( D, E, A, B, C, R(62) ); P( C, D, E, A, B, R(63) );
+        P( B, C, D, E, A, R(64) ); P( A, B, C, D, E, R(65) );
+        P( E, A, B, C, D, R(66) ); P( D, E, A, B, C, R(67) );
+        P( C, D, E, A, B, R(68) ); P( B, C, D, E, A, R(69) );
+        P( A, B, C, D, E, R(70) ); P( E, A, B, C, D, R(71) );
+        P( D, E, A, B, C, R(72) ); P( C, D, E, A, B, R(73) );
+        P( B, C, D, E, A, R(74) ); P( A, B, C, D, E, R(75) );
+        P( E, A, B, C, D, R(76) ); P( D, E, A, B, C, R(77) );
+        P( C, D, E, A, B, R(78) ); P( B, C, D, E, A, R(79) );
+
+        #undef K
+        #undef F
+
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
     }
+}
 
-    A = state[0]; B = state[1]; C = state[2]; D = state[3]; E = state[4];
-
-    #define F(x,y,z) (z ^ (x & (y ^ z)))
-    #define K 0x5A827999
-
-    P( A, B, C, D, E, W[0]  ); P( E, A, B, C, D, W[1]  );
-    P( D, E, A, B, C, W[2]  ); P( C, D, E, A, B, W[3]  );
-    P( B, C, D, E, A, W[4]  ); P( A, B, C, D, E, W[5]  );
-    P( E, A, B, C, D, W[6]  ); P( D, E, A, B, C, W[7]  );
-    P( C, D, E, A, B, W[8]  ); P( B, C, D, E, A, W[9]  );
-    P( A, B, C, D, E, W[10] ); P( E, A, B, C, D, W[11] );
-    P( D, E, A, B, C, W[12] ); P( C, D, E, A, B, W[13] );
-    P( B, C, D, E, A, W[14] ); P( A, B, C, D, E, W[15] );
-    P( E, A, B, C, D, R(16) ); P( D, E, A, B, C, R(17) );
-    P( C, D, E, A, B, R(18) ); P( B, C, D, E, A, R(19) );
-
-    #undef K
-    #undef F
-
-    #define F(x,y,z) (x ^ y ^ z)
-    #define K 0x6ED9EBA1
-
-    P( A, B, C, D, E, R(20) ); P( E, A, B, C, D, R(21) );
-    P( D, E, A, B, C, R(22) ); P( C, D, E, A, B, R(23) );
-    P( B, C, D, E, A, R(24) ); P( A, B, C, D, E, R(25) );
-    P( E, A, B, C, D, R(26) ); P( D, E, A, B, C, R(27) );
-    P( C, D, E, A, B, R(28) ); P( B, C, D, E, A, R(29) );
-    P( A, B, C, D, E, R(30) ); P( E, A, B, C, D, R(31) );
-    P( D, E, A, B, C, R(32) ); P( C, D, E, A, B, R(33) );
-    P( B, C, D, E, A, R(34) ); P( A, B, C, D, E, R(35) );
-    P( E, A, B, C, D, R(36) ); P( D, E, A, B, C, R(37) );
-    P( C, D, E, A, B, R(38) ); P( B, C, D, E, A, R(39) );
-
-    #undef K
-    #undef F
-
-    #define F(x,y,z) ((x & y) | (z & (x | y)))
-    #define K 0x8F1BBCDC
-
-    P( A, B, C, D, E, R(40) ); P( E, A, B, C, D, R(41) );
-    P( D, E, A, B, C, R(42) ); P( C, D, E, A, B, R(43) );
-    P( B, C, D, E, A, R(44) ); P( A, B, C, D, E, R(45) );
-    P( E, A, B, C, D, R(46) ); P( D, E, A, B, C, R(47) );
-    P( C, D, E, A, B, R(48) ); P( B, C, D, E, A, R(49) );
-    P( A, B, C, D, E, R(50) ); P( E, A, B, C, D, R(51) );
-    P( D, E, A, B, C, R(52) ); P( C, D, E, A, B, R(53) );
-    P( B, C, D, E, A, R(54) ); P( A, B, C, D, E, R(55) );
-    P( E, A, B, C, D, R(56) ); P( D, E, A, B, C, R(57) );
-    P( C, D, E, A, B, R(58) ); P( B, C, D, E, A, R(59) );
-
-    #undef K
-    #undef F
-
-    #define F(x,y,z) (x ^ y ^ z)
-    #define K 0xCA62C1D6
-
-    P( A, B, C, D, E, R(60) ); P( E, A, B, C, D, R(61) );
-    P( D, E, A, B, C, R(62) ); P( C, D, E, A, B, R(63) );
-    P( B, C, D, E, A, R(64) ); P( A, B, C, D, E, R(65) );
-    P( E, A, B, C, D, R(66) ); P( D, E, A, B, C, R(67) );
-    P( C, D, E, A, B, R(68) ); P( B, C, D, E, A, R(69) );
-    P( A, B, C, D, E, R(70) ); P( E, A, B, C, D, R(71) );
-    P( D, E, A, B, C, R(72) ); P( C, D, E, A, B, R(73) );
-    P( B, C, D, E, A, R(74) ); P( A, B, C, D, E, R(75) );
-    P( E, A, B, C, D, R(76) ); P( D, E, A, B, C, R(77) );
-    P( C, D, E, A, B, R(78) ); P( B, C, D, E, A, R(79) );
-
-    #undef K
-    #undef F
-
-    state[0] += A;
-    state[1] += B;
-    state[2] += C;
-    state[3] += D;
-    state[4] += E;
+// the kernel pointer is resolved by s11nsha_dispatch.cpp; no per-block
+// feature checks here
+void s11nSHA::SHA1::process( const unsigned char *data, size_t blocks )
+{
+    process_kernel.load( std::memory_order_relaxed )( state, data, blocks );
 }
 
 s11nSHA::SHA1::SHA1()
@@ -177,6 +210,9 @@ void s11nSHA::SHA1::update( const unsigned char *input, size_t length )
     if( total[0] < static_cast<uint32_t>(length) )
         total[1]++;
 
+    // inputs of 4GB and more, e.g. a whole mmap'd file
+    total[1] += static_cast<uint32_t>( static_cast<uint64_t>(length) >> 32 );
+
     if( left && length >= fill )
     {
         std::memcpy( (buffer + left), input, fill );
@@ -186,17 +222,37 @@ void s11nSHA::SHA1::update( const unsigned char *input, size_t length )
         left = 0;
     }
 
-    while( length >= BLOCK_BYTES )
+    if( length >= BLOCK_BYTES )
     {
-        process( input );
-        input += BLOCK_BYTES;
-        length  -= BLOCK_BYTES;
+        size_t blocks = length / BLOCK_BYTES;
+        process( input, blocks );
+        input += blocks * BLOCK_BYTES;
+        length  -= blocks * BLOCK_BYTES;
     }
 
     if( length > 0 )
         std::memcpy( (buffer + left), input, length );
 }
 
+// segments that continue each other in memory, as readv() buffers carved
+// from one arena often do, go to update() as one run of blocks
+void s11nSHA::SHA1::update( const struct iovec *segments, size_t count )
+{
+    size_t i = 0;
+
+    while( i < count )
+    {
+        const unsigned char *input = (const unsigned char*) segments[i].iov_base;
+        size_t length = segments[i].iov_len;
+
+        for( ++i; i < count && length > 0
+                  && segments[i].iov_base == input + length; ++i )
+            length += segments[i].iov_len;
+
+        update( input, length );
+    }
+}
+
 void s11nSHA::SHA1::final( unsigned char digest[DIGEST_SIZE] )
 {
     uint32_t last, padn;
@@ -233,32 +289,76 @@ void s11nSHA::SHA1::calculate( const unsigned char *input, size_t length,
     init(); // reset for future use
 }
 
+// file hashing falls back to read() into a buffer of this size
+const size_t FILE_READ_BYTES = 1024*1024*4;
+const size_t FILE_BUFFER_ALIGN = 4096;
+
+// hash whatever is left to read on fd through one aligned buffer; used for
+// pipes, sockets and anything else mmap() refuses
+static bool update_from_read( s11nSHA::SHA1& sha1_object, int fd )
+{
+    void *buf;
+    ssize_t n;
+
+    if( posix_memalign( &buf, FILE_BUFFER_ALIGN, FILE_READ_BYTES ) != 0 )
+        return false;
+
+    while( ( n = read( fd, buf, FILE_READ_BYTES ) ) != 0 )
+    {
+        if( n < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            break;
+        }
+        sha1_object.update( (const unsigned char*) buf, (size_t) n );
+    }
+
+    free( buf );
+    return n == 0;
+}
+
+// regular files are mapped and hashed in place; a file truncated by someone
+// else while it is being hashed raises SIGBUS, as with any mmap reader
 bool s11nSHA::SHA1::calculate( const char *path,
                                unsigned char digest[DIGEST_SIZE] )
 {
-    FILE *f;
-    size_t n;
-    unsigned char buf[1024*4];
+    int fd;
+    struct stat st;
+    bool ok = false;
 
-    if( ( f = fopen( path, "rb" ) ) == NULL )
+    if( ( fd = open( path, O_RDONLY ) ) < 0 )
         return false;
 
     this->init();
 
-    while( ( n = fread( buf, 1, sizeof( buf ), f ) ) > 0 )
-        this->update( buf, n );
+    if( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 &&
+        (uint64_t) st.st_size <= SIZE_MAX )
+    {
+        size_t size = (size_t) st.st_size;
+        void *p = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+        if( p != MAP_FAILED )
+        {
+            madvise( p, size, MADV_SEQUENTIAL );
+            this->update( (const unsigned char*) p, size );
+            munmap( p, size );
+
+            // pick up anything appended since fstat()
+            if( lseek( fd, (off_t) size, SEEK_SET ) == (off_t) size )
+                ok = update_from_read( *this, fd );
+        }
+        else
+            ok = update_from_read( *this, fd );
+    }
+    else
+        ok = update_from_read( *this, fd );
 
     this->final( digest );
     this->init();
 
-    if( ferror(f) != 0 )
-    {
-        fclose(f);
-        return false;
-    }
-
-    fclose(f);
-    return true;
+    close( fd );
+    return ok;
 }
 
 void s11nSHA::marshall( std::string& s11n_sha1_object,
@@ -297,6 +397,161 @@ void s11nSHA::unmarshall( const std::string& s11n_sha1_object,
     }
 }
 
+void s11nSHA::marshall( unsigned char s11n_sha1_object[FIXED_S11N_BYTES],
+                        const SHA1& sha1_object )
+{
+    unsigned char *p = s11n_sha1_object;
+
+    p[0] = 'S';
+    p[1] = '1';
+    p[2] = FIXED_S11N_VERSION;
+    p[3] = 0;
+    p += 4;
+
+    PUT_UINT32_BE( sha1_object.total[0], p, 0 );
+    PUT_UINT32_BE( sha1_object.total[1], p, 4 );
+    p += 8;
+
+    for( unsigned int i = 0; i < DIGEST_INTS; ++i, p += 4 )
+        PUT_UINT32_BE( sha1_object.state[i], p, 0 );
+
+    std::memcpy( p, sha1_object.buffer, BLOCK_BYTES );
+}
+
+bool s11nSHA::unmarshall( const unsigned char *s11n_sha1_object,
+                          size_t length, SHA1& sha1_object )
+{
+    const unsigned char *p = s11n_sha1_object;
+
+    if( length != FIXED_S11N_BYTES || p[0] != 'S' || p[1] != '1' ||
+        p[2] != FIXED_S11N_VERSION )
+        return false;
+    p += 4;
+
+    GET_UINT32_BE( sha1_object.total[0], p, 0 );
+    GET_UINT32_BE( sha1_object.total[1], p, 4 );
+    p += 8;
+
+    for( unsigned int i = 0; i < DIGEST_INTS; ++i, p += 4 )
+        GET_UINT32_BE( sha1_object.state[i], p, 0 );
+
+    std::memcpy( sha1_object.buffer, p, BLOCK_BYTES );
+    return true;
+}
+
+size_t s11nSHA::compact_size( const SHA1& sha1_object, bool varint_length )
+{
+    uint64_t length = ( (uint64_t) sha1_object.total[1] << 32 )
+                    | sha1_object.total[0];
+    size_t needed = 2 + 4 * DIGEST_INTS + ( sha1_object.total[0] & 0x3F );
+
+    if( varint_length )
+        for( uint64_t n = length; ; n >>= 7 )
+        {
+            ++needed;
+            if( n < 0x80 )
+                break;
+        }
+    else
+        needed += 8;
+
+    return needed;
+}
+
+size_t s11nSHA::marshall_compact( unsigned char *s11n_sha1_object,
+                                  size_t capacity, const SHA1& sha1_object,
+                                  bool varint_length )
+{
+    unsigned char *p = s11n_sha1_object;
+    uint64_t length = ( (uint64_t) sha1_object.total[1] << 32 )
+                    | sha1_object.total[0];
+    uint32_t left = sha1_object.total[0] & 0x3F;
+    size_t needed = compact_size( sha1_object, varint_length );
+
+    if( capacity < needed )
+        return 0;
+
+    *p++ = 'S';
+    *p++ = ( COMPACT_S11N_VERSION << 4 )
+         | ( varint_length ? COMPACT_S11N_VARINT : 0 );
+
+    if( varint_length )
+    {
+        while( length >= 0x80 )
+        {
+            *p++ = (unsigned char) ( length | 0x80 );
+            length >>= 7;
+        }
+        *p++ = (unsigned char) length;
+    }
+    else
+    {
+        PUT_UINT32_BE( sha1_object.total[1], p, 0 );
+        PUT_UINT32_BE( sha1_object.total[0], p, 4 );
+        p += 8;
+    }
+
+    for( unsigned int i = 0; i < DIGEST_INTS; ++i, p += 4 )
+        PUT_UINT32_BE( sha1_object.state[i], p, 0 );
+
+    std::memcpy( p, sha1_object.buffer, left );
+    return needed;
+}
+
+size_t s11nSHA::unmarshall_compact( const unsigned char *s11n_sha1_object,
+                                    size_t length, SHA1& sha1_object )
+{
+    const unsigned char *p = s11n_sha1_object;
+    const unsigned char *end = s11n_sha1_object + length;
+    uint64_t total = 0;
+    uint32_t left;
+
+    if( length < 2 || p[0] != 'S' || ( p[1] >> 4 ) != COMPACT_S11N_VERSION ||
+        ( p[1] & 0x0F & ~COMPACT_S11N_VARINT ) != 0 )
+        return 0;
+
+    if( p[1] & COMPACT_S11N_VARINT )
+    {
+        p += 2;
+        for( unsigned int shift = 0; ; shift += 7 )
+        {
+            if( p == end || shift > 63 )
+                return 0;
+            total |= (uint64_t) ( *p & 0x7F ) << shift;
+            if( !( *p++ & 0x80 ) )
+                break;
+        }
+    }
+    else
+    {
+        uint32_t high, low;
+
+        p += 2;
+        if( end - p < 8 )
+            return 0;
+        GET_UINT32_BE( high, p, 0 );
+        GET_UINT32_BE( low,  p, 4 );
+        total = ( (uint64_t) high << 32 ) | low;
+        p += 8;
+    }
+
+    left = (uint32_t) total & 0x3F;
+    if( (size_t) ( end - p ) < 4 * DIGEST_INTS + left )
+        return 0;
+
+    sha1_object.total[0] = (uint32_t) total;
+    sha1_object.total[1] = (uint32_t) ( total >> 32 );
+
+    for( unsigned int i = 0; i < DIGEST_INTS; ++i, p += 4 )
+        GET_UINT32_BE( sha1_object.state[i], p, 0 );
+
+    std::memcpy( sha1_object.buffer, p, left );
+    std::memset( sha1_object.buffer + left, 0, BLOCK_BYTES - left );
+    p += left;
+
+    return p - s11n_sha1_object;
+}
+
 void s11nSHA::SHA1::dump()
 {
     printf( "total[0, 1] = [%u, %u]\n", total[0], total[1] );
@@ -36,6 +36,9 @@
 // std::string
 #include <string>
 
+// struct iovec
+#include <sys/uio.h>
+
 // boost archive and serialization
 #include <boost/serialization/serialization.hpp>
 
@@ -46,6 +49,19 @@ namespace s11nSHA
     const unsigned int BLOCK_INTS = 16;  // 32bit integers per SHA1 block
     const unsigned int BLOCK_BYTES = BLOCK_INTS * 4;
 
+    // fixed binary format: magic "S1", version, reserved byte, then
+    // total[2], state[5] big endian and the raw 64 byte block buffer
+    const unsigned char FIXED_S11N_VERSION = 1;
+    const unsigned int FIXED_S11N_BYTES = 4 + 4 * ( 2 + DIGEST_INTS ) + BLOCK_BYTES;
+
+    // compact format: magic 'S', version/flags byte, message length in bytes
+    // (8 byte big endian or LEB128 varint), state[5] big endian, then only
+    // the live ( length % 64 ) bytes of the block buffer
+    const unsigned char COMPACT_S11N_VERSION = 1;
+    const unsigned char COMPACT_S11N_VARINT = 0x01;  // flag: varint length
+    const unsigned int COMPACT_S11N_MAX_BYTES = 2 + 10 + 4 * DIGEST_INTS
+                                              + BLOCK_BYTES - 1;
+
     const unsigned char SHA1_PADDING[BLOCK_BYTES] =
         { 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
              0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -63,6 +79,11 @@ namespace s11nSHA
         // process more input
         void update( const unsigned char *input, size_t length );
 
+        // process count segments as if they were one contiguous input, e.g.
+        // a chain of network buffers; blocks are compressed in place and
+        // only a block straddling two segments is assembled in buffer
+        void update( const struct iovec *segments, size_t count );
+
         // compute hash for current message, then restart for a new message
         void final( unsigned char digest[DIGEST_SIZE] );
 
@@ -79,7 +100,8 @@ namespace s11nSHA
 
     private:
         // helper methods 
-        void process( const unsigned char data[BLOCK_BYTES] );
+        // compress `blocks` full blocks using the kernel picked for this CPU
+        void process( const unsigned char *data, size_t blocks = 1 );
 
         uint32_t total[2];                 // number of bytes processed
         uint32_t state[DIGEST_INTS];       // intermediate digest state
@@ -87,6 +109,27 @@ namespace s11nSHA
 
         friend class boost::serialization::access;
 
+        // keeps states in its own struct-of-arrays slabs
+        friend class SessionManager;
+
+        // drives state[] and total[] of many objects directly
+        friend void update_multi( SHA1 *const contexts[],
+                                  const unsigned char *const inputs[],
+                                  const size_t lengths[], size_t count );
+
+        friend void marshall( unsigned char s11n_sha1_object[FIXED_S11N_BYTES],
+                              const SHA1& sha1_object );
+        friend bool unmarshall( const unsigned char *s11n_sha1_object,
+                                size_t length, SHA1& sha1_object );
+        friend size_t compact_size( const SHA1& sha1_object,
+                                    bool varint_length );
+        friend size_t marshall_compact( unsigned char *s11n_sha1_object,
+                                        size_t capacity,
+                                        const SHA1& sha1_object,
+                                        bool varint_length );
+        friend size_t unmarshall_compact( const unsigned char *s11n_sha1_object,
+                                          size_t length, SHA1& sha1_object );
+
         template <typename Archive>
         void serialize( Archive &ar, const unsigned int version ) 
         { 
@@ -104,6 +147,32 @@ namespace s11nSHA
     void unmarshall( const std::string& s11n_sha1_object, SHA1& sha1_object,
                                                   bool from_binary = false );
 
+    // serialize SHA1 object into a caller supplied FIXED_S11N_BYTES record;
+    // portable, no allocation and no iostreams
+    void marshall( unsigned char s11n_sha1_object[FIXED_S11N_BYTES],
+                   const SHA1& sha1_object );
+
+    // deserialize SHA1 object from a record written by above; returns false
+    // and leaves sha1_object untouched if length, magic or version is wrong
+    bool unmarshall( const unsigned char *s11n_sha1_object, size_t length,
+                     SHA1& sha1_object );
+
+    // bytes marshall_compact() writes for sha1_object, so that a buffer of
+    // many records can be sized exactly
+    size_t compact_size( const SHA1& sha1_object, bool varint_length = true );
+
+    // serialize SHA1 object in the compact format into at most capacity
+    // bytes; COMPACT_S11N_MAX_BYTES is always enough. returns the number of
+    // bytes written, or 0 if capacity is too small
+    size_t marshall_compact( unsigned char *s11n_sha1_object, size_t capacity,
+                             const SHA1& sha1_object, bool varint_length = true );
+
+    // deserialize SHA1 object from the compact format; returns the number
+    // of bytes consumed, or 0 (leaving sha1_object untouched) if the input
+    // is truncated or malformed
+    size_t unmarshall_compact( const unsigned char *s11n_sha1_object,
+                               size_t length, SHA1& sha1_object );
+
 } // end of namespace s11nSHA
 
 #endif
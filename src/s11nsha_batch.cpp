@@ -0,0 +1,175 @@
+// g++ -Wall -c -std=c++0x s11nsha_batch.cpp
+// implementation of s11nsha_batch.hpp
+
+#include "s11nsha_batch.hpp"
+
+// std::sort
+#include <algorithm>
+
+// std::pair
+#include <utility>
+
+// std::vector
+#include <vector>
+
+static void put_uint32( unsigned char *p, uint32_t n )
+{
+    p[0] = (unsigned char) ( n >> 24 );
+    p[1] = (unsigned char) ( n >> 16 );
+    p[2] = (unsigned char) ( n >>  8 );
+    p[3] = (unsigned char) ( n       );
+}
+
+static uint32_t get_uint32( const unsigned char *p )
+{
+    return ( (uint32_t) p[0] << 24 ) | ( (uint32_t) p[1] << 16 )
+         | ( (uint32_t) p[2] <<  8 ) | ( (uint32_t) p[3]       );
+}
+
+bool s11nSHA::marshall_batch( std::string& s11n_batch,
+                              const SHA1 *const objects[],
+                              const uint64_t keys[], size_t count )
+{
+    // the header count and the index offsets are 32 bit
+    if( count > BATCH_MAX_OBJECTS )
+    {
+        s11n_batch.clear();
+        return false;
+    }
+
+    std::vector< std::pair<uint64_t, size_t> > order( count );
+    for( size_t i = 0; i < count; ++i )
+        order[i] = std::make_pair( keys[i], i );
+    std::sort( order.begin(), order.end() );
+
+    // sized exactly, so a large batch does not keep room for the longest
+    // possible record of every object
+    size_t payload = BATCH_HEADER_BYTES + count * BATCH_INDEX_BYTES;
+    size_t total = payload;
+    for( size_t i = 0; i < count; ++i )
+        total += compact_size( *objects[i] );
+    s11n_batch.resize( total );
+    unsigned char *out = (unsigned char*) &s11n_batch[0];
+
+    out[0] = 'S';
+    out[1] = 'B';
+    out[2] = BATCH_S11N_VERSION;
+    out[3] = 0;
+    put_uint32( out + 4, (uint32_t) count );
+
+    unsigned char *index = out + BATCH_HEADER_BYTES;
+    for( size_t i = 0; i < count; ++i, index += BATCH_INDEX_BYTES )
+    {
+        size_t n = marshall_compact( out + payload, total - payload,
+                                     *objects[order[i].second] );
+
+        put_uint32( index,     (uint32_t) ( order[i].first >> 32 ) );
+        put_uint32( index + 4, (uint32_t) order[i].first );
+        put_uint32( index + 8, (uint32_t) payload );
+        put_uint32( index + 12, (uint32_t) n );
+        payload += n;
+    }
+
+    return true;
+}
+
+s11nSHA::BatchReader::BatchReader()
+    : data( NULL ), length( 0 ), count( 0 )
+{
+}
+
+bool s11nSHA::BatchReader::open( const unsigned char *data, size_t length )
+{
+    this->data = NULL;
+    this->length = 0;
+    this->count = 0;
+
+    if( length < BATCH_HEADER_BYTES || data[0] != 'S' || data[1] != 'B' ||
+        data[2] != BATCH_S11N_VERSION )
+        return false;
+
+    size_t count = get_uint32( data + 4 );
+    if( ( length - BATCH_HEADER_BYTES ) / BATCH_INDEX_BYTES < count )
+        return false;
+
+    // every record must lie inside the buffer, after the index
+    size_t payload = BATCH_HEADER_BYTES + count * BATCH_INDEX_BYTES;
+    const unsigned char *index = data + BATCH_HEADER_BYTES;
+    for( size_t i = 0; i < count; ++i, index += BATCH_INDEX_BYTES )
+    {
+        size_t offset = get_uint32( index + 8 );
+        size_t size = get_uint32( index + 12 );
+        if( offset < payload || offset > length || size > length - offset )
+            return false;
+    }
+
+    this->data = data;
+    this->length = length;
+    this->count = count;
+    return true;
+}
+
+size_t s11nSHA::BatchReader::size() const
+{
+    return count;
+}
+
+uint64_t s11nSHA::BatchReader::key( size_t i ) const
+{
+    const unsigned char *index = data + BATCH_HEADER_BYTES
+                               + i * BATCH_INDEX_BYTES;
+
+    return ( (uint64_t) get_uint32( index ) << 32 ) | get_uint32( index + 4 );
+}
+
+bool s11nSHA::BatchReader::restore( size_t i, SHA1& sha1_object ) const
+{
+    if( i >= count )
+        return false;
+
+    const unsigned char *index = data + BATCH_HEADER_BYTES
+                               + i * BATCH_INDEX_BYTES;
+    size_t size = get_uint32( index + 12 );
+
+    return unmarshall_compact( data + get_uint32( index + 8 ), size,
+                               sha1_object ) == size;
+}
+
+bool s11nSHA::BatchReader::find( uint64_t key, SHA1& sha1_object ) const
+{
+    size_t low = 0, high = count;
+
+    while( low < high )
+    {
+        size_t mid = low + ( high - low ) / 2;
+        if( this->key( mid ) < key )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if( low == count || this->key( low ) != key )
+        return false;
+
+    return restore( low, sha1_object );
+}
+
+size_t s11nSHA::unmarshall_batch( const std::string& s11n_batch,
+                                  SHA1 objects[], uint64_t keys[],
+                                  size_t capacity )
+{
+    BatchReader reader;
+
+    if( !reader.open( (const unsigned char*) s11n_batch.data(),
+                      s11n_batch.size() ) || reader.size() > capacity )
+        return 0;
+
+    for( size_t i = 0; i < reader.size(); ++i )
+    {
+        if( !reader.restore( i, objects[i] ) )
+            return 0;
+        keys[i] = reader.key( i );
+    }
+
+    return reader.size();
+}
@@ -0,0 +1,84 @@
+/**
+ *  Batch checkpointing of many s11nSHA::SHA1 objects into one buffer
+ *
+ *  Layout (all integers big endian):
+ *      header  : magic "SB", version, reserved byte, uint32 count
+ *      index   : count entries of uint64 key, uint32 offset, uint32 length,
+ *                sorted by key; offset is from the start of the buffer
+ *      payload : one marshall_compact() record per object
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_BATCH_HPP
+#define S11NSHA_BATCH_HPP
+
+// uint32_t, uint64_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// std::string
+#include <string>
+
+// s11nSHA::SHA1, COMPACT_S11N_MAX_BYTES
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    const unsigned char BATCH_S11N_VERSION = 1;
+    const unsigned int BATCH_HEADER_BYTES = 8;
+    const unsigned int BATCH_INDEX_BYTES = 16;  // per object
+
+    // most objects in a batch: any more could push an offset past 32 bits
+    const size_t BATCH_MAX_OBJECTS = ( 0xFFFFFFFFu - BATCH_HEADER_BYTES )
+                                   / ( BATCH_INDEX_BYTES + COMPACT_S11N_MAX_BYTES );
+
+    // serialize count objects, tagged with caller supplied keys, into one
+    // contiguous buffer with a single allocation. keys should be unique;
+    // with duplicates find() returns any one of them. false, with
+    // s11n_batch emptied, if count is above BATCH_MAX_OBJECTS
+    bool marshall_batch( std::string& s11n_batch, const SHA1 *const objects[],
+                         const uint64_t keys[], size_t count );
+
+    // read-only view of a buffer written by marshall_batch(); restores any
+    // object, or all of them, straight from the buffer without allocating
+    class BatchReader
+    {
+    public:
+        BatchReader();
+
+        // check header and index; false if the buffer is not a valid batch
+        bool open( const unsigned char *data, size_t length );
+
+        // number of objects in the batch
+        size_t size() const;
+
+        // key of the i-th object; objects are ordered by key
+        uint64_t key( size_t i ) const;
+
+        // restore the i-th object; false if its record is corrupt
+        bool restore( size_t i, SHA1& sha1_object ) const;
+
+        // restore the object stored under key; false if there is none
+        bool find( uint64_t key, SHA1& sha1_object ) const;
+
+    private:
+        const unsigned char *data;
+        size_t length;
+        size_t count;
+    };
+
+    // restore every object of a batch into objects[0 .. size) and keys[]
+    // (in key order); returns the number restored, or 0 if the buffer is
+    // invalid or holds more than capacity objects
+    size_t unmarshall_batch( const std::string& s11n_batch, SHA1 objects[],
+                             uint64_t keys[], size_t capacity );
+
+} // end of namespace s11nSHA
+
+#endif
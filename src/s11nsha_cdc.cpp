@@ -0,0 +1,325 @@
+// g++ -Wall -c -std=c++0x s11nsha_cdc.cpp
+// implementation of s11nsha_cdc.hpp
+
+#include "s11nsha_cdc.hpp"
+
+// std::vector
+#include <vector>
+
+// std::min
+#include <algorithm>
+
+// std::thread
+#include <thread>
+
+namespace
+{
+    // 256 random words from a fixed splitmix64 seed, so that cut points
+    // never change between builds
+    struct GearTable
+    {
+        GearTable()
+        {
+            uint64_t seed = 0x5331314E53484131ULL;  // "S11NSHA1"
+            for( int i = 0; i < 256; ++i )
+            {
+                uint64_t z = ( seed += 0x9E3779B97F4A7C15ULL );
+                z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+                z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+                words[i] = z ^ ( z >> 31 );
+            }
+        }
+
+        uint64_t words[256];
+    };
+
+    const GearTable GEAR;
+
+    struct Limits
+    {
+        explicit Limits( unsigned int avg_shift )
+            : min( (uint64_t) 1 << ( avg_shift - 2 ) ),
+              avg( (uint64_t) 1 << avg_shift ),
+              max( (uint64_t) 1 << ( avg_shift + 3 ) ),
+              // bit i of the hash depends on the last i + 1 bytes only,
+              // so the masks test the top bits
+              strict( ~(uint64_t) 0 << ( 64 - ( avg_shift + 2 ) ) ),
+              loose( ~(uint64_t) 0 << ( 64 - ( avg_shift - 2 ) ) ) {}
+
+        uint64_t min, avg, max;
+        uint64_t strict;  // below avg
+        uint64_t loose;   // from avg on
+    };
+
+    // continue a chunk that already holds `have` bytes with rolling hash
+    // gear over data[0 .. length). returns how many bytes belong to the
+    // chunk; cut tells whether it ends there or goes on past length
+    size_t scan( const Limits& limits, const unsigned char *data,
+                 size_t length, uint64_t have, uint64_t& gear, bool& cut )
+    {
+        size_t i = 0;
+        cut = false;
+
+        // bytes below the minimum can never be a cut point
+        if( have < limits.min )
+            i = (size_t) std::min<uint64_t>( length, limits.min - have );
+
+        size_t end = (size_t) std::min<uint64_t>( length, limits.avg - std::min( have, limits.avg ) );
+        for( ; i < end; ++i )
+        {
+            gear = ( gear << 1 ) + GEAR.words[data[i]];
+            if( !( gear & limits.strict ) )
+            {
+                cut = true;
+                return i + 1;
+            }
+        }
+
+        end = (size_t) std::min<uint64_t>( length, limits.max - have );
+        for( ; i < end; ++i )
+        {
+            gear = ( gear << 1 ) + GEAR.words[data[i]];
+            if( !( gear & limits.loose ) )
+            {
+                cut = true;
+                return i + 1;
+            }
+        }
+
+        cut = have + i == limits.max;
+        return i;
+    }
+
+    // chunk starting at data[pos], cut at the latest at the end of data
+    size_t next_chunk( const Limits& limits, const unsigned char *data,
+                       size_t length, size_t pos, uint64_t base,
+                       std::vector<s11nSHA::Chunk>& out )
+    {
+        uint64_t gear = 0;
+        bool cut;
+        s11nSHA::Chunk chunk;
+        s11nSHA::SHA1 sha1;
+
+        chunk.offset = base + pos;
+        chunk.length = scan( limits, data + pos, length - pos, 0, gear, cut );
+        sha1.calculate( data + pos, (size_t) chunk.length, chunk.digest );
+        out.push_back( chunk );
+        return (size_t) chunk.length;
+    }
+
+    // chunks of data[begin .. ) as if a chunk started at begin, up to the
+    // first cut at or past stop
+    void chunk_slice( const Limits& limits, const unsigned char *data,
+                      size_t length, size_t begin, size_t stop, uint64_t base,
+                      std::vector<s11nSHA::Chunk>& out )
+    {
+        for( size_t pos = begin; pos < length && ( pos == begin || pos < stop ); )
+            pos += next_chunk( limits, data, length, pos, base, out );
+    }
+
+    // chunks of data[0 .. length) on up to `threads` threads; the last
+    // one ends at length, cut or not
+    void chunk_parallel( const Limits& limits, const unsigned char *data,
+                         size_t length, uint64_t base, unsigned int threads,
+                         std::vector<s11nSHA::Chunk>& out )
+    {
+        // slices much longer than a chunk keep the stitching cheap
+        size_t slices = (size_t) std::min<uint64_t>( threads,
+                                                     length / ( limits.max * 16 ) );
+        if( slices < 1 )
+            slices = 1;
+
+        std::vector<size_t> starts( slices + 1 );
+        for( size_t i = 0; i <= slices; ++i )
+            starts[i] = (size_t) ( (uint64_t) length * i / slices );
+
+        std::vector<std::vector<s11nSHA::Chunk> > parts( slices );
+        std::vector<std::thread> workers;
+        for( size_t i = 1; i < slices; ++i )
+            workers.push_back( std::thread( chunk_slice, std::cref( limits ), data,
+                                            length, starts[i], starts[i + 1], base,
+                                            std::ref( parts[i] ) ) );
+        chunk_slice( limits, data, length, 0, starts[1], base, parts[0] );
+        for( size_t i = 0; i < workers.size(); ++i )
+            workers[i].join();
+
+        // slice 0 starts at a true cut. follow the true cuts into each
+        // next slice until one of them is a cut that slice also made;
+        // from there on the slice's chunks are the true ones
+        out.swap( parts[0] );
+        size_t pos = out.empty() ? 0 : (size_t) ( out.back().offset - base
+                                                  + out.back().length );
+        for( size_t i = 1; i < slices; ++i )
+        {
+            const std::vector<s11nSHA::Chunk>& part = parts[i];
+            size_t j = 0;
+            for( ;; )
+            {
+                while( j < part.size() && part[j].offset - base < pos )
+                    ++j;
+                if( j == part.size() || part[j].offset - base == pos )
+                    break;
+                pos += next_chunk( limits, data, length, pos, base, out );
+            }
+            if( j < part.size() )
+            {
+                out.insert( out.end(), part.begin() + j, part.end() );
+                pos = (size_t) ( out.back().offset - base + out.back().length );
+            }
+        }
+        while( pos < length )
+            pos += next_chunk( limits, data, length, pos, base, out );
+    }
+
+} // end of anonymous namespace
+
+s11nSHA::Chunker::Chunker( unsigned int avg_shift )
+    : avg_shift( CDC_DEFAULT_AVG_SHIFT ), threads( 1 )
+{
+    if( !init( avg_shift ) )
+        init();
+}
+
+bool s11nSHA::Chunker::init( unsigned int avg_shift )
+{
+    if( avg_shift < CDC_MIN_AVG_SHIFT || avg_shift > CDC_MAX_AVG_SHIFT )
+        return false;
+
+    this->avg_shift = avg_shift;
+    total = 0;
+    pending = 0;
+    gear = 0;
+    sha1.init();
+    return true;
+}
+
+void s11nSHA::Chunker::set_threads( unsigned int threads )
+{
+    if( threads == 0 )
+        threads = std::thread::hardware_concurrency();
+    this->threads = threads ? threads : 1;
+}
+
+void s11nSHA::Chunker::update( const unsigned char *input, size_t length,
+                               const ChunkCallback& emit )
+{
+    Limits limits( avg_shift );
+    bool parallel = threads > 1;
+
+    while( length > 0 )
+    {
+        // at a cut with plenty of input left: fan out. the last chunk may
+        // end at the end of input instead of a cut, so it is left to the
+        // serial scan below, which also carries it into the next call
+        if( parallel && pending == 0 && length >= CDC_PARALLEL_BYTES )
+        {
+            std::vector<Chunk> chunks;
+            chunk_parallel( limits, input, length, total, threads, chunks );
+            chunks.pop_back();
+
+            size_t done = 0;
+            for( size_t i = 0; i < chunks.size(); ++i )
+            {
+                emit( chunks[i] );
+                done += (size_t) chunks[i].length;
+            }
+            total += done;
+            input += done;
+            length -= done;
+            parallel = false;
+            continue;
+        }
+
+        bool cut;
+        size_t n = scan( limits, input, length, pending, gear, cut );
+        sha1.update( input, n );
+        pending += n;
+        total += n;
+        input += n;
+        length -= n;
+
+        if( cut )
+            emit_open( emit );
+    }
+}
+
+void s11nSHA::Chunker::emit_open( const ChunkCallback& emit )
+{
+    Chunk chunk;
+    chunk.offset = total - pending;
+    chunk.length = pending;
+    sha1.final( chunk.digest );
+    pending = 0;
+    gear = 0;
+    emit( chunk );
+}
+
+void s11nSHA::Chunker::final( const ChunkCallback& emit )
+{
+    if( pending > 0 )
+        emit_open( emit );
+    init( avg_shift );
+}
+
+uint64_t s11nSHA::Chunker::offset() const
+{
+    return total;
+}
+
+void s11nSHA::marshall_chunker( std::string& s11n_chunker_object,
+                                const Chunker& chunker_object )
+{
+    unsigned char record[FIXED_S11N_BYTES];
+    marshall( record, chunker_object.sha1 );
+
+    const uint64_t words[3] = { chunker_object.total, chunker_object.pending,
+                                chunker_object.gear };
+
+    s11n_chunker_object.clear();
+    s11n_chunker_object.reserve( CDC_S11N_BYTES );
+    s11n_chunker_object.push_back( 'S' );
+    s11n_chunker_object.push_back( 'C' );
+    s11n_chunker_object.push_back( (char) CDC_S11N_VERSION );
+    s11n_chunker_object.push_back( (char) chunker_object.avg_shift );
+    for( int w = 0; w < 3; ++w )
+        for( int i = 0; i < 8; ++i )
+            s11n_chunker_object.push_back( (char) ( words[w] >> ( 56 - 8 * i ) ) );
+    s11n_chunker_object.append( (const char*) record, sizeof( record ) );
+}
+
+bool s11nSHA::unmarshall_chunker( const unsigned char *s11n_chunker_object,
+                                  size_t length, Chunker& chunker_object )
+{
+    const unsigned char *p = s11n_chunker_object;
+
+    if( length != CDC_S11N_BYTES || p[0] != 'S' || p[1] != 'C'
+        || p[2] != CDC_S11N_VERSION
+        || p[3] < CDC_MIN_AVG_SHIFT || p[3] > CDC_MAX_AVG_SHIFT )
+        return false;
+
+    uint64_t words[3] = { 0, 0, 0 };
+    for( int w = 0; w < 3; ++w )
+        for( int i = 0; i < 8; ++i )
+            words[w] = ( words[w] << 8 ) | p[4 + 8 * w + i];
+
+    // the open chunk must be shorter than the maximum, and its SHA1 must
+    // hold exactly its bytes: total[] is the first field of the record
+    SHA1 sha1;
+    const unsigned char *record = p + 4 + 8 * 3;
+    if( !unmarshall( record, FIXED_S11N_BYTES, sha1 ) )
+        return false;
+    uint64_t hashed = ( (uint64_t) record[8] << 24 | (uint64_t) record[9] << 16
+                      | (uint64_t) record[10] << 8 | record[11] ) << 32
+                    | ( (uint64_t) record[4] << 24 | (uint64_t) record[5] << 16
+                      | (uint64_t) record[6] << 8 | record[7] );
+    Limits limits( p[3] );
+    if( words[1] > words[0] || words[1] >= limits.max || hashed != words[1] )
+        return false;
+
+    chunker_object.avg_shift = p[3];
+    chunker_object.total = words[0];
+    chunker_object.pending = words[1];
+    chunker_object.gear = words[2];
+    chunker_object.sha1 = sha1;
+    return true;
+}
@@ -0,0 +1,122 @@
+/**
+ *  Content defined chunking: cut a stream into variable size chunks at
+ *  offsets picked by a rolling Gear hash (FastCDC style) and SHA-1 each
+ *  chunk, so that inserting or deleting bytes only changes the chunks
+ *  around the edit and deduplication by chunk digest keeps working.
+ *
+ *  With A = 2^avg_shift the chunks are at least A / 4 and at most 8 A
+ *  bytes long (only the last one may be shorter). Bytes below the minimum
+ *  are never looked at by the rolling hash; up to A a stricter mask is
+ *  used than after it, which pulls the sizes towards A. Each chunk is
+ *  hashed right after it is scanned, while it is still in cache.
+ *
+ *  Cut points depend only on the bytes since the previous cut, so large
+ *  inputs are split between threads: every thread chunks its own slice
+ *  from an arbitrary start, and the slices are stitched together where
+ *  a thread's cuts meet the true ones, which takes a chunk or two. The
+ *  records are the same for any thread count and any update() sizes.
+ *
+ *  Partial state (marshall_chunker), all integers big endian:
+ *      magic "SC", version, avg_shift, uint64 bytes processed, uint64
+ *      bytes in the open chunk, uint64 rolling hash, then the
+ *      FIXED_S11N_BYTES marshall() record of the open chunk's SHA1
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_CDC_HPP
+#define S11NSHA_CDC_HPP
+
+// uint64_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// std::string
+#include <string>
+
+// std::function
+#include <functional>
+
+// s11nSHA::SHA1, DIGEST_SIZE, FIXED_S11N_BYTES
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    const unsigned char CDC_S11N_VERSION = 1;
+    const unsigned int CDC_S11N_BYTES = 4 + 8 * 3 + FIXED_S11N_BYTES;
+    const unsigned int CDC_MIN_AVG_SHIFT = 8;   // 256 bytes
+    const unsigned int CDC_MAX_AVG_SHIFT = 24;  // 16 MiB
+    const unsigned int CDC_DEFAULT_AVG_SHIFT = 13;  // 8 KiB
+
+    // update() inputs at least this long are chunked on all threads
+    const size_t CDC_PARALLEL_BYTES = 1024*1024*4;
+
+    struct Chunk
+    {
+        uint64_t offset;  // in the whole stream
+        uint64_t length;
+        unsigned char digest[DIGEST_SIZE];
+    };
+
+    // receives the chunks in stream order
+    typedef std::function<void( const Chunk& chunk )> ChunkCallback;
+
+    class Chunker
+    {
+    public:
+        Chunker( unsigned int avg_shift = CDC_DEFAULT_AVG_SHIFT );
+
+        // restart at offset 0 with a new average size; false (and no
+        // change) if it is outside [ CDC_MIN_AVG_SHIFT, CDC_MAX_AVG_SHIFT ]
+        bool init( unsigned int avg_shift = CDC_DEFAULT_AVG_SHIFT );
+
+        // worker threads for large update() inputs; 0 = hardware
+        // concurrency, 1 (the default) keeps everything on the calling
+        // thread
+        void set_threads( unsigned int threads );
+
+        // process more input; emit is called for every chunk completed
+        void update( const unsigned char *input, size_t length,
+                     const ChunkCallback& emit );
+
+        // emit the open chunk, if it has any bytes, then restart with
+        // the same average size
+        void final( const ChunkCallback& emit );
+
+        // bytes processed so far
+        uint64_t offset() const;
+
+    private:
+        void emit_open( const ChunkCallback& emit );
+
+        unsigned int avg_shift;
+        unsigned int threads;
+        uint64_t total;    // bytes processed
+        uint64_t pending;  // bytes in the open chunk
+        uint64_t gear;     // rolling hash of the open chunk
+        SHA1 sha1;         // the open chunk
+
+        friend void marshall_chunker( std::string& s11n_chunker_object,
+                                      const Chunker& chunker_object );
+        friend bool unmarshall_chunker( const unsigned char *s11n_chunker_object,
+                                        size_t length, Chunker& chunker_object );
+    }; // end of class Chunker
+
+    // serialize the chunker so that chunking can resume elsewhere
+    void marshall_chunker( std::string& s11n_chunker_object,
+                           const Chunker& chunker_object );
+
+    // restore a chunker written by above; returns false and leaves
+    // chunker_object untouched if the record is truncated or malformed.
+    // the thread count of chunker_object is kept
+    bool unmarshall_chunker( const unsigned char *s11n_chunker_object,
+                             size_t length, Chunker& chunker_object );
+
+} // end of namespace s11nSHA
+
+#endif
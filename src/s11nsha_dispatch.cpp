@@ -0,0 +1,155 @@
+// g++ -Wall -c -std=c++0x s11nsha_dispatch.cpp
+// CPU feature checks and kernel dispatch; see s11nsha_kernels.hpp
+
+#include "s11nsha_kernels.hpp"
+
+// std::getenv
+#include <cstdlib>
+
+// std::strcmp
+#include <cstring>
+
+#ifdef S11NSHA_X86
+
+// __get_cpuid, __get_cpuid_count
+#include <cpuid.h>
+
+bool s11nSHA::cpu_has_ssse3()
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    // leaf 1: ecx bit 9 = SSSE3
+    if( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) )
+        return false;
+    return ( ecx & ( 1u << 9 ) ) != 0;
+}
+
+bool s11nSHA::cpu_has_shani()
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    // leaf 1: ecx bit 9 = SSSE3, ecx bit 19 = SSE4.1
+    if( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) )
+        return false;
+    if( !( ecx & ( 1u << 9 ) ) || !( ecx & ( 1u << 19 ) ) )
+        return false;
+
+    // leaf 7, subleaf 0: ebx bit 29 = SHA
+    if( !__get_cpuid_count( 7, 0, &eax, &ebx, &ecx, &edx ) )
+        return false;
+    return ( ebx & ( 1u << 29 ) ) != 0;
+}
+
+// these also check that the OS saves the wider registers (XCR0)
+bool s11nSHA::cpu_has_avx2()
+{
+    return __builtin_cpu_supports( "avx2" );
+}
+
+bool s11nSHA::cpu_has_avx512()
+{
+    return __builtin_cpu_supports( "avx512f" );
+}
+
+#endif // S11NSHA_X86
+
+namespace
+{
+    bool always_supported()
+    {
+        return true;
+    }
+
+    struct kernel_entry
+    {
+        const char *name;
+        s11nSHA::process_fn process;
+        bool (*supported)();
+    };
+
+    // fastest first
+    const kernel_entry kernels[] =
+    {
+#ifdef S11NSHA_X86
+        { "shani",  s11nSHA::process_shani,  s11nSHA::cpu_has_shani  },
+        { "avx2",   s11nSHA::process_avx2,   s11nSHA::cpu_has_avx2   },
+        { "ssse3",  s11nSHA::process_ssse3,  s11nSHA::cpu_has_ssse3  },
+#endif
+        { "scalar", s11nSHA::process_scalar, always_supported        }
+    };
+
+    const size_t kernel_count = sizeof( kernels ) / sizeof( kernels[0] );
+
+    const kernel_entry *find_kernel( const char *name )
+    {
+        if( name == NULL )
+            return NULL;
+
+        for( size_t i = 0; i < kernel_count; ++i )
+            if( std::strcmp( kernels[i].name, name ) == 0 )
+                return kernels[i].supported() ? &kernels[i] : NULL;
+
+        return NULL;
+    }
+
+    s11nSHA::process_fn best_kernel()
+    {
+        for( size_t i = 0; i < kernel_count; ++i )
+            if( kernels[i].supported() )
+                return kernels[i].process;
+
+        return s11nSHA::process_scalar;
+    }
+
+    s11nSHA::process_fn resolve_kernel()
+    {
+        const kernel_entry *pinned = find_kernel( std::getenv( s11nSHA::KERNEL_ENV ) );
+        s11nSHA::process_fn kernel = pinned ? pinned->process : best_kernel();
+
+        s11nSHA::process_kernel.store( kernel, std::memory_order_relaxed );
+        return kernel;
+    }
+
+    void process_resolve( uint32_t state[s11nSHA::DIGEST_INTS],
+                          const unsigned char *data, size_t blocks )
+    {
+        resolve_kernel()( state, data, blocks );
+    }
+}
+
+std::atomic<s11nSHA::process_fn> s11nSHA::process_kernel( process_resolve );
+
+const char *s11nSHA::kernel_name()
+{
+    process_fn kernel = process_kernel.load( std::memory_order_relaxed );
+
+    if( kernel == process_resolve )
+        kernel = resolve_kernel();
+
+    for( size_t i = 0; i < kernel_count; ++i )
+        if( kernels[i].process == kernel )
+            return kernels[i].name;
+
+    return "unknown";
+}
+
+bool s11nSHA::kernel_supported( const char *name )
+{
+    return find_kernel( name ) != NULL;
+}
+
+bool s11nSHA::set_kernel( const char *name )
+{
+    const kernel_entry *kernel = find_kernel( name );
+
+    if( kernel == NULL )
+        return false;
+
+    process_kernel.store( kernel->process, std::memory_order_relaxed );
+    return true;
+}
+
+void s11nSHA::reset_kernel()
+{
+    process_kernel.store( best_kernel(), std::memory_order_relaxed );
+}
@@ -0,0 +1,195 @@
+// g++ -Wall -c -std=c++0x -pthread s11nsha_files.cpp
+// implementation of s11nsha_files.hpp
+
+#include "s11nsha_files.hpp"
+
+// s11nSHA::calculate_pipelined
+#include "s11nsha_pipeline.hpp"
+
+// std::sort
+#include <algorithm>
+
+// std::atomic
+#include <atomic>
+
+// std::deque
+#include <deque>
+
+// std::mutex, std::lock_guard
+#include <mutex>
+
+// std::thread
+#include <thread>
+
+// std::vector
+#include <vector>
+
+// errno, EIO
+#include <cerrno>
+
+// stat, S_ISREG
+#include <sys/stat.h>
+
+namespace
+{
+    // files order[first .. last) of the size sorted order
+    struct task
+    {
+        size_t first;
+        size_t last;
+    };
+
+    // owner takes from the front (largest work first), thieves from the
+    // back; a plain mutex is enough at one lock per file or batch
+    struct worker_queue
+    {
+        std::mutex lock;
+        std::deque<task> tasks;
+    };
+
+    struct pool
+    {
+        const char *const *paths;
+        s11nSHA::FileResult *results;
+        std::vector<size_t> order;
+        std::vector<uint64_t> sizes;
+        uint64_t large_file_bytes;
+        std::vector<worker_queue> queues;
+        std::atomic<size_t> hashed_ok;
+    };
+
+    bool take( worker_queue& q, task& t, bool own )
+    {
+        std::lock_guard<std::mutex> guard( q.lock );
+        if( q.tasks.empty() )
+            return false;
+        if( own )
+        {
+            t = q.tasks.front();
+            q.tasks.pop_front();
+        }
+        else
+        {
+            t = q.tasks.back();
+            q.tasks.pop_back();
+        }
+        return true;
+    }
+
+    void run( pool& p, const task& t )
+    {
+        for( size_t k = t.first; k < t.last; ++k )
+        {
+            size_t i = p.order[k];
+            s11nSHA::FileResult& result = p.results[i];
+            bool ok;
+
+            errno = 0;
+            if( p.sizes[i] >= p.large_file_bytes )
+                ok = s11nSHA::calculate_pipelined( p.paths[i], result.digest );
+            else
+            {
+                s11nSHA::SHA1 sha1;
+                ok = sha1.calculate( p.paths[i], result.digest );
+            }
+            result.ok = ok;
+            result.error = ok ? 0 : ( errno ? errno : EIO );
+            if( ok )
+                ++p.hashed_ok;
+        }
+    }
+
+    void worker( pool& p, size_t self )
+    {
+        size_t n = p.queues.size();
+        task t;
+        for( ;; )
+        {
+            if( take( p.queues[self], t, true ) )
+            {
+                run( p, t );
+                continue;
+            }
+
+            // no task is ever queued after the workers start, so once
+            // every queue is empty there is nothing left to steal
+            bool stole = false;
+            for( size_t k = 1; k < n && !stole; ++k )
+                stole = take( p.queues[( self + k ) % n], t, false );
+            if( !stole )
+                return;
+            run( p, t );
+        }
+    }
+
+} // end of anonymous namespace
+
+size_t s11nSHA::hash_files( const char *const paths[], size_t count,
+                            FileResult results[],
+                            const HashFilesOptions& options )
+{
+    pool p;
+    p.paths = paths;
+    p.results = results;
+    p.large_file_bytes = options.large_file_bytes;
+    p.sizes.resize( count );
+    p.hashed_ok = 0;
+
+    // stat everything up front; files that cannot be stat'ed fail here
+    for( size_t i = 0; i < count; ++i )
+    {
+        struct stat st;
+        if( stat( paths[i], &st ) != 0 )
+        {
+            results[i].ok = false;
+            results[i].error = errno;
+            continue;
+        }
+        // pipes and devices: unknown length, treat as small
+        p.sizes[i] = S_ISREG( st.st_mode ) ? (uint64_t) st.st_size : 0;
+        p.order.push_back( i );
+    }
+
+    std::sort( p.order.begin(), p.order.end(),
+               [&p]( size_t a, size_t b ) { return p.sizes[a] > p.sizes[b]; } );
+
+    // one task per large file, then batches of small files
+    std::vector<task> tasks;
+    for( size_t k = 0; k < p.order.size(); )
+    {
+        task t = { k, k + 1 };
+        if( p.sizes[p.order[k]] < options.large_file_bytes )
+        {
+            uint64_t bytes = p.sizes[p.order[k]];
+            while( t.last < p.order.size()
+                   && t.last - t.first < options.batch_files
+                   && bytes + p.sizes[p.order[t.last]] <= options.batch_bytes )
+                bytes += p.sizes[p.order[t.last++]];
+        }
+        tasks.push_back( t );
+        k = t.last;
+    }
+
+    unsigned int threads = options.threads;
+    if( threads == 0 )
+        threads = std::thread::hardware_concurrency();
+    if( threads == 0 )
+        threads = 1;
+    if( threads > tasks.size() )
+        threads = tasks.size() ? (unsigned int) tasks.size() : 1;
+
+    // deal the tasks out largest first, so every worker starts on one of
+    // the biggest files and the long poles begin as early as possible
+    p.queues = std::vector<worker_queue>( threads );
+    for( size_t k = 0; k < tasks.size(); ++k )
+        p.queues[k % threads].tasks.push_back( tasks[k] );
+
+    std::vector<std::thread> workers;
+    for( unsigned int w = 1; w < threads; ++w )
+        workers.push_back( std::thread( worker, std::ref( p ), w ) );
+    worker( p, 0 );
+    for( size_t w = 0; w < workers.size(); ++w )
+        workers[w].join();
+
+    return p.hashed_ok;
+}
@@ -0,0 +1,62 @@
+/**
+ *  Parallel multi-file hashing: hash a list of files on a pool of worker
+ *  threads that steal work from each other once their own queue is empty.
+ *
+ *  A single SHA-1 stream cannot be split, so large files are scheduled
+ *  first, one task each, and hashed with calculate_pipelined() so their
+ *  worker is not also stalled on I/O; small files are packed into batch
+ *  tasks that idle workers steal while the large ones run.
+ *
+ *  This only helps with many files: one file is still hashed by a single
+ *  worker, at the speed of one core, however many threads there are. The
+ *  results are plain SHA-1 digests, which cannot be built from ranges;
+ *  for a single big file where a different digest is acceptable, hash it
+ *  with calculate_tree() (s11nsha_tree.hpp), which does use every thread.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_FILES_HPP
+#define S11NSHA_FILES_HPP
+
+// uint64_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// s11nSHA::SHA1, DIGEST_SIZE
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    struct HashFilesOptions
+    {
+        HashFilesOptions() : threads( 0 ), large_file_bytes( 1024*1024*64 ),
+                             batch_bytes( 1024*1024*8 ), batch_files( 256 ) {}
+
+        unsigned int threads;       // workers; 0 = hardware concurrency
+        uint64_t large_file_bytes;  // files at least this big get a task each
+        uint64_t batch_bytes;       // small files per task, by total size
+        size_t batch_files;         // small files per task, by count
+    };
+
+    struct FileResult
+    {
+        bool ok;
+        int error;  // errno of the failure when ok is false
+        unsigned char digest[DIGEST_SIZE];
+    };
+
+    // hash paths[0 .. count) into results[0 .. count); returns the number
+    // of files hashed successfully
+    size_t hash_files( const char *const paths[], size_t count,
+                       FileResult results[],
+                       const HashFilesOptions& options = HashFilesOptions() );
+
+} // end of namespace s11nSHA
+
+#endif
@@ -0,0 +1,549 @@
+// g++ -Wall -c -std=c++0x s11nsha_git.cpp
+// implementation of s11nsha_git.hpp
+
+#include "s11nsha_git.hpp"
+
+// std::string
+#include <string>
+
+// std::vector
+#include <vector>
+
+// std::sort
+#include <algorithm>
+
+// std::atomic
+#include <atomic>
+
+// std::thread
+#include <thread>
+
+// std::ifstream, std::ofstream
+#include <fstream>
+
+// std::snprintf, std::rename, std::remove
+#include <cstdio>
+
+// std::time
+#include <ctime>
+
+// errno, EINTR, ENOENT
+#include <cerrno>
+
+// opendir, readdir, closedir, dirfd
+#include <dirent.h>
+
+// open, O_RDONLY, fstatat, AT_SYMLINK_NOFOLLOW
+#include <fcntl.h>
+
+// read, readlink, close
+#include <unistd.h>
+
+namespace
+{
+    enum Kind { KIND_FILE, KIND_EXEC, KIND_LINK, KIND_DIR };
+
+    // tree entry modes, indexed by Kind
+    const char *const MODES[] = { "100644", "100755", "120000", "40000" };
+
+    const size_t CACHE_HEADER_BYTES = 4 + 8;
+    const size_t CACHE_RECORD_BYTES = 8 * 4 + 4 + s11nSHA::DIGEST_SIZE;
+    const size_t READ_BYTES = 1024*256;
+
+    struct Entry
+    {
+        std::string name;
+        Kind kind;
+        struct stat st;
+        size_t child;  // index of the directory in dirs, for KIND_DIR
+        unsigned char digest[s11nSHA::DIGEST_SIZE];
+    };
+
+    struct Dir
+    {
+        std::string path;
+        std::vector<Entry> entries;
+        bool empty;  // no entries once empty subdirectories are left out
+        unsigned char digest[s11nSHA::DIGEST_SIZE];
+    };
+
+    void put_uint32( unsigned char *p, uint32_t n )
+    {
+        p[0] = (unsigned char) ( n >> 24 );
+        p[1] = (unsigned char) ( n >> 16 );
+        p[2] = (unsigned char) ( n >>  8 );
+        p[3] = (unsigned char) ( n       );
+    }
+
+    uint32_t get_uint32( const unsigned char *p )
+    {
+        return ( (uint32_t) p[0] << 24 ) | ( (uint32_t) p[1] << 16 )
+             | ( (uint32_t) p[2] <<  8 ) | ( (uint32_t) p[3]       );
+    }
+
+    void put_uint64( unsigned char *p, uint64_t n )
+    {
+        put_uint32( p, (uint32_t) ( n >> 32 ) );
+        put_uint32( p + 4, (uint32_t) n );
+    }
+
+    uint64_t get_uint64( const unsigned char *p )
+    {
+        return ( (uint64_t) get_uint32( p ) << 32 ) | get_uint32( p + 4 );
+    }
+
+    // start an object id: "<type> <length>\0"
+    void object_header( s11nSHA::SHA1& sha1, const char *type, uint64_t length )
+    {
+        char header[32];
+        int n = std::snprintf( header, sizeof( header ), "%s %llu", type,
+                               (unsigned long long) length );
+        sha1.update( (const unsigned char*) header, (size_t) n + 1 );
+    }
+
+    // git orders tree entries bytewise, with a directory compared as if
+    // its name ended in '/'
+    bool git_order( const Entry& a, const Entry& b )
+    {
+        size_t n = std::min( a.name.size(), b.name.size() );
+        int c = std::memcmp( a.name.data(), b.name.data(), n );
+        if( c != 0 )
+            return c < 0;
+
+        unsigned char ca = a.name.size() > n ? (unsigned char) a.name[n]
+                                             : ( a.kind == KIND_DIR ? '/' : 0 );
+        unsigned char cb = b.name.size() > n ? (unsigned char) b.name[n]
+                                             : ( b.kind == KIND_DIR ? '/' : 0 );
+        return ca < cb;
+    }
+
+    std::string join( const std::string& dir, const std::string& name )
+    {
+        if( !dir.empty() && dir[dir.size() - 1] == '/' )
+            return dir + name;
+        return dir + "/" + name;
+    }
+
+    // entries of one directory; entries that vanish between readdir()
+    // and the stat are skipped
+    bool read_dir( Dir& dir )
+    {
+        DIR *d = opendir( dir.path.c_str() );
+        if( d == NULL )
+            return false;
+
+        bool ok = true;
+        struct dirent *e;
+        while( ( e = readdir( d ) ) != NULL )
+        {
+            const char *name = e->d_name;
+            if( std::strcmp( name, "." ) == 0 || std::strcmp( name, ".." ) == 0
+                || std::strcmp( name, ".git" ) == 0 )
+                continue;
+
+            Entry entry;
+            if( fstatat( dirfd( d ), name, &entry.st, AT_SYMLINK_NOFOLLOW ) != 0 )
+            {
+                if( errno == ENOENT )
+                    continue;
+                ok = false;
+                break;
+            }
+
+            if( S_ISREG( entry.st.st_mode ) )
+                entry.kind = ( entry.st.st_mode & S_IXUSR ) ? KIND_EXEC : KIND_FILE;
+            else if( S_ISLNK( entry.st.st_mode ) )
+                entry.kind = KIND_LINK;
+            else if( S_ISDIR( entry.st.st_mode ) )
+                entry.kind = KIND_DIR;
+            else
+                continue;
+
+            entry.name = name;
+            entry.child = 0;
+            dir.entries.push_back( entry );
+        }
+        closedir( d );
+        return ok;
+    }
+
+    // blob id of a file or symlink; entry.st is refreshed from the open
+    // file so that the cache is keyed by what was actually hashed
+    bool hash_blob( const std::string& path, Entry& entry, unsigned char *buf,
+                    uint64_t& bytes )
+    {
+        s11nSHA::SHA1 sha1;
+
+        if( entry.kind == KIND_LINK )
+        {
+            ssize_t n = readlink( path.c_str(), (char*) buf, READ_BYTES );
+            if( n < 0 || (size_t) n == READ_BYTES )
+                return false;
+            object_header( sha1, "blob", (uint64_t) n );
+            sha1.update( buf, (size_t) n );
+            sha1.final( entry.digest );
+            return true;
+        }
+
+        int fd = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+        if( fd < 0 )
+            return false;
+        if( fstat( fd, &entry.st ) != 0 )
+        {
+            close( fd );
+            return false;
+        }
+
+        uint64_t left = (uint64_t) entry.st.st_size;
+        object_header( sha1, "blob", left );
+        while( left > 0 )
+        {
+            ssize_t n = read( fd, buf, left < READ_BYTES ? (size_t) left : READ_BYTES );
+            if( n < 0 && errno == EINTR )
+                continue;
+            if( n <= 0 )
+                break;
+            sha1.update( buf, (size_t) n );
+            left -= (uint64_t) n;
+        }
+        close( fd );
+
+        bytes += (uint64_t) entry.st.st_size - left;
+        sha1.final( entry.digest );
+        return left == 0;
+    }
+
+    // fn( item, worker ) for every item < count on up to threads workers,
+    // the calling thread being worker 0
+    template <typename Fn>
+    void parallel_for( size_t count, unsigned int threads, Fn fn )
+    {
+        std::atomic<size_t> next( 0 );
+        auto work = [&]( unsigned int worker )
+        {
+            size_t i;
+            while( ( i = next.fetch_add( 1 ) ) < count )
+                fn( i, worker );
+        };
+
+        if( threads > count )
+            threads = (unsigned int) count;
+
+        std::vector<std::thread> workers;
+        for( unsigned int w = 1; w < threads; ++w )
+            workers.push_back( std::thread( work, w ) );
+        work( 0 );
+        for( size_t w = 0; w < workers.size(); ++w )
+            workers[w].join();
+    }
+
+} // end of anonymous namespace
+
+s11nSHA::GitBlobCache::GitBlobCache() : hit_count( 0 ), miss_count( 0 )
+{
+}
+
+bool s11nSHA::GitBlobCache::Key::operator==( const Key& other ) const
+{
+    return dev == other.dev && ino == other.ino && size == other.size
+        && mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+}
+
+size_t s11nSHA::GitBlobCache::KeyHash::operator()( const Key& key ) const
+{
+    uint64_t h = key.ino * 0x9E3779B97F4A7C15ULL;
+    h ^= ( key.dev + key.size ) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= ( key.mtime_sec << 30 ) ^ key.mtime_nsec;
+    return (size_t) ( h ^ ( h >> 29 ) );
+}
+
+s11nSHA::GitBlobCache::Key s11nSHA::GitBlobCache::make_key( const struct stat& st )
+{
+    Key key;
+    key.dev = (uint64_t) st.st_dev;
+    key.ino = (uint64_t) st.st_ino;
+    key.size = (uint64_t) st.st_size;
+    key.mtime_sec = (uint64_t) st.st_mtim.tv_sec;
+    key.mtime_nsec = (uint32_t) st.st_mtim.tv_nsec;
+    return key;
+}
+
+bool s11nSHA::GitBlobCache::find( const struct stat& st,
+                                  unsigned char digest[DIGEST_SIZE] )
+{
+    std::unordered_map<Key, Value, KeyHash>::iterator it = entries.find( make_key( st ) );
+    if( it == entries.end() )
+    {
+        ++miss_count;
+        return false;
+    }
+    it->second.used = true;
+    std::memcpy( digest, it->second.digest, DIGEST_SIZE );
+    ++hit_count;
+    return true;
+}
+
+void s11nSHA::GitBlobCache::insert( const struct stat& st,
+                                    const unsigned char digest[DIGEST_SIZE] )
+{
+    Value& value = entries[make_key( st )];
+    std::memcpy( value.digest, digest, DIGEST_SIZE );
+    value.used = true;
+}
+
+size_t s11nSHA::GitBlobCache::prune()
+{
+    size_t dropped = 0;
+    std::unordered_map<Key, Value, KeyHash>::iterator it = entries.begin();
+    while( it != entries.end() )
+    {
+        if( !it->second.used )
+        {
+            it = entries.erase( it );
+            ++dropped;
+            continue;
+        }
+        it->second.used = false;
+        ++it;
+    }
+    return dropped;
+}
+
+bool s11nSHA::GitBlobCache::load( const char *path )
+{
+    entries.clear();
+
+    std::ifstream in( path, std::ios::binary );
+    unsigned char header[CACHE_HEADER_BYTES];
+    if( !in.read( (char*) header, sizeof( header ) ) || header[0] != 'S'
+        || header[1] != 'G' || header[2] != GIT_CACHE_VERSION )
+        return false;
+
+    uint64_t count = get_uint64( header + 4 );
+    unsigned char record[CACHE_RECORD_BYTES];
+    for( uint64_t i = 0; i < count; ++i )
+    {
+        if( !in.read( (char*) record, sizeof( record ) ) )
+        {
+            entries.clear();
+            return false;
+        }
+
+        Key key;
+        key.dev = get_uint64( record );
+        key.ino = get_uint64( record + 8 );
+        key.size = get_uint64( record + 16 );
+        key.mtime_sec = get_uint64( record + 24 );
+        key.mtime_nsec = get_uint32( record + 32 );
+
+        // loaded entries count as unused until a walk finds them
+        Value& value = entries[key];
+        std::memcpy( value.digest, record + 36, DIGEST_SIZE );
+        value.used = false;
+    }
+    return true;
+}
+
+bool s11nSHA::GitBlobCache::save( const char *path ) const
+{
+    std::string tmp = std::string( path ) + ".tmp";
+    std::ofstream out( tmp.c_str(), std::ios::binary | std::ios::trunc );
+
+    unsigned char header[CACHE_HEADER_BYTES];
+    header[0] = 'S';
+    header[1] = 'G';
+    header[2] = GIT_CACHE_VERSION;
+    header[3] = 0;
+    put_uint64( header + 4, (uint64_t) entries.size() );
+    out.write( (const char*) header, sizeof( header ) );
+
+    unsigned char record[CACHE_RECORD_BYTES];
+    std::unordered_map<Key, Value, KeyHash>::const_iterator it;
+    for( it = entries.begin(); it != entries.end() && out; ++it )
+    {
+        put_uint64( record, it->first.dev );
+        put_uint64( record + 8, it->first.ino );
+        put_uint64( record + 16, it->first.size );
+        put_uint64( record + 24, it->first.mtime_sec );
+        put_uint32( record + 32, it->first.mtime_nsec );
+        std::memcpy( record + 36, it->second.digest, DIGEST_SIZE );
+        out.write( (const char*) record, sizeof( record ) );
+    }
+
+    out.close();
+    if( !out || std::rename( tmp.c_str(), path ) != 0 )
+    {
+        std::remove( tmp.c_str() );
+        return false;
+    }
+    return true;
+}
+
+void s11nSHA::GitBlobCache::clear()
+{
+    entries.clear();
+}
+
+size_t s11nSHA::GitBlobCache::size() const
+{
+    return entries.size();
+}
+
+uint64_t s11nSHA::GitBlobCache::hits() const
+{
+    return hit_count;
+}
+
+uint64_t s11nSHA::GitBlobCache::misses() const
+{
+    return miss_count;
+}
+
+void s11nSHA::git_blob_sha1( const unsigned char *content, size_t length,
+                             unsigned char digest[DIGEST_SIZE] )
+{
+    SHA1 sha1;
+    object_header( sha1, "blob", length );
+    sha1.update( content, length );
+    sha1.final( digest );
+}
+
+bool s11nSHA::git_blob_sha1( const char *path, unsigned char digest[DIGEST_SIZE] )
+{
+    Entry entry;
+    entry.kind = KIND_FILE;
+    std::vector<unsigned char> buf( READ_BYTES );
+    uint64_t bytes = 0;
+
+    if( !hash_blob( path, entry, &buf[0], bytes ) )
+        return false;
+    std::memcpy( digest, entry.digest, DIGEST_SIZE );
+    return true;
+}
+
+bool s11nSHA::git_tree_sha1( const char *dir, unsigned char digest[DIGEST_SIZE],
+                             GitBlobCache *cache, const GitTreeOptions& options,
+                             GitTreeStats *stats )
+{
+    GitTreeStats local;
+    std::atomic<bool> failed( false );
+    std::time_t started = std::time( NULL );
+
+    unsigned int threads = options.threads;
+    if( threads == 0 )
+        threads = std::thread::hardware_concurrency();
+    if( threads == 0 )
+        threads = 1;
+
+    // breadth first, one level at a time; a level's directories are read
+    // in parallel and their subdirectories make up the next level
+    std::vector<Dir> dirs( 1 );
+    dirs[0].path = dir;
+    for( size_t begin = 0; begin < dirs.size() && !failed; )
+    {
+        size_t end = dirs.size();
+        parallel_for( end - begin, threads, [&]( size_t i, unsigned int )
+        {
+            if( !read_dir( dirs[begin + i] ) )
+                failed = true;
+        });
+
+        for( size_t i = begin; i < end; ++i )
+            for( size_t k = 0; k < dirs[i].entries.size(); ++k )
+            {
+                if( dirs[i].entries[k].kind != KIND_DIR )
+                    continue;
+                Dir child;
+                child.path = join( dirs[i].path, dirs[i].entries[k].name );
+                dirs[i].entries[k].child = dirs.size();
+                dirs.push_back( child );
+            }
+        begin = end;
+    }
+    local.directories = dirs.size();
+
+    // blobs: cache hits first, then the rest largest first so that one
+    // big file does not end up last on a single worker
+    std::vector<std::pair<size_t, size_t> > todo;
+    for( size_t i = 0; i < dirs.size() && !failed; ++i )
+        for( size_t k = 0; k < dirs[i].entries.size(); ++k )
+        {
+            Entry& entry = dirs[i].entries[k];
+            if( entry.kind == KIND_DIR )
+                continue;
+            ++local.blobs;
+            if( cache != NULL && cache->find( entry.st, entry.digest ) )
+                ++local.cached;
+            else
+                todo.push_back( std::make_pair( i, k ) );
+        }
+
+    std::sort( todo.begin(), todo.end(),
+               [&]( const std::pair<size_t, size_t>& a, const std::pair<size_t, size_t>& b )
+    {
+        return dirs[a.first].entries[a.second].st.st_size
+             > dirs[b.first].entries[b.second].st.st_size;
+    });
+
+    std::vector<std::vector<unsigned char> > buffers( threads );
+    std::vector<uint64_t> bytes( threads, 0 );
+    parallel_for( failed ? 0 : todo.size(), threads, [&]( size_t i, unsigned int w )
+    {
+        if( buffers[w].empty() )
+            buffers[w].resize( READ_BYTES );
+        Dir& parent = dirs[todo[i].first];
+        Entry& entry = parent.entries[todo[i].second];
+        if( !hash_blob( join( parent.path, entry.name ), entry, &buffers[w][0], bytes[w] ) )
+            failed = true;
+    });
+    for( size_t w = 0; w < bytes.size(); ++w )
+        local.hashed_bytes += bytes[w];
+
+    if( stats != NULL )
+        *stats = local;
+    if( failed )
+        return false;
+
+    // files touched in the second the walk started may change again
+    // without a new mtime, so they are hashed again next time
+    for( size_t i = 0; cache != NULL && i < todo.size(); ++i )
+    {
+        const Entry& entry = dirs[todo[i].first].entries[todo[i].second];
+        if( entry.st.st_mtim.tv_sec < started )
+            cache->insert( entry.st, entry.digest );
+    }
+
+    // trees bottom up: every subdirectory comes after its parent in dirs
+    for( size_t i = dirs.size(); i-- > 0; )
+    {
+        Dir& d = dirs[i];
+        std::sort( d.entries.begin(), d.entries.end(), git_order );
+
+        std::string content;
+        for( size_t k = 0; k < d.entries.size(); ++k )
+        {
+            const Entry& entry = d.entries[k];
+            const unsigned char *id = entry.digest;
+            if( entry.kind == KIND_DIR )
+            {
+                if( dirs[entry.child].empty )
+                    continue;
+                id = dirs[entry.child].digest;
+            }
+            content += MODES[entry.kind];
+            content += ' ';
+            content += entry.name;
+            content += '\0';
+            content.append( (const char*) id, DIGEST_SIZE );
+        }
+
+        SHA1 sha1;
+        object_header( sha1, "tree", content.size() );
+        sha1.update( (const unsigned char*) content.data(), content.size() );
+        sha1.final( d.digest );
+        d.empty = content.empty();
+    }
+
+    std::memcpy( digest, dirs[0].digest, DIGEST_SIZE );
+    return true;
+}
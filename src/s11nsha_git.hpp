@@ -0,0 +1,141 @@
+/**
+ *  Git object hashing: blob ids ("blob <length>\0" + content) and tree ids
+ *  for whole directories, matching what `git add -A && git write-tree`
+ *  records for the same working tree.
+ *
+ *  A directory is walked breadth first, each level read by a pool of
+ *  threads; the blobs are then hashed on the same pool, largest first,
+ *  and the trees are assembled bottom up. Entries are ordered the way git
+ *  orders them (a directory sorts as if its name ended in '/'), ".git"
+ *  is skipped, empty directories are left out like git leaves them out,
+ *  and anything that is not a regular file, symlink or directory is
+ *  ignored.
+ *
+ *  A GitBlobCache keyed by device, inode, size and mtime lets a rerun over
+ *  a mostly unchanged tree skip reading the files it has seen before.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_GIT_HPP
+#define S11NSHA_GIT_HPP
+
+// uint64_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// std::unordered_map
+#include <unordered_map>
+
+// struct stat
+#include <sys/stat.h>
+
+// s11nSHA::SHA1, DIGEST_SIZE
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    // file format: magic "SG", version, reserved byte, uint64 count, then
+    // count records of uint64 st_dev, st_ino, size and mtime seconds,
+    // uint32 mtime nanoseconds and the 20 byte blob id, all big endian
+    const unsigned char GIT_CACHE_VERSION = 1;
+
+    // blob ids of files by identity and change stamp. a file whose mtime
+    // is not older than the walk that saw it is never cached, as it may
+    // still change within the same timestamp. not thread safe
+    class GitBlobCache
+    {
+    public:
+        GitBlobCache();
+
+        // blob id cached for a file with this stat(); false on a miss
+        bool find( const struct stat& st, unsigned char digest[DIGEST_SIZE] );
+
+        void insert( const struct stat& st,
+                     const unsigned char digest[DIGEST_SIZE] );
+
+        // drop the entries not found or inserted since the previous
+        // prune(), i.e. files gone since the last walk; returns how many
+        size_t prune();
+
+        // replace the contents with / write them to a cache file; load()
+        // returns false and keeps the cache empty on a missing or corrupt
+        // file. save() writes a temporary file and renames it into place
+        bool load( const char *path );
+        bool save( const char *path ) const;
+
+        void clear();
+
+        size_t size() const;
+        uint64_t hits() const;
+        uint64_t misses() const;
+
+    private:
+        struct Key
+        {
+            uint64_t dev, ino, size, mtime_sec;
+            uint32_t mtime_nsec;
+
+            bool operator==( const Key& other ) const;
+        };
+
+        struct KeyHash
+        {
+            size_t operator()( const Key& key ) const;
+        };
+
+        struct Value
+        {
+            unsigned char digest[DIGEST_SIZE];
+            bool used;  // seen since the last prune()
+        };
+
+        static Key make_key( const struct stat& st );
+
+        std::unordered_map<Key, Value, KeyHash> entries;
+        uint64_t hit_count;
+        uint64_t miss_count;
+    };
+
+    struct GitTreeOptions
+    {
+        GitTreeOptions() : threads( 0 ) {}
+
+        unsigned int threads;  // walkers and hashers; 0 = hardware concurrency
+    };
+
+    struct GitTreeStats
+    {
+        GitTreeStats() : directories( 0 ), blobs( 0 ), cached( 0 ),
+                         hashed_bytes( 0 ) {}
+
+        uint64_t directories;   // directories read, empty ones included
+        uint64_t blobs;         // files and symlinks in the tree
+        uint64_t cached;        // blob ids taken from the cache
+        uint64_t hashed_bytes;  // content bytes read and hashed
+    };
+
+    // blob id of content
+    void git_blob_sha1( const unsigned char *content, size_t length,
+                        unsigned char digest[DIGEST_SIZE] );
+
+    // blob id of the file at path; false if it cannot be read
+    bool git_blob_sha1( const char *path, unsigned char digest[DIGEST_SIZE] );
+
+    // tree id of directory dir. cache and stats may be NULL; a cache is
+    // consulted and updated, but not pruned or saved. returns false if a
+    // directory or file in the tree cannot be read or a file shrinks
+    // while it is hashed
+    bool git_tree_sha1( const char *dir, unsigned char digest[DIGEST_SIZE],
+                        GitBlobCache *cache = NULL,
+                        const GitTreeOptions& options = GitTreeOptions(),
+                        GitTreeStats *stats = NULL );
+
+} // end of namespace s11nSHA
+
+#endif
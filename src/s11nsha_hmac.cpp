@@ -0,0 +1,120 @@
+// g++ -Wall -c -std=c++0x s11nsha_hmac.cpp
+// implementation of s11nsha_hmac.hpp
+
+#include "s11nsha_hmac.hpp"
+#include "s11nsha_kernels.hpp"
+
+// std::stringstream
+#include <sstream>
+
+// boost archive and serialization
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+s11nSHA::HMAC_SHA1::HMAC_SHA1()
+{
+    this->set_key( NULL, 0 );
+}
+
+s11nSHA::HMAC_SHA1::HMAC_SHA1( const unsigned char *key, size_t length )
+{
+    this->set_key( key, length );
+}
+
+void s11nSHA::HMAC_SHA1::set_key( const unsigned char *key, size_t length )
+{
+    unsigned char block[BLOCK_BYTES] = { 0 };
+    unsigned char pad[BLOCK_BYTES];
+
+    if( length > BLOCK_BYTES )
+    {
+        SHA1 sha1;
+        sha1.calculate( key, length, block );
+    }
+    else if( length > 0 )
+        std::memcpy( block, key, length );
+
+    for( unsigned int i = 0; i < BLOCK_BYTES; ++i )
+        pad[i] = block[i] ^ 0x36;
+    this->inner_key.init();
+    this->inner_key.update( pad, BLOCK_BYTES );
+
+    for( unsigned int i = 0; i < BLOCK_BYTES; ++i )
+        pad[i] = block[i] ^ 0x5C;
+    this->outer_key.init();
+    this->outer_key.update( pad, BLOCK_BYTES );
+
+    // no key material left on the stack
+    wipe( block, BLOCK_BYTES );
+    wipe( pad, BLOCK_BYTES );
+
+    this->inner = this->inner_key;
+}
+
+void s11nSHA::HMAC_SHA1::init()
+{
+    this->inner = this->inner_key;
+}
+
+void s11nSHA::HMAC_SHA1::update( const unsigned char *input, size_t length )
+{
+    this->inner.update( input, length );
+}
+
+void s11nSHA::HMAC_SHA1::final( unsigned char mac[DIGEST_SIZE] )
+{
+    unsigned char digest[DIGEST_SIZE];
+    SHA1 outer = this->outer_key;
+
+    this->inner.final( digest );
+    outer.update( digest, DIGEST_SIZE );
+    outer.final( mac );
+
+    this->inner = this->inner_key;
+}
+
+void s11nSHA::HMAC_SHA1::calculate( const unsigned char *input, size_t length,
+                                    unsigned char mac[DIGEST_SIZE] )
+{
+    this->init();
+    this->update( input, length );
+    this->final( mac );
+}
+
+void s11nSHA::marshall( std::string& s11n_hmac_object,
+                        const HMAC_SHA1& hmac_object, bool to_binary )
+{
+    std::stringstream ss;
+    if (to_binary)
+    {
+        boost::archive::binary_oarchive oa(ss);
+        oa << hmac_object;
+    }
+    else
+    {
+        boost::archive::text_oarchive oa(ss);
+        oa << hmac_object;
+    }
+
+    s11n_hmac_object.clear();
+    s11n_hmac_object = ss.str();
+}
+
+void s11nSHA::unmarshall( const std::string& s11n_hmac_object,
+                          HMAC_SHA1& hmac_object, bool from_binary )
+{
+    std::stringstream ss(s11n_hmac_object);
+
+    if (from_binary)
+    {
+        boost::archive::binary_iarchive ia(ss);
+        ia >> hmac_object;
+    }
+    else
+    {
+        boost::archive::text_iarchive ia(ss);
+        ia >> hmac_object;
+    }
+}
@@ -0,0 +1,83 @@
+/**
+ *  HMAC-SHA1 (RFC 2104) on top of s11nSHA::SHA1
+ *
+ *  The SHA1 states after the ipad and opad key blocks are computed once in
+ *  set_key() and copied for every message, which saves two compressions
+ *  per MAC. The object serializes through boost like SHA1 does, so a long
+ *  MAC stream can be checkpointed and resumed. The serialized form holds
+ *  the key states, which are as good as the key: store it accordingly.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_HMAC_HPP
+#define S11NSHA_HMAC_HPP
+
+// size_t
+#include <cstring>
+
+// std::string
+#include <string>
+
+// boost archive and serialization
+#include <boost/serialization/serialization.hpp>
+
+// s11nSHA::SHA1, DIGEST_SIZE
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    class HMAC_SHA1
+    {
+    public:
+        // an empty key until set_key() is called
+        HMAC_SHA1();
+        HMAC_SHA1( const unsigned char *key, size_t length );
+
+        // precompute the inner and outer key states and start a message;
+        // keys longer than a block are hashed first, as RFC 2104 says
+        void set_key( const unsigned char *key, size_t length );
+
+        // drop the current message and start a new one with the same key
+        void init();
+
+        // process more of the message
+        void update( const unsigned char *input, size_t length );
+
+        // compute the MAC of the current message, then start a new one
+        void final( unsigned char mac[DIGEST_SIZE] );
+
+        // MAC of input in one call
+        void calculate( const unsigned char *input, size_t length,
+                        unsigned char mac[DIGEST_SIZE] );
+
+    private:
+        SHA1 inner_key;  // state after ( key ^ ipad )
+        SHA1 outer_key;  // state after ( key ^ opad )
+        SHA1 inner;      // inner_key plus the message so far
+
+        friend class boost::serialization::access;
+
+        template <typename Archive>
+        void serialize( Archive &ar, const unsigned int version )
+        {
+            ar & inner_key & outer_key & inner;
+        }
+    }; // end of class HMAC_SHA1
+
+    // serialize HMAC_SHA1 object into std::string; set last argument to
+    // true for non-portable binary format
+    void marshall( std::string& s11n_hmac_object, const HMAC_SHA1& hmac_object,
+                   bool to_binary = false );
+
+    // deserialize HMAC_SHA1 object from std::string; set last argument to
+    // true if non-portable binary format was used while serializing
+    void unmarshall( const std::string& s11n_hmac_object,
+                     HMAC_SHA1& hmac_object, bool from_binary = false );
+
+} // end of namespace s11nSHA
+
+#endif
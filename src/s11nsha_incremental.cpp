@@ -0,0 +1,321 @@
+// g++ -Wall -c -std=c++0x s11nsha_incremental.cpp
+// implementation of s11nsha_incremental.hpp
+
+#include "s11nsha_incremental.hpp"
+
+// std::string
+#include <string>
+
+// std::vector
+#include <vector>
+
+// errno, EINTR
+#include <cerrno>
+
+// rename
+#include <cstdio>
+
+// open, O_RDONLY, O_WRONLY, O_CREAT, O_TRUNC
+#include <fcntl.h>
+
+// fstat
+#include <sys/stat.h>
+
+// pread, write, fsync, close, unlink
+#include <unistd.h>
+
+namespace
+{
+    const size_t HEADER_BYTES = 4 + 4 + 8 * 6 + 4 + s11nSHA::DIGEST_SIZE;
+    const size_t ENTRY_BYTES = 8 + s11nSHA::DIGEST_SIZE + s11nSHA::FIXED_S11N_BYTES;
+    const size_t READ_BYTES = 1024*1024*4;
+
+    // size stored when the file changed while it was hashed, so the
+    // unchanged shortcut never matches
+    const uint64_t SIZE_UNKNOWN = ~(uint64_t) 0;
+
+    struct checkpoint
+    {
+        uint64_t offset;
+        unsigned char guard[s11nSHA::DIGEST_SIZE];
+        unsigned char record[s11nSHA::FIXED_S11N_BYTES];
+    };
+
+    struct sidecar
+    {
+        uint64_t interval, dev, ino, size, mtime_sec;
+        uint32_t mtime_nsec;
+        unsigned char digest[s11nSHA::DIGEST_SIZE];
+        std::vector<checkpoint> points;
+    };
+
+    void put_uint32( unsigned char *p, uint32_t n )
+    {
+        p[0] = (unsigned char) ( n >> 24 );
+        p[1] = (unsigned char) ( n >> 16 );
+        p[2] = (unsigned char) ( n >>  8 );
+        p[3] = (unsigned char) ( n       );
+    }
+
+    uint32_t get_uint32( const unsigned char *p )
+    {
+        return ( (uint32_t) p[0] << 24 ) | ( (uint32_t) p[1] << 16 )
+             | ( (uint32_t) p[2] <<  8 ) | ( (uint32_t) p[3]       );
+    }
+
+    void put_uint64( unsigned char *p, uint64_t n )
+    {
+        put_uint32( p, (uint32_t) ( n >> 32 ) );
+        put_uint32( p + 4, (uint32_t) n );
+    }
+
+    uint64_t get_uint64( const unsigned char *p )
+    {
+        return ( (uint64_t) get_uint32( p ) << 32 ) | get_uint32( p + 4 );
+    }
+
+    // pread() exactly length bytes unless the file ends first
+    ssize_t read_at( int fd, unsigned char *buf, size_t length, uint64_t offset )
+    {
+        size_t done = 0;
+        while( done < length )
+        {
+            ssize_t n = pread( fd, buf + done, length - done,
+                               (off_t) ( offset + done ) );
+            if( n < 0 && errno == EINTR )
+                continue;
+            if( n < 0 )
+                return -1;
+            if( n == 0 )
+                break;
+            done += (size_t) n;
+        }
+        return (ssize_t) done;
+    }
+
+    // SHA1 of the guard bytes that end at offset
+    bool guard_digest( int fd, uint64_t offset,
+                       unsigned char digest[s11nSHA::DIGEST_SIZE] )
+    {
+        unsigned char buf[s11nSHA::SIDECAR_GUARD_BYTES];
+        uint64_t start = offset > sizeof( buf ) ? offset - sizeof( buf ) : 0;
+        size_t length = (size_t) ( offset - start );
+
+        if( read_at( fd, buf, length, start ) != (ssize_t) length )
+            return false;
+        s11nSHA::SHA1 sha1;
+        sha1.calculate( buf, length, digest );
+        return true;
+    }
+
+    bool load_sidecar( const std::string& path, sidecar& s )
+    {
+        int fd = open( path.c_str(), O_RDONLY );
+        if( fd < 0 )
+            return false;
+
+        struct stat st;
+        std::vector<unsigned char> data;
+        bool ok = fstat( fd, &st ) == 0 && (size_t) st.st_size >= HEADER_BYTES;
+        if( ok )
+        {
+            data.resize( (size_t) st.st_size );
+            ok = read_at( fd, &data[0], data.size(), 0 ) == (ssize_t) data.size();
+        }
+        close( fd );
+        if( !ok )
+            return false;
+
+        const unsigned char *p = &data[0];
+        if( p[0] != 'S' || p[1] != 'I' || p[2] != s11nSHA::SIDECAR_VERSION )
+            return false;
+        uint32_t count = get_uint32( p + 4 );
+        if( data.size() != HEADER_BYTES + count * ENTRY_BYTES )
+            return false;
+
+        s.interval = get_uint64( p + 8 );
+        s.dev = get_uint64( p + 16 );
+        s.ino = get_uint64( p + 24 );
+        s.size = get_uint64( p + 32 );
+        s.mtime_sec = get_uint64( p + 40 );
+        s.mtime_nsec = get_uint32( p + 48 );
+        std::memcpy( s.digest, p + 52, s11nSHA::DIGEST_SIZE );
+
+        s.points.resize( count );
+        p += HEADER_BYTES;
+        for( uint32_t i = 0; i < count; ++i, p += ENTRY_BYTES )
+        {
+            s.points[i].offset = get_uint64( p );
+            std::memcpy( s.points[i].guard, p + 8, s11nSHA::DIGEST_SIZE );
+            std::memcpy( s.points[i].record, p + 8 + s11nSHA::DIGEST_SIZE,
+                         s11nSHA::FIXED_S11N_BYTES );
+        }
+        return true;
+    }
+
+    // written next to the sidecar and renamed over it, so a crash leaves
+    // either the old index or the new one
+    bool save_sidecar( const std::string& path, const sidecar& s )
+    {
+        std::vector<unsigned char> data( HEADER_BYTES + s.points.size() * ENTRY_BYTES );
+        unsigned char *p = &data[0];
+
+        p[0] = 'S';
+        p[1] = 'I';
+        p[2] = s11nSHA::SIDECAR_VERSION;
+        p[3] = 0;
+        put_uint32( p + 4, (uint32_t) s.points.size() );
+        put_uint64( p + 8, s.interval );
+        put_uint64( p + 16, s.dev );
+        put_uint64( p + 24, s.ino );
+        put_uint64( p + 32, s.size );
+        put_uint64( p + 40, s.mtime_sec );
+        put_uint32( p + 48, s.mtime_nsec );
+        std::memcpy( p + 52, s.digest, s11nSHA::DIGEST_SIZE );
+
+        p += HEADER_BYTES;
+        for( size_t i = 0; i < s.points.size(); ++i, p += ENTRY_BYTES )
+        {
+            put_uint64( p, s.points[i].offset );
+            std::memcpy( p + 8, s.points[i].guard, s11nSHA::DIGEST_SIZE );
+            std::memcpy( p + 8 + s11nSHA::DIGEST_SIZE, s.points[i].record,
+                         s11nSHA::FIXED_S11N_BYTES );
+        }
+
+        std::string tmp = path + ".tmp";
+        int fd = open( tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        if( fd < 0 )
+            return false;
+
+        size_t done = 0;
+        while( done < data.size() )
+        {
+            ssize_t n = write( fd, &data[done], data.size() - done );
+            if( n < 0 && errno == EINTR )
+                continue;
+            if( n <= 0 )
+                break;
+            done += (size_t) n;
+        }
+        bool ok = done == data.size() && fsync( fd ) == 0;
+        ok = close( fd ) == 0 && ok;
+        if( ok )
+            ok = rename( tmp.c_str(), path.c_str() ) == 0;
+        if( !ok )
+            unlink( tmp.c_str() );
+        return ok;
+    }
+
+} // end of anonymous namespace
+
+bool s11nSHA::calculate_incremental( const char *path,
+                                     unsigned char digest[DIGEST_SIZE],
+                                     const char *sidecar_path,
+                                     uint64_t interval,
+                                     IncrementalStats *stats )
+{
+    std::string index_path = sidecar_path ? sidecar_path
+                                          : std::string( path ) + ".s11n";
+    IncrementalStats local;
+    struct stat st;
+    sidecar old, next;
+    int fd;
+
+    if( interval < SIDECAR_GUARD_BYTES )
+        interval = SIDECAR_GUARD_BYTES;
+
+    if( ( fd = open( path, O_RDONLY ) ) < 0 )
+        return false;
+    if( fstat( fd, &st ) != 0 )
+    {
+        close( fd );
+        return false;
+    }
+
+    bool have = load_sidecar( index_path, old ) && old.interval == interval
+                && old.dev == (uint64_t) st.st_dev
+                && old.ino == (uint64_t) st.st_ino;
+
+    if( have && old.size == (uint64_t) st.st_size
+        && old.mtime_sec == (uint64_t) st.st_mtim.tv_sec
+        && old.mtime_nsec == (uint32_t) st.st_mtim.tv_nsec )
+    {
+        close( fd );
+        std::memcpy( digest, old.digest, DIGEST_SIZE );
+        local.unchanged = true;
+        if( stats != NULL )
+            *stats = local;
+        return true;
+    }
+
+    // latest checkpoint the file still agrees with
+    SHA1 sha1;
+    uint64_t offset = 0;
+    for( size_t k = have ? old.points.size() : 0; k-- > 0; )
+    {
+        const checkpoint& cp = old.points[k];
+        unsigned char guard[DIGEST_SIZE];
+        if( cp.offset > (uint64_t) st.st_size || !guard_digest( fd, cp.offset, guard )
+            || std::memcmp( guard, cp.guard, DIGEST_SIZE ) != 0
+            || !unmarshall( cp.record, FIXED_S11N_BYTES, sha1 ) )
+            continue;
+
+        offset = cp.offset;
+        next.points.assign( old.points.begin(), old.points.begin() + k + 1 );
+        break;
+    }
+    local.resumed_from = offset;
+
+    std::vector<unsigned char> buf( READ_BYTES );
+    uint64_t next_point = ( offset / interval + 1 ) * interval;
+    bool ok = true;
+    for( ;; )
+    {
+        uint64_t want = next_point - offset;
+        if( want > READ_BYTES )
+            want = READ_BYTES;
+
+        ssize_t n = read_at( fd, &buf[0], (size_t) want, offset );
+        if( n < 0 )
+            ok = false;
+        if( n <= 0 )
+            break;
+
+        sha1.update( &buf[0], (size_t) n );
+        offset += (uint64_t) n;
+        local.hashed_bytes += (uint64_t) n;
+
+        if( offset == next_point )
+        {
+            checkpoint cp;
+            cp.offset = offset;
+            marshall( cp.record, sha1 );
+            if( guard_digest( fd, offset, cp.guard ) )
+                next.points.push_back( cp );
+            next_point += interval;
+        }
+        else if( (uint64_t) n < want )
+            break;
+    }
+
+    sha1.final( digest );
+
+    // only promise "unchanged" for the size and mtime the digest covers
+    struct stat after;
+    if( ok && fstat( fd, &after ) == 0 )
+    {
+        next.interval = interval;
+        next.dev = (uint64_t) after.st_dev;
+        next.ino = (uint64_t) after.st_ino;
+        next.size = (uint64_t) after.st_size == offset ? offset : SIZE_UNKNOWN;
+        next.mtime_sec = (uint64_t) after.st_mtim.tv_sec;
+        next.mtime_nsec = (uint32_t) after.st_mtim.tv_nsec;
+        std::memcpy( next.digest, digest, DIGEST_SIZE );
+        save_sidecar( index_path, next );
+    }
+
+    close( fd );
+    if( stats != NULL )
+        *stats = local;
+    return ok;
+}
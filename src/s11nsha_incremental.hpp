@@ -0,0 +1,65 @@
+/**
+ *  Incremental hashing of append-only files: a sidecar index remembers the
+ *  marshalled SHA1 state at every `interval` bytes of the file, so the next
+ *  run restores the last checkpoint that is still valid and only hashes
+ *  what was appended since.
+ *
+ *  Sidecar layout (integers big endian):
+ *      header : magic "SI", version, reserved byte, uint32 checkpoints,
+ *               uint64 interval, uint64 st_dev, uint64 st_ino, uint64 size,
+ *               uint64 mtime seconds, uint32 mtime nanoseconds, and the
+ *               20 byte digest of the whole file at that size and mtime
+ *      entry  : uint64 offset, SHA1 digest of the SIDECAR_GUARD_BYTES
+ *               before offset, FIXED_S11N_BYTES marshall() record
+ *
+ *  A checkpoint is only trusted if the file is the same inode, is at least
+ *  that long and the guard bytes before it still hash the same; an
+ *  unchanged size and mtime reuse the stored digest without reading.
+ *  Rewriting data further back than the guard is not detected: this is
+ *  for files that really are append-only.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_INCREMENTAL_HPP
+#define S11NSHA_INCREMENTAL_HPP
+
+// uint64_t
+#include <cstdint>
+
+// s11nSHA::SHA1, DIGEST_SIZE
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    const unsigned char SIDECAR_VERSION = 1;
+    const unsigned int SIDECAR_GUARD_BYTES = 4096;
+    const uint64_t SIDECAR_DEFAULT_INTERVAL = 1024*1024*64;
+
+    struct IncrementalStats
+    {
+        IncrementalStats() : resumed_from( 0 ), hashed_bytes( 0 ),
+                             unchanged( false ) {}
+
+        uint64_t resumed_from;  // offset of the checkpoint used, 0 if none
+        uint64_t hashed_bytes;  // bytes read and hashed in this run
+        bool unchanged;         // digest reused, nothing read
+    };
+
+    // digest of the file at path, resuming from the sidecar at
+    // sidecar_path (path + ".s11n" when NULL) and rewriting it. a missing,
+    // foreign or stale sidecar just means hashing from byte 0. intervals
+    // below SIDECAR_GUARD_BYTES are raised to it. returns false if the
+    // file cannot be read; failing to write the sidecar is not an error
+    bool calculate_incremental( const char *path,
+                                unsigned char digest[DIGEST_SIZE],
+                                const char *sidecar_path = NULL,
+                                uint64_t interval = SIDECAR_DEFAULT_INTERVAL,
+                                IncrementalStats *stats = NULL );
+
+} // end of namespace s11nSHA
+
+#endif
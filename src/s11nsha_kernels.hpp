@@ -0,0 +1,123 @@
+/**
+ *  SHA-1 block compression kernels used by s11nSHA::SHA1, and the runtime
+ *  dispatch that picks one of them
+ *
+ *  Every kernel compresses one or more consecutive 64 byte blocks into the
+ *  five word intermediate state and must leave exactly the same state[]
+ *  behind as the scalar PolarSSL code, so that serialized SHA1 objects
+ *  stay interchangeable no matter which kernel produced them.
+ *
+ *  The kernel is resolved once, before the first block is compressed: the
+ *  one named by the S11NSHA_KERNEL environment variable if it is set and
+ *  supported, otherwise the fastest one this CPU supports. set_kernel()
+ *  pins a kernel at runtime, e.g. for A/B benchmarks.
+ *
+ *  Also home to wipe(), which the keyed code (HMAC, PBKDF2) uses to clear
+ *  key material.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_KERNELS_HPP
+#define S11NSHA_KERNELS_HPP
+
+// uint32_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// std::atomic
+#include <atomic>
+
+// DIGEST_INTS, BLOCK_BYTES
+#include "s11nsha.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define S11NSHA_X86 1
+#endif
+
+namespace s11nSHA
+{
+    // state of an empty message, before any block is compressed
+    const uint32_t SHA1_INIT[DIGEST_INTS] =
+        { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    // compress `blocks` consecutive BLOCK_BYTES sized blocks into state
+    typedef void (*process_fn)( uint32_t state[DIGEST_INTS],
+                                const unsigned char *data, size_t blocks );
+
+    // portable PolarSSL round loop; always available
+    void process_scalar( uint32_t state[DIGEST_INTS],
+                         const unsigned char *data, size_t blocks );
+
+#ifdef S11NSHA_X86
+    // x86 SHA extensions (sha1rnds4, sha1nexte, sha1msg1, sha1msg2)
+    void process_shani( uint32_t state[DIGEST_INTS],
+                        const unsigned char *data, size_t blocks );
+
+    // true if the running CPU supports SHA extensions and SSE4.1
+    bool cpu_has_shani();
+
+    // scalar rounds fed by a 4-wide SSSE3 message schedule
+    void process_ssse3( uint32_t state[DIGEST_INTS],
+                        const unsigned char *data, size_t blocks );
+
+    // scalar rounds fed by an AVX2 message schedule covering two blocks
+    void process_avx2( uint32_t state[DIGEST_INTS],
+                       const unsigned char *data, size_t blocks );
+
+    // true if the running CPU supports SSSE3
+    bool cpu_has_ssse3();
+
+    // multi-buffer kernels: compress one block for each of 8 or 16 unrelated
+    // streams at once. digest is word major, i.e. digest[w][lane] holds word
+    // w of the state of stream `lane`
+    void process_x8_avx2( uint32_t digest[DIGEST_INTS][8],
+                          const unsigned char *const data[8] );
+    void process_x16_avx512( uint32_t digest[DIGEST_INTS][16],
+                             const unsigned char *const data[16] );
+
+    // true if the running CPU (and OS) support AVX2 / AVX-512F
+    bool cpu_has_avx2();
+    bool cpu_has_avx512();
+#endif
+
+    // environment variable holding the name of the kernel to pin
+    const char KERNEL_ENV[] = "S11NSHA_KERNEL";
+
+    // kernel used by SHA1::process(); starts out at a resolver that picks
+    // the real kernel on first use, so SHA1 objects used during static
+    // initialisation are safe
+    extern std::atomic<process_fn> process_kernel;
+
+    // name of the kernel in use: "shani", "avx2", "ssse3" or "scalar"
+    const char *kernel_name();
+
+    // true if kernel `name` is built in and supported by this CPU
+    bool kernel_supported( const char *name );
+
+    // make every SHA1 object use kernel `name` from now on; returns false
+    // and keeps the current kernel if it is unknown or unsupported. also
+    // applies to the single stream tail of update_multi() and limits the
+    // multi-buffer kernels, see multi_lanes()
+    bool set_kernel( const char *name );
+
+    // go back to the fastest kernel this CPU supports, ignoring KERNEL_ENV
+    void reset_kernel();
+
+    // zero length bytes at p through a volatile pointer, so that wiping
+    // key material is not dropped as a dead store like a memset() is
+    inline void wipe( void *p, size_t length )
+    {
+        volatile unsigned char *v = (volatile unsigned char*) p;
+        while( length-- > 0 )
+            *v++ = 0;
+    }
+
+} // end of namespace s11nSHA
+
+#endif
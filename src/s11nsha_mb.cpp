@@ -0,0 +1,490 @@
+// g++ -Wall -c -std=c++0x s11nsha_mb.cpp
+// implementation of s11nsha_mb.hpp
+
+#include "s11nsha_mb.hpp"
+#include "s11nsha_kernels.hpp"
+
+// std::vector
+#include <vector>
+
+// std::strcmp
+#include <cstring>
+
+#ifdef S11NSHA_X86
+
+// __m256i, __m512i and friends
+#include <immintrin.h>
+
+// load words [8*half, 8*half+8) of one block from each of 8 streams and
+// transpose them so that W[t] holds word t of every lane, byte swapped
+__attribute__((target("avx2"), always_inline))
+static inline void load_transposed_x8( __m256i W[8],
+                                       const unsigned char *const data[8],
+                                       unsigned int half )
+{
+    const __m256i BSWAP = _mm256_set_epi8( 12, 13, 14, 15,  8,  9, 10, 11,
+                                            4,  5,  6,  7,  0,  1,  2,  3,
+                                           12, 13, 14, 15,  8,  9, 10, 11,
+                                            4,  5,  6,  7,  0,  1,  2,  3 );
+    __m256i r[8], t[8], u[8];
+
+    for( unsigned int i = 0; i < 8; ++i )
+        r[i] = _mm256_loadu_si256( (const __m256i*) ( data[i] + 32 * half ) );
+
+    for( unsigned int i = 0; i < 8; i += 2 )
+    {
+        t[i]     = _mm256_unpacklo_epi32( r[i], r[i + 1] );
+        t[i + 1] = _mm256_unpackhi_epi32( r[i], r[i + 1] );
+    }
+
+    u[0] = _mm256_unpacklo_epi64( t[0], t[2] );
+    u[1] = _mm256_unpackhi_epi64( t[0], t[2] );
+    u[2] = _mm256_unpacklo_epi64( t[1], t[3] );
+    u[3] = _mm256_unpackhi_epi64( t[1], t[3] );
+    u[4] = _mm256_unpacklo_epi64( t[4], t[6] );
+    u[5] = _mm256_unpackhi_epi64( t[4], t[6] );
+    u[6] = _mm256_unpacklo_epi64( t[5], t[7] );
+    u[7] = _mm256_unpackhi_epi64( t[5], t[7] );
+
+    for( unsigned int i = 0; i < 4; ++i )
+    {
+        W[i]     = _mm256_shuffle_epi8(
+                     _mm256_permute2x128_si256( u[i], u[i + 4], 0x20 ), BSWAP );
+        W[i + 4] = _mm256_shuffle_epi8(
+                     _mm256_permute2x128_si256( u[i], u[i + 4], 0x31 ), BSWAP );
+    }
+}
+
+// the round structure is the same as process_scalar(), with every variable
+// holding one word per lane. the V_* and F_* macros are defined per
+// instruction set below
+#define MB_W(t)                                                         \
+    ( W[(t) & 0x0F] = V_ROL( V_XOR( V_XOR( W[((t) - 3) & 0x0F],         \
+                                           W[((t) - 8) & 0x0F] ),       \
+                                    V_XOR( W[((t) - 14) & 0x0F],        \
+                                           W[(t) & 0x0F] ) ), 1 ) )
+
+#define MB_P(F,k,x)                                                     \
+{                                                                       \
+    temp = V_ADD( V_ADD( V_ROL( A, 5 ), F( B, C, D ) ),                 \
+                  V_ADD( V_ADD( E, k ), x ) );                          \
+    E = D; D = C; C = V_ROL( B, 30 ); B = A; A = temp;                  \
+}
+
+#define MB_ROUNDS                                                       \
+{                                                                       \
+    unsigned int t;                                                     \
+                                                                        \
+    A = V_LOAD( digest[0] ); B = V_LOAD( digest[1] );                   \
+    C = V_LOAD( digest[2] ); D = V_LOAD( digest[3] );                   \
+    E = V_LOAD( digest[4] );                                            \
+                                                                        \
+    for( t =  0; t < 16; ++t ) MB_P( F_CH,  K0, W[t] );                 \
+    for( t = 16; t < 20; ++t ) MB_P( F_CH,  K0, MB_W(t) );              \
+    for( t = 20; t < 40; ++t ) MB_P( F_XOR, K1, MB_W(t) );              \
+    for( t = 40; t < 60; ++t ) MB_P( F_MAJ, K2, MB_W(t) );              \
+    for( t = 60; t < 80; ++t ) MB_P( F_XOR, K3, MB_W(t) );              \
+                                                                        \
+    V_STORE( digest[0], V_ADD( A, V_LOAD( digest[0] ) ) );              \
+    V_STORE( digest[1], V_ADD( B, V_LOAD( digest[1] ) ) );              \
+    V_STORE( digest[2], V_ADD( C, V_LOAD( digest[2] ) ) );              \
+    V_STORE( digest[3], V_ADD( D, V_LOAD( digest[3] ) ) );              \
+    V_STORE( digest[4], V_ADD( E, V_LOAD( digest[4] ) ) );              \
+}
+
+__attribute__((target("avx2")))
+void s11nSHA::process_x8_avx2( uint32_t digest[DIGEST_INTS][8],
+                               const unsigned char *const data[8] )
+{
+    #define V_LOAD(p)    _mm256_loadu_si256( (const __m256i*) (p) )
+    #define V_STORE(p,v) _mm256_storeu_si256( (__m256i*) (p), (v) )
+    #define V_ADD(x,y)   _mm256_add_epi32( x, y )
+    #define V_XOR(x,y)   _mm256_xor_si256( x, y )
+    #define V_ROL(x,n)   _mm256_or_si256( _mm256_slli_epi32( x, n ),      \
+                                          _mm256_srli_epi32( x, 32 - n ) )
+    #define F_CH(x,y,z)  V_XOR( z, _mm256_and_si256( x, V_XOR( y, z ) ) )
+    #define F_XOR(x,y,z) V_XOR( x, V_XOR( y, z ) )
+    #define F_MAJ(x,y,z) _mm256_or_si256( _mm256_and_si256( x, y ),       \
+                             _mm256_and_si256( z, _mm256_or_si256( x, y ) ) )
+
+    const __m256i K0 = _mm256_set1_epi32( 0x5A827999 );
+    const __m256i K1 = _mm256_set1_epi32( 0x6ED9EBA1 );
+    const __m256i K2 = _mm256_set1_epi32( (int) 0x8F1BBCDC );
+    const __m256i K3 = _mm256_set1_epi32( (int) 0xCA62C1D6 );
+    __m256i W[16], A, B, C, D, E, temp;
+
+    load_transposed_x8( W, data, 0 );
+    load_transposed_x8( W + 8, data, 1 );
+
+    MB_ROUNDS
+
+    #undef F_MAJ
+    #undef F_XOR
+    #undef F_CH
+    #undef V_ROL
+    #undef V_XOR
+    #undef V_ADD
+    #undef V_STORE
+    #undef V_LOAD
+}
+
+// gcc 12 warns about the _mm512_undefined_epi32() placeholders inside its own
+// avx512fintrin.h wrappers (gcc bug 105593)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+__attribute__((target("avx512f,avx2")))
+void s11nSHA::process_x16_avx512( uint32_t digest[DIGEST_INTS][16],
+                                  const unsigned char *const data[16] )
+{
+    #define V_LOAD(p)    _mm512_loadu_si512( (const void*) (p) )
+    #define V_STORE(p,v) _mm512_storeu_si512( (void*) (p), (v) )
+    #define V_ADD(x,y)   _mm512_add_epi32( x, y )
+    #define V_XOR(x,y)   _mm512_xor_si512( x, y )
+    #define V_ROL(x,n)   _mm512_rol_epi32( x, n )
+    #define F_CH(x,y,z)  _mm512_ternarylogic_epi32( x, y, z, 0xCA )
+    #define F_XOR(x,y,z) _mm512_ternarylogic_epi32( x, y, z, 0x96 )
+    #define F_MAJ(x,y,z) _mm512_ternarylogic_epi32( x, y, z, 0xE8 )
+
+    const __m512i K0 = _mm512_set1_epi32( 0x5A827999 );
+    const __m512i K1 = _mm512_set1_epi32( 0x6ED9EBA1 );
+    const __m512i K2 = _mm512_set1_epi32( (int) 0x8F1BBCDC );
+    const __m512i K3 = _mm512_set1_epi32( (int) 0xCA62C1D6 );
+    __m512i W[16], A, B, C, D, E, temp;
+    __m256i lo[16], hi[16];
+
+    load_transposed_x8( lo, data, 0 );
+    load_transposed_x8( lo + 8, data, 1 );
+    load_transposed_x8( hi, data + 8, 0 );
+    load_transposed_x8( hi + 8, data + 8, 1 );
+
+    for( unsigned int t = 0; t < 16; ++t )
+        W[t] = _mm512_inserti64x4( _mm512_castsi256_si512( lo[t] ), hi[t], 1 );
+
+    MB_ROUNDS
+
+    #undef F_MAJ
+    #undef F_XOR
+    #undef F_CH
+    #undef V_ROL
+    #undef V_XOR
+    #undef V_ADD
+    #undef V_STORE
+    #undef V_LOAD
+}
+
+#pragma GCC diagnostic pop
+
+#undef MB_ROUNDS
+#undef MB_P
+#undef MB_W
+
+#endif // S11NSHA_X86
+
+unsigned int s11nSHA::multi_lanes()
+{
+#ifdef S11NSHA_X86
+    static const unsigned int lanes = cpu_has_avx512() ? 16
+                                    : cpu_has_avx2()   ?  8 : 1;
+
+    // a kernel pinned below AVX2 (to debug, or to avoid a faulty unit)
+    // keeps the multi-buffer kernels out of the way too; avx2 caps them
+    // at the 8 lane one
+    const char *kernel = kernel_name();
+    if( std::strcmp( kernel, "scalar" ) == 0 || std::strcmp( kernel, "ssse3" ) == 0 )
+        return 1;
+    if( std::strcmp( kernel, "avx2" ) == 0 && lanes > 8 )
+        return 8;
+    return lanes;
+#else
+    return 1;
+#endif
+}
+
+void s11nSHA::update_multi( SHA1 *const contexts[],
+                            const unsigned char *const inputs[],
+                            const size_t lengths[], size_t count )
+{
+    const unsigned int lanes = multi_lanes();
+
+    if( lanes < 2 )
+    {
+        for( size_t i = 0; i < count; ++i )
+            contexts[i]->update( inputs[i], lengths[i] );
+        return;
+    }
+
+#ifdef S11NSHA_X86
+    // idle lanes keep hashing this block; their results are never used
+    static const unsigned char idle_block[BLOCK_BYTES] = { 0 };
+
+    // word w of lane l lives at digest[w * lanes + l]
+    uint32_t digest[DIGEST_INTS * MB_MAX_LANES];
+    const unsigned char *data[MB_MAX_LANES], *rest[MB_MAX_LANES];
+    size_t blocks[MB_MAX_LANES], full[MB_MAX_LANES], tail[MB_MAX_LANES];
+    size_t owner[MB_MAX_LANES];
+    size_t next = 0, active = 0;
+
+    // top up the partial block of the next stream through update(), then
+    // put its full blocks on a lane. streams without full blocks are done
+    // right here
+    auto assign = [&]( unsigned int lane )
+    {
+        while( next < count )
+        {
+            SHA1 &sha = *contexts[next];
+            const unsigned char *input = inputs[next];
+            size_t length = lengths[next];
+            size_t left = sha.total[0] & 0x3F;
+
+            if( left && length > 0 )
+            {
+                size_t head = BLOCK_BYTES - left;
+                if( head > length )
+                    head = length;
+                sha.update( input, head );
+                input += head;
+                length -= head;
+            }
+
+            if( length < BLOCK_BYTES )
+            {
+                sha.update( input, length );
+                ++next;
+                continue;
+            }
+
+            for( unsigned int w = 0; w < DIGEST_INTS; ++w )
+                digest[w * lanes + lane] = sha.state[w];
+            data[lane] = input;
+            blocks[lane] = length / BLOCK_BYTES;
+            full[lane] = blocks[lane] * BLOCK_BYTES;
+            rest[lane] = input + full[lane];
+            tail[lane] = length - full[lane];
+            owner[lane] = next++;
+            ++active;
+            return;
+        }
+
+        data[lane] = idle_block;
+        blocks[lane] = 0;
+        owner[lane] = count;
+    };
+
+    // hand the lane state back to its SHA1 object, finish any blocks left
+    // on it with the single stream kernel, account for the bytes that were
+    // compressed behind update()'s back and buffer the leftover bytes
+    auto retire = [&]( unsigned int lane )
+    {
+        SHA1 &sha = *contexts[owner[lane]];
+        uint32_t low = sha.total[0];
+
+        for( unsigned int w = 0; w < DIGEST_INTS; ++w )
+            sha.state[w] = digest[w * lanes + lane];
+
+        if( blocks[lane] > 0 )
+            sha.process( data[lane], blocks[lane] );
+
+        sha.total[0] += static_cast<uint32_t>( full[lane] );
+        sha.total[1] += static_cast<uint32_t>( (uint64_t) full[lane] >> 32 );
+        if( sha.total[0] < low )
+            sha.total[1]++;
+
+        sha.update( rest[lane], tail[lane] );
+        owner[lane] = count;
+        --active;
+    };
+
+    for( unsigned int lane = 0; lane < lanes; ++lane )
+        assign( lane );
+
+    // once nothing is left to refill with, a handful of long streams would
+    // leave most lanes idle; they are cheaper to finish one at a time
+    while( active > 0 && ( next < count || active > lanes / 4 ) )
+    {
+        if( lanes == 16 )
+            process_x16_avx512( (uint32_t (*)[16]) digest, data );
+        else
+            process_x8_avx2( (uint32_t (*)[8]) digest, data );
+
+        for( unsigned int lane = 0; lane < lanes; ++lane )
+        {
+            if( owner[lane] == count )
+                continue;
+
+            data[lane] += BLOCK_BYTES;
+            if( --blocks[lane] == 0 )
+            {
+                retire( lane );
+                assign( lane );
+            }
+        }
+    }
+
+    for( unsigned int lane = 0; lane < lanes; ++lane )
+        if( owner[lane] != count )
+            retire( lane );
+#endif
+}
+
+namespace
+{
+    size_t padded_blocks( size_t length )
+    {
+        return ( length + 8 ) / s11nSHA::BLOCK_BYTES + 1;
+    }
+
+    // fill tail with the bytes after the last full block plus the 0x80,
+    // zeros and bit length of the padding; returns the number of tail
+    // blocks (1 or 2)
+    size_t pad_tail( const unsigned char *input, size_t length,
+                     unsigned char tail[2 * s11nSHA::BLOCK_BYTES] )
+    {
+        size_t full = length / s11nSHA::BLOCK_BYTES * s11nSHA::BLOCK_BYTES;
+        size_t rest = length - full;
+        size_t blocks = padded_blocks( length ) - full / s11nSHA::BLOCK_BYTES;
+        size_t end = blocks * s11nSHA::BLOCK_BYTES;
+        uint64_t bits = (uint64_t) length << 3;
+
+        std::memcpy( tail, input + full, rest );
+        tail[rest] = 0x80;
+        std::memset( tail + rest + 1, 0, end - rest - 1 );
+        for( int i = 0; i < 8; ++i )
+            tail[end - 1 - i] = (unsigned char) ( bits >> ( 8 * i ) );
+        return blocks;
+    }
+
+    void put_digest( const uint32_t state[s11nSHA::DIGEST_INTS],
+                     unsigned char digest[s11nSHA::DIGEST_SIZE] )
+    {
+        for( unsigned int w = 0; w < s11nSHA::DIGEST_INTS; ++w )
+        {
+            digest[4 * w    ] = (unsigned char) ( state[w] >> 24 );
+            digest[4 * w + 1] = (unsigned char) ( state[w] >> 16 );
+            digest[4 * w + 2] = (unsigned char) ( state[w] >>  8 );
+            digest[4 * w + 3] = (unsigned char) ( state[w]       );
+        }
+    }
+
+} // end of anonymous namespace
+
+void s11nSHA::calculate_batch( const unsigned char *const inputs[],
+                               const size_t lengths[], size_t count,
+                               unsigned char digests[][DIGEST_SIZE] )
+{
+    const unsigned int lanes = multi_lanes();
+    unsigned char tail[MB_MAX_LANES][2 * BLOCK_BYTES];
+
+    if( lanes < 2 )
+    {
+        process_fn process = process_kernel.load( std::memory_order_relaxed );
+        for( size_t i = 0; i < count; ++i )
+        {
+            uint32_t state[DIGEST_INTS];
+            std::memcpy( state, SHA1_INIT, sizeof( state ) );
+            process( state, inputs[i], lengths[i] / BLOCK_BYTES );
+            process( state, tail[0], pad_tail( inputs[i], lengths[i], tail[0] ) );
+            put_digest( state, digests[i] );
+        }
+        return;
+    }
+
+#ifdef S11NSHA_X86
+    static const unsigned char idle_block[BLOCK_BYTES] = { 0 };
+
+    // short messages grouped by block count (a counting sort), so a pass
+    // rarely carries a lane that has already finished; long ones are set
+    // aside
+    size_t start[BATCH_MAX_BLOCKS + 2] = { 0 };
+    std::vector<size_t> order, long_ones;
+    for( size_t i = 0; i < count; ++i )
+    {
+        size_t b = padded_blocks( lengths[i] );
+        if( b <= BATCH_MAX_BLOCKS )
+            ++start[b + 1];
+        else
+            long_ones.push_back( i );
+    }
+    for( size_t b = 1; b <= BATCH_MAX_BLOCKS + 1; ++b )
+        start[b] += start[b - 1];
+    order.resize( start[BATCH_MAX_BLOCKS + 1] );
+    for( size_t i = 0; i < count; ++i )
+    {
+        size_t b = padded_blocks( lengths[i] );
+        if( b <= BATCH_MAX_BLOCKS )
+            order[start[b]++] = i;
+    }
+
+    // word w of lane l lives at digest[w * lanes + l]
+    uint32_t digest[DIGEST_INTS * MB_MAX_LANES];
+    const unsigned char *data[MB_MAX_LANES];
+    size_t owner[MB_MAX_LANES], full[MB_MAX_LANES], blocks[MB_MAX_LANES];
+
+    for( size_t first = 0; first < order.size(); first += lanes )
+    {
+        size_t n = order.size() - first;
+        if( n > lanes )
+            n = lanes;
+
+        size_t passes = 0;
+        for( unsigned int lane = 0; lane < lanes; ++lane )
+        {
+            for( unsigned int w = 0; w < DIGEST_INTS; ++w )
+                digest[w * lanes + lane] = SHA1_INIT[w];
+            if( lane >= n )
+            {
+                blocks[lane] = 0;
+                continue;
+            }
+            size_t i = order[first + lane];
+            owner[lane] = i;
+            full[lane] = lengths[i] / BLOCK_BYTES;
+            blocks[lane] = full[lane] + pad_tail( inputs[i], lengths[i], tail[lane] );
+            if( blocks[lane] > passes )
+                passes = blocks[lane];
+        }
+
+        // full blocks straight from the input, then the padded tail
+        for( size_t b = 0; b < passes; ++b )
+        {
+            for( unsigned int lane = 0; lane < lanes; ++lane )
+                data[lane] = b >= blocks[lane] ? idle_block
+                           : b < full[lane] ? inputs[owner[lane]] + b * BLOCK_BYTES
+                           : tail[lane] + ( b - full[lane] ) * BLOCK_BYTES;
+
+            if( lanes == 16 )
+                process_x16_avx512( (uint32_t (*)[16]) digest, data );
+            else
+                process_x8_avx2( (uint32_t (*)[8]) digest, data );
+
+            for( unsigned int lane = 0; lane < n; ++lane )
+                if( b + 1 == blocks[lane] )
+                {
+                    uint32_t state[DIGEST_INTS];
+                    for( unsigned int w = 0; w < DIGEST_INTS; ++w )
+                        state[w] = digest[w * lanes + lane];
+                    put_digest( state, digests[owner[lane]] );
+                }
+        }
+    }
+
+    // long messages keep their lanes busy on their own
+    if( !long_ones.empty() )
+    {
+        std::vector<SHA1> contexts( long_ones.size() );
+        std::vector<SHA1*> ptrs( long_ones.size() );
+        std::vector<const unsigned char*> long_inputs( long_ones.size() );
+        std::vector<size_t> long_lengths( long_ones.size() );
+        for( size_t k = 0; k < long_ones.size(); ++k )
+        {
+            ptrs[k] = &contexts[k];
+            long_inputs[k] = inputs[long_ones[k]];
+            long_lengths[k] = lengths[long_ones[k]];
+        }
+        update_multi( &ptrs[0], &long_inputs[0], &long_lengths[0],
+                      long_ones.size() );
+        for( size_t k = 0; k < long_ones.size(); ++k )
+            contexts[k].final( digests[long_ones[k]] );
+    }
+#endif
+}
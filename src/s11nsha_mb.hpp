@@ -0,0 +1,56 @@
+/**
+ *  Multi-buffer SHA-1: advance many independent s11nSHA::SHA1 streams at
+ *  once, one block per SIMD lane (8 lanes with AVX2, 16 with AVX-512).
+ *
+ *  The contexts are ordinary SHA1 objects; they can be updated, finalized
+ *  or marshalled individually before and after a multi-buffer call.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_MB_HPP
+#define S11NSHA_MB_HPP
+
+// size_t
+#include <cstring>
+
+// s11nSHA::SHA1
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    const unsigned int MB_MAX_LANES = 16;
+
+    // number of streams compressed per SIMD pass on this CPU; 1 means
+    // update_multi() falls back to calling SHA1::update() per stream.
+    // follows a pinned kernel: 1 with scalar or ssse3, at most 8 with avx2
+    unsigned int multi_lanes();
+
+    // same as contexts[i]->update( inputs[i], lengths[i] ) for every
+    // i < count. contexts must be distinct objects. streams of different
+    // lengths are fine: a lane that runs out of blocks is retired and
+    // refilled with the next stream
+    void update_multi( SHA1 *const contexts[],
+                       const unsigned char *const inputs[],
+                       const size_t lengths[], size_t count );
+
+    // messages of up to this many padded blocks share SIMD passes in
+    // calculate_batch(); longer ones go through update_multi()
+    const unsigned int BATCH_MAX_BLOCKS = 16;
+
+    // same as SHA1().calculate( inputs[i], lengths[i], digests[i] ) for
+    // every i < count, for many short messages (keys, ids) at once:
+    // messages are grouped by padded block count and padded in place, so
+    // each SIMD pass compresses a block of `multi_lanes()` of them with no
+    // per-message init/final. without multi-lane kernels every message
+    // still skips the SHA1 object and goes straight to the block kernel
+    void calculate_batch( const unsigned char *const inputs[],
+                          const size_t lengths[], size_t count,
+                          unsigned char digests[][DIGEST_SIZE] );
+
+} // end of namespace s11nSHA
+
+#endif
@@ -0,0 +1,279 @@
+// g++ -Wall -c -std=c++0x s11nsha_pbkdf2.cpp
+// implementation of s11nsha_pbkdf2.hpp
+
+#include "s11nsha_pbkdf2.hpp"
+#include "s11nsha_kernels.hpp"
+#include "s11nsha_mb.hpp"
+
+// std::vector
+#include <vector>
+
+namespace
+{
+    using s11nSHA::DIGEST_INTS;
+    using s11nSHA::DIGEST_SIZE;
+    using s11nSHA::BLOCK_BYTES;
+
+    // one output block of one derivation
+    struct job
+    {
+        uint32_t inner[DIGEST_INTS];  // state after ( password ^ ipad )
+        uint32_t outer[DIGEST_INTS];  // state after ( password ^ opad )
+        uint32_t u[DIGEST_INTS];      // U_i
+        uint32_t t[DIGEST_INTS];      // U_1 ^ ... ^ U_i
+        unsigned char *out;
+        size_t out_bytes;
+    };
+
+    void put_words( unsigned char *p, const uint32_t words[DIGEST_INTS] )
+    {
+        for( unsigned int w = 0; w < DIGEST_INTS; ++w, p += 4 )
+        {
+            p[0] = (unsigned char) ( words[w] >> 24 );
+            p[1] = (unsigned char) ( words[w] >> 16 );
+            p[2] = (unsigned char) ( words[w] >>  8 );
+            p[3] = (unsigned char) ( words[w]       );
+        }
+    }
+
+    // every block hashed in the loop is a 20 byte message following a key
+    // block: digest, 0x80, zeros, bit length ( 64 + 20 ) * 8 = 672
+    void pad_block( unsigned char block[BLOCK_BYTES] )
+    {
+        std::memset( block, 0, BLOCK_BYTES );
+        block[DIGEST_SIZE] = 0x80;
+        block[BLOCK_BYTES - 2] = 0x02;
+        block[BLOCK_BYTES - 1] = 0xA0;
+    }
+
+    // key states of password, then U_1 of each output block. U_1 is the
+    // MAC of salt || INT( i ), computed from the same key states as the
+    // other U_i instead of setting up an HMAC_SHA1 with the password again
+    void setup( const unsigned char *password, size_t password_length,
+                const unsigned char *salt, size_t salt_length,
+                unsigned char *key, size_t key_length, std::vector<job>& jobs )
+    {
+        s11nSHA::process_fn process =
+            s11nSHA::process_kernel.load( std::memory_order_relaxed );
+        unsigned char block[BLOCK_BYTES] = { 0 };
+        unsigned char pad[BLOCK_BYTES];
+        uint32_t inner[DIGEST_INTS], outer[DIGEST_INTS];
+
+        if( password_length > BLOCK_BYTES )
+        {
+            s11nSHA::SHA1 sha1;
+            sha1.calculate( password, password_length, block );
+        }
+        else if( password_length > 0 )
+            std::memcpy( block, password, password_length );
+
+        std::memcpy( inner, s11nSHA::SHA1_INIT, sizeof( inner ) );
+        for( unsigned int i = 0; i < BLOCK_BYTES; ++i )
+            pad[i] = block[i] ^ 0x36;
+        process( inner, pad, 1 );
+
+        std::memcpy( outer, s11nSHA::SHA1_INIT, sizeof( outer ) );
+        for( unsigned int i = 0; i < BLOCK_BYTES; ++i )
+            pad[i] = block[i] ^ 0x5C;
+        process( outer, pad, 1 );
+
+        s11nSHA::wipe( block, BLOCK_BYTES );
+        s11nSHA::wipe( pad, BLOCK_BYTES );
+
+        // salt || INT( i ) and its padding, after the key block: 0x80,
+        // zeros, then the bit length of all of it
+        size_t message_length = salt_length + 4;
+        std::vector<unsigned char> message(
+            ( message_length + 9 + BLOCK_BYTES - 1 ) / BLOCK_BYTES * BLOCK_BYTES, 0 );
+        if( salt_length > 0 )
+            std::memcpy( &message[0], salt, salt_length );
+        message[message_length] = 0x80;
+        uint64_t bits = ( (uint64_t) BLOCK_BYTES + message_length ) * 8;
+        for( unsigned int k = 0; k < 8; ++k )
+            message[message.size() - 1 - k] = (unsigned char) ( bits >> ( 8 * k ) );
+
+        unsigned char out[BLOCK_BYTES];
+        uint32_t state[DIGEST_INTS];
+        pad_block( out );
+        for( uint32_t i = 1; key_length > 0; ++i )
+        {
+            job j;
+
+            message[salt_length    ] = (unsigned char) ( i >> 24 );
+            message[salt_length + 1] = (unsigned char) ( i >> 16 );
+            message[salt_length + 2] = (unsigned char) ( i >>  8 );
+            message[salt_length + 3] = (unsigned char) ( i       );
+            std::memcpy( state, inner, sizeof( state ) );
+            process( state, &message[0], message.size() / BLOCK_BYTES );
+
+            put_words( out, state );
+            std::memcpy( j.u, outer, sizeof( j.u ) );
+            process( j.u, out, 1 );
+
+            std::memcpy( j.inner, inner, sizeof( inner ) );
+            std::memcpy( j.outer, outer, sizeof( outer ) );
+            std::memcpy( j.t, j.u, sizeof( j.u ) );
+            j.out = key;
+            j.out_bytes = key_length < DIGEST_SIZE ? key_length : DIGEST_SIZE;
+            key += j.out_bytes;
+            key_length -= j.out_bytes;
+            jobs.push_back( j );
+        }
+    }
+
+    void iterate_single( job& j, uint32_t rounds )
+    {
+        s11nSHA::process_fn process =
+            s11nSHA::process_kernel.load( std::memory_order_relaxed );
+        unsigned char in[BLOCK_BYTES], out[BLOCK_BYTES];
+        uint32_t state[DIGEST_INTS];
+
+        pad_block( in );
+        pad_block( out );
+        while( rounds-- > 0 )
+        {
+            put_words( in, j.u );
+            std::memcpy( state, j.inner, sizeof( state ) );
+            process( state, in, 1 );
+
+            put_words( out, state );
+            std::memcpy( j.u, j.outer, sizeof( j.u ) );
+            process( j.u, out, 1 );
+
+            for( unsigned int w = 0; w < DIGEST_INTS; ++w )
+                j.t[w] ^= j.u[w];
+        }
+    }
+
+#ifdef S11NSHA_X86
+    // n <= lanes jobs, one per lane; word w of lane l lives at
+    // digest[w * lanes + l]
+    void iterate_multi( job *jobs, size_t n, unsigned int lanes,
+                        uint32_t rounds )
+    {
+        unsigned char in[s11nSHA::MB_MAX_LANES][BLOCK_BYTES];
+        unsigned char out[s11nSHA::MB_MAX_LANES][BLOCK_BYTES];
+        const unsigned char *in_data[s11nSHA::MB_MAX_LANES];
+        const unsigned char *out_data[s11nSHA::MB_MAX_LANES];
+        uint32_t digest[DIGEST_INTS * s11nSHA::MB_MAX_LANES] = { 0 };
+        uint32_t words[DIGEST_INTS];
+
+        for( unsigned int lane = 0; lane < lanes; ++lane )
+        {
+            pad_block( in[lane] );
+            pad_block( out[lane] );
+            in_data[lane] = in[lane];
+            out_data[lane] = out[lane];
+        }
+
+        while( rounds-- > 0 )
+        {
+            for( size_t lane = 0; lane < n; ++lane )
+            {
+                put_words( in[lane], jobs[lane].u );
+                for( unsigned int w = 0; w < DIGEST_INTS; ++w )
+                    digest[w * lanes + lane] = jobs[lane].inner[w];
+            }
+            if( lanes == 16 )
+                s11nSHA::process_x16_avx512( (uint32_t (*)[16]) digest, in_data );
+            else
+                s11nSHA::process_x8_avx2( (uint32_t (*)[8]) digest, in_data );
+
+            for( size_t lane = 0; lane < n; ++lane )
+            {
+                for( unsigned int w = 0; w < DIGEST_INTS; ++w )
+                {
+                    words[w] = digest[w * lanes + lane];
+                    digest[w * lanes + lane] = jobs[lane].outer[w];
+                }
+                put_words( out[lane], words );
+            }
+            if( lanes == 16 )
+                s11nSHA::process_x16_avx512( (uint32_t (*)[16]) digest, out_data );
+            else
+                s11nSHA::process_x8_avx2( (uint32_t (*)[8]) digest, out_data );
+
+            for( size_t lane = 0; lane < n; ++lane )
+                for( unsigned int w = 0; w < DIGEST_INTS; ++w )
+                {
+                    jobs[lane].u[w] = digest[w * lanes + lane];
+                    jobs[lane].t[w] ^= jobs[lane].u[w];
+                }
+        }
+    }
+#endif
+
+} // end of anonymous namespace
+
+void s11nSHA::pbkdf2_hmac_sha1_multi( const unsigned char *const passwords[],
+                                      const size_t password_lengths[],
+                                      const unsigned char *const salts[],
+                                      const size_t salt_lengths[], size_t count,
+                                      uint32_t iterations,
+                                      unsigned char *const keys[],
+                                      size_t key_length )
+{
+    std::vector<job> jobs;
+    for( size_t i = 0; i < count; ++i )
+        setup( passwords[i], password_lengths[i], salts[i], salt_lengths[i],
+               keys[i], key_length, jobs );
+
+    uint32_t rounds = iterations > 1 ? iterations - 1 : 0;
+    size_t first = 0;
+
+#ifdef S11NSHA_X86
+    const unsigned int lanes = multi_lanes();
+
+    // a nearly empty SIMD pass is slower than a few single stream ones, as
+    // in update_multi()
+    for( ; lanes >= 2 && jobs.size() - first > lanes / 4; first += lanes )
+    {
+        size_t n = jobs.size() - first;
+        iterate_multi( &jobs[first], n < lanes ? n : lanes, lanes, rounds );
+        if( n <= lanes )
+        {
+            first = jobs.size();
+            break;
+        }
+    }
+#endif
+    for( ; first < jobs.size(); ++first )
+        iterate_single( jobs[first], rounds );
+
+    for( size_t k = 0; k < jobs.size(); ++k )
+    {
+        unsigned char t[DIGEST_SIZE];
+        put_words( t, jobs[k].t );
+        std::memcpy( jobs[k].out, t, jobs[k].out_bytes );
+    }
+}
+
+void s11nSHA::pbkdf2_hmac_sha1( const unsigned char *password,
+                                size_t password_length,
+                                const unsigned char *salt, size_t salt_length,
+                                uint32_t iterations,
+                                unsigned char *key, size_t key_length )
+{
+    pbkdf2_hmac_sha1_multi( &password, &password_length, &salt, &salt_length,
+                            1, iterations, &key, key_length );
+}
+
+bool s11nSHA::pbkdf2_hmac_sha1_verify( const unsigned char *password,
+                                       size_t password_length,
+                                       const unsigned char *salt,
+                                       size_t salt_length, uint32_t iterations,
+                                       const unsigned char *expected,
+                                       size_t expected_length )
+{
+    std::vector<unsigned char> key( expected_length );
+    unsigned char diff = 0;
+
+    if( expected_length == 0 )
+        return false;
+
+    pbkdf2_hmac_sha1( password, password_length, salt, salt_length,
+                      iterations, &key[0], expected_length );
+    for( size_t i = 0; i < expected_length; ++i )
+        diff |= key[i] ^ expected[i];
+    return diff == 0;
+}
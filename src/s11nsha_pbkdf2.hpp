@@ -0,0 +1,55 @@
+/**
+ *  PBKDF2-HMAC-SHA1 (RFC 2898 / RFC 6070)
+ *
+ *  The iteration loop never goes through SHA1 objects: the HMAC key states
+ *  are five words each, every U_i is one inner and one outer compression
+ *  of a single, pre-padded block, and only the 20 changing bytes of that
+ *  block are rewritten per iteration. Independent output blocks and
+ *  independent derivations (e.g. a burst of logins) run side by side on
+ *  the multi-buffer kernels, one per SIMD lane.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_PBKDF2_HPP
+#define S11NSHA_PBKDF2_HPP
+
+// uint32_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+namespace s11nSHA
+{
+    // derive key_length bytes from password and salt; iterations 0 counts
+    // as 1
+    void pbkdf2_hmac_sha1( const unsigned char *password, size_t password_length,
+                           const unsigned char *salt, size_t salt_length,
+                           uint32_t iterations,
+                           unsigned char *key, size_t key_length );
+
+    // count derivations at once, each with its own password and salt but
+    // the same iteration count and key length; keys[i] receives the key of
+    // passwords[i]
+    void pbkdf2_hmac_sha1_multi( const unsigned char *const passwords[],
+                                 const size_t password_lengths[],
+                                 const unsigned char *const salts[],
+                                 const size_t salt_lengths[], size_t count,
+                                 uint32_t iterations,
+                                 unsigned char *const keys[], size_t key_length );
+
+    // derive and compare with expected in constant time
+    bool pbkdf2_hmac_sha1_verify( const unsigned char *password,
+                                  size_t password_length,
+                                  const unsigned char *salt, size_t salt_length,
+                                  uint32_t iterations,
+                                  const unsigned char *expected,
+                                  size_t expected_length );
+
+} // end of namespace s11nSHA
+
+#endif
@@ -0,0 +1,191 @@
+// g++ -Wall -c -std=c++0x -pthread s11nsha_pipeline.cpp
+// implementation of s11nsha_pipeline.hpp
+
+#include "s11nsha_pipeline.hpp"
+
+// std::chrono::steady_clock
+#include <chrono>
+
+// std::condition_variable
+#include <condition_variable>
+
+// std::deque
+#include <deque>
+
+// std::mutex, std::unique_lock
+#include <mutex>
+
+// std::thread
+#include <thread>
+
+// std::vector
+#include <vector>
+
+// errno, EINTR
+#include <cerrno>
+
+// posix_memalign, free
+#include <cstdlib>
+
+// open, O_RDONLY, posix_fadvise
+#include <fcntl.h>
+
+// read, close
+#include <unistd.h>
+
+namespace
+{
+    typedef std::chrono::steady_clock clock_type;
+
+    double seconds_since( clock_type::time_point start )
+    {
+        return std::chrono::duration<double>( clock_type::now() - start ).count();
+    }
+
+    // a filled buffer; length 0 marks end of file
+    struct chunk
+    {
+        size_t buffer;
+        size_t length;
+    };
+
+    // buffers move from free to full (reader) and back (hasher)
+    struct ring
+    {
+        std::mutex lock;
+        std::condition_variable changed;
+        std::deque<size_t> free;
+        std::deque<chunk> full;
+        bool read_error;
+    };
+
+    void reader( int fd, const std::vector<unsigned char*>& buffers,
+                 size_t buffer_bytes, ring& r, s11nSHA::PipelineStats& stats )
+    {
+        for( ;; )
+        {
+            size_t buffer;
+            {
+                clock_type::time_point wait = clock_type::now();
+                std::unique_lock<std::mutex> guard( r.lock );
+                while( r.free.empty() )
+                    r.changed.wait( guard );
+                stats.cpu_bound_seconds += seconds_since( wait );
+                buffer = r.free.front();
+                r.free.pop_front();
+            }
+
+            // fill the whole buffer unless the input ends first
+            clock_type::time_point start = clock_type::now();
+            size_t length = 0;
+            bool error = false;
+            while( length < buffer_bytes )
+            {
+                ssize_t n = read( fd, buffers[buffer] + length,
+                                  buffer_bytes - length );
+                if( n < 0 && errno == EINTR )
+                    continue;
+                if( n < 0 )
+                    error = true;
+                if( n <= 0 )
+                    break;
+                length += (size_t) n;
+            }
+            stats.read_seconds += seconds_since( start );
+
+            std::lock_guard<std::mutex> guard( r.lock );
+            if( length > 0 )
+                r.full.push_back( chunk{ buffer, length } );
+            if( length < buffer_bytes )
+            {
+                r.read_error = error;
+                r.full.push_back( chunk{ buffer, 0 } );
+                r.changed.notify_all();
+                return;
+            }
+            r.changed.notify_all();
+        }
+    }
+}
+
+bool s11nSHA::calculate_pipelined( const char *path,
+                                   unsigned char digest[DIGEST_SIZE],
+                                   const PipelineOptions& options,
+                                   PipelineStats *stats )
+{
+    const size_t align = 4096;
+    size_t count = options.buffers < 2 ? 2 : options.buffers;
+    size_t buffer_bytes = ( options.buffer_bytes + align - 1 ) & ~( align - 1 );
+    clock_type::time_point start = clock_type::now();
+    PipelineStats local;
+    std::vector<unsigned char*> buffers;
+    ring r;
+    int fd;
+
+    if( buffer_bytes == 0 )
+        buffer_bytes = align;
+
+    if( ( fd = open( path, O_RDONLY ) ) < 0 )
+        return false;
+
+    posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        void *p;
+        if( posix_memalign( &p, align, buffer_bytes ) != 0 )
+            break;
+        buffers.push_back( (unsigned char*) p );
+        r.free.push_back( i );
+    }
+
+    r.read_error = false;
+
+    bool ok = buffers.size() == count;
+    if( ok )
+    {
+        std::thread io( reader, fd, std::cref( buffers ), buffer_bytes,
+                        std::ref( r ), std::ref( local ) );
+        SHA1 sha1;
+
+        for( ;; )
+        {
+            chunk c;
+            {
+                clock_type::time_point wait = clock_type::now();
+                std::unique_lock<std::mutex> guard( r.lock );
+                while( r.full.empty() )
+                    r.changed.wait( guard );
+                local.io_bound_seconds += seconds_since( wait );
+                c = r.full.front();
+                r.full.pop_front();
+            }
+
+            if( c.length == 0 )
+                break;
+
+            clock_type::time_point hash = clock_type::now();
+            sha1.update( buffers[c.buffer], c.length );
+            local.hash_seconds += seconds_since( hash );
+            local.bytes += c.length;
+
+            std::lock_guard<std::mutex> guard( r.lock );
+            r.free.push_back( c.buffer );
+            r.changed.notify_all();
+        }
+
+        io.join();
+        sha1.final( digest );
+        ok = !r.read_error;
+    }
+
+    for( size_t i = 0; i < buffers.size(); ++i )
+        free( buffers[i] );
+    close( fd );
+
+    local.wall_seconds = seconds_since( start );
+    if( stats != NULL )
+        *stats = local;
+
+    return ok;
+}
@@ -0,0 +1,59 @@
+/**
+ *  Pipelined file hashing: a reader thread fills a ring of buffers while
+ *  the calling thread hashes them with s11nSHA::SHA1, so that I/O and
+ *  compression overlap and wall time approaches max( I/O, hash ) instead
+ *  of their sum.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_PIPELINE_HPP
+#define S11NSHA_PIPELINE_HPP
+
+// uint64_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// s11nSHA::SHA1, DIGEST_SIZE
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    struct PipelineOptions
+    {
+        PipelineOptions() : buffers( 4 ), buffer_bytes( 1024*1024*4 ) {}
+
+        size_t buffers;       // ring size, at least 2
+        size_t buffer_bytes;  // bytes per read(), rounded up to 4 KiB
+    };
+
+    struct PipelineStats
+    {
+        PipelineStats() : bytes( 0 ), wall_seconds( 0 ), read_seconds( 0 ),
+                          hash_seconds( 0 ), io_bound_seconds( 0 ),
+                          cpu_bound_seconds( 0 ) {}
+
+        uint64_t bytes;            // bytes hashed
+        double wall_seconds;       // whole call
+        double read_seconds;       // reader thread inside read()
+        double hash_seconds;       // hashing thread inside update()
+        double io_bound_seconds;   // hasher idle, waiting for a full buffer
+        double cpu_bound_seconds;  // reader idle, waiting for a free buffer
+    };
+
+    // hash the contents of path (any readable file, pipe or device) with a
+    // reader thread running ahead of the hasher; stats may be NULL.
+    // returns false if path cannot be opened or a read fails
+    bool calculate_pipelined( const char *path,
+                              unsigned char digest[DIGEST_SIZE],
+                              const PipelineOptions& options = PipelineOptions(),
+                              PipelineStats *stats = NULL );
+
+} // end of namespace s11nSHA
+
+#endif
@@ -0,0 +1,187 @@
+// g++ -Wall -c -std=c++0x s11nsha_prefix.cpp
+// implementation of s11nsha_prefix.hpp
+
+#include "s11nsha_prefix.hpp"
+
+namespace
+{
+    // identity keys and prefix bytes live in separate key spaces
+    const uint64_t PREFIX_SEED = 0x9e3779b97f4a7c15ULL;
+    const uint64_t IDENTITY_SEED = 0xc2b2ae3d27d4eb4fULL;
+
+    uint64_t mix64( uint64_t x )
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    // eight bytes per step; only picks the bucket, keys are compared in full
+    uint64_t hash_bytes( const unsigned char *p, size_t length, uint64_t seed )
+    {
+        uint64_t h = seed ^ ( length * 0x87c37b91114253d5ULL );
+        uint64_t w;
+
+        for( ; length >= 8; p += 8, length -= 8 )
+        {
+            std::memcpy( &w, p, 8 );
+            h = ( h ^ mix64( w ) ) * 0x4cf5ad432745937fULL;
+        }
+        w = 0;
+        std::memcpy( &w, p, length );
+        return mix64( h ^ w );
+    }
+
+} // end of anonymous namespace
+
+s11nSHA::PrefixCache::PrefixCache( size_t capacity )
+    : limit( capacity ? capacity : 1 ), hit_count( 0 ), miss_count( 0 ),
+      eviction_count( 0 )
+{
+}
+
+const s11nSHA::PrefixCache::Entry *
+s11nSHA::PrefixCache::lookup( uint64_t hash, const unsigned char *key,
+                              size_t length )
+{
+    typedef std::unordered_multimap<uint64_t, lru_list::iterator>::iterator
+            index_iterator;
+    std::pair<index_iterator, index_iterator> range = this->index.equal_range( hash );
+
+    for( index_iterator i = range.first; i != range.second; ++i )
+    {
+        const Entry& e = *i->second;
+        if( e.key.size() == length &&
+            std::memcmp( e.key.data(), key, length ) == 0 )
+        {
+            this->entries.splice( this->entries.begin(), this->entries,
+                                  i->second );
+            return &e;
+        }
+    }
+    return NULL;
+}
+
+void s11nSHA::PrefixCache::store( uint64_t hash, const unsigned char *key,
+                                  size_t length, const SHA1& sha1_object )
+{
+    Entry *e = const_cast<Entry*>( this->lookup( hash, key, length ) );
+    if( e != NULL )
+    {
+        e->state = sha1_object;
+        return;
+    }
+
+    if( this->entries.size() >= this->limit )
+    {
+        Entry& last = this->entries.back();
+        typedef std::unordered_multimap<uint64_t, lru_list::iterator>::iterator
+                index_iterator;
+        std::pair<index_iterator, index_iterator> range =
+            this->index.equal_range( last.hash );
+        for( index_iterator i = range.first; i != range.second; ++i )
+            if( &*i->second == &last )
+            {
+                this->index.erase( i );
+                break;
+            }
+        this->entries.pop_back();
+        ++this->eviction_count;
+    }
+
+    Entry fresh;
+    fresh.hash = hash;
+    fresh.key.assign( (const char*) key, length );
+    fresh.state = sha1_object;
+    this->entries.push_front( fresh );
+    this->index.insert( std::make_pair( hash, this->entries.begin() ) );
+}
+
+void s11nSHA::PrefixCache::fork( const unsigned char *prefix, size_t length,
+                                 SHA1& sha1_object )
+{
+    uint64_t hash = hash_bytes( prefix, length, PREFIX_SEED );
+    {
+        std::lock_guard<std::mutex> guard( this->lock );
+        const Entry *e = this->lookup( hash, prefix, length );
+        if( e != NULL )
+        {
+            ++this->hit_count;
+            sha1_object = e->state;
+            return;
+        }
+        ++this->miss_count;
+    }
+
+    // compress outside the lock; two threads missing on the same prefix
+    // both compute it and the second store() just overwrites the first
+    sha1_object.init();
+    sha1_object.update( prefix, length );
+
+    std::lock_guard<std::mutex> guard( this->lock );
+    this->store( hash, prefix, length, sha1_object );
+}
+
+bool s11nSHA::PrefixCache::find( const std::string& key, SHA1& sha1_object )
+{
+    const unsigned char *k = (const unsigned char*) key.data();
+    uint64_t hash = hash_bytes( k, key.size(), IDENTITY_SEED );
+
+    std::lock_guard<std::mutex> guard( this->lock );
+    const Entry *e = this->lookup( hash, k, key.size() );
+    if( e == NULL )
+    {
+        ++this->miss_count;
+        return false;
+    }
+    ++this->hit_count;
+    sha1_object = e->state;
+    return true;
+}
+
+void s11nSHA::PrefixCache::insert( const std::string& key,
+                                   const SHA1& sha1_object )
+{
+    const unsigned char *k = (const unsigned char*) key.data();
+    uint64_t hash = hash_bytes( k, key.size(), IDENTITY_SEED );
+
+    std::lock_guard<std::mutex> guard( this->lock );
+    this->store( hash, k, key.size(), sha1_object );
+}
+
+void s11nSHA::PrefixCache::clear()
+{
+    std::lock_guard<std::mutex> guard( this->lock );
+    this->index.clear();
+    this->entries.clear();
+}
+
+size_t s11nSHA::PrefixCache::size() const
+{
+    std::lock_guard<std::mutex> guard( this->lock );
+    return this->entries.size();
+}
+
+size_t s11nSHA::PrefixCache::capacity() const
+{
+    return this->limit;
+}
+
+uint64_t s11nSHA::PrefixCache::hits() const
+{
+    std::lock_guard<std::mutex> guard( this->lock );
+    return this->hit_count;
+}
+
+uint64_t s11nSHA::PrefixCache::misses() const
+{
+    std::lock_guard<std::mutex> guard( this->lock );
+    return this->miss_count;
+}
+
+uint64_t s11nSHA::PrefixCache::evictions() const
+{
+    std::lock_guard<std::mutex> guard( this->lock );
+    return this->eviction_count;
+}
@@ -0,0 +1,100 @@
+/**
+ *  Prefix state cache: remembers the s11nSHA::SHA1 state reached after a
+ *  given prefix (a "blob <len>\0" header, an HMAC key block, a protocol
+ *  envelope) so that later messages with the same prefix start from a
+ *  copy of that state instead of compressing the prefix again.
+ *
+ *  A state is a plain SHA1 object, so a fork is a 92 byte copy with no
+ *  allocation. Entries are keyed either by the prefix bytes themselves
+ *  (fork()) or by an identity string the caller picks (find()/insert()),
+ *  and the least recently used entry is dropped when the cache is full.
+ *  All members are safe to call from several threads.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_PREFIX_HPP
+#define S11NSHA_PREFIX_HPP
+
+// uint64_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// std::list
+#include <list>
+
+// std::mutex
+#include <mutex>
+
+// std::string
+#include <string>
+
+// std::unordered_multimap
+#include <unordered_map>
+
+// s11nSHA::SHA1
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    class PrefixCache
+    {
+    public:
+        explicit PrefixCache( size_t capacity = 1024 );
+
+        // set sha1_object to the state after hashing prefix, copied from
+        // the cache on a hit and computed (and cached) on a miss
+        void fork( const unsigned char *prefix, size_t length,
+                   SHA1& sha1_object );
+
+        // state cached under identity key; false on a miss
+        bool find( const std::string& key, SHA1& sha1_object );
+
+        // cache sha1_object under identity key, replacing any older entry
+        void insert( const std::string& key, const SHA1& sha1_object );
+
+        // drop every entry; counters are kept
+        void clear();
+
+        size_t size() const;
+        size_t capacity() const;
+        uint64_t hits() const;
+        uint64_t misses() const;
+        uint64_t evictions() const;
+
+    private:
+        PrefixCache( const PrefixCache& );
+        PrefixCache& operator=( const PrefixCache& );
+
+        struct Entry
+        {
+            uint64_t hash;
+            std::string key;
+            SHA1 state;
+        };
+        typedef std::list<Entry> lru_list;
+
+        // entry for key (moved to the front of the LRU list), or NULL;
+        // called with lock held
+        const Entry *lookup( uint64_t hash, const unsigned char *key,
+                             size_t length );
+        void store( uint64_t hash, const unsigned char *key, size_t length,
+                    const SHA1& sha1_object );
+
+        mutable std::mutex lock;
+        lru_list entries;  // most recently used first
+        std::unordered_multimap<uint64_t, lru_list::iterator> index;
+        size_t limit;
+        uint64_t hit_count;
+        uint64_t miss_count;
+        uint64_t eviction_count;
+    };
+
+} // end of namespace s11nSHA
+
+#endif
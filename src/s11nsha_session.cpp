@@ -0,0 +1,450 @@
+// g++ -Wall -c -std=c++0x s11nsha_session.cpp
+// implementation of s11nsha_session.hpp
+
+#include "s11nsha_session.hpp"
+
+// std::condition_variable
+#include <condition_variable>
+
+// std::unordered_map
+#include <unordered_map>
+
+// posix_memalign, free
+#include <cstdlib>
+
+namespace
+{
+    const uint32_t NIL = 0xFFFFFFFF;
+    const size_t CACHE_LINE = 64;
+
+    // SESSION_SLAB contexts, one array per field, so that a walk over the
+    // states of neighbouring sessions never drags their buffers along
+    struct slab
+    {
+        uint32_t state[s11nSHA::DIGEST_INTS][s11nSHA::SESSION_SLAB];
+        uint32_t total[2][s11nSHA::SESSION_SLAB];
+        unsigned char buffer[s11nSHA::SESSION_SLAB][s11nSHA::BLOCK_BYTES];
+    };
+
+    uint64_t mix64( uint64_t x )
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+} // end of anonymous namespace
+
+// per shard pool, index and LRU list (head = most recently used); slot
+// metadata is kept in parallel vectors next to the slabs
+struct s11nSHA::SessionManager::Shard
+{
+    Shard( size_t capacity, size_t stored )
+        : capacity( capacity ), stored( stored ), head( NIL ), tail( NIL ) {}
+
+    ~Shard()
+    {
+        for( size_t i = 0; i < slabs.size(); ++i )
+            free( slabs[i] );
+    }
+
+    std::mutex lock;
+    std::condition_variable released;  // a busy session became idle
+    std::unordered_map<uint64_t, uint32_t> index;
+    std::vector<slab*> slabs;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> prev;
+    std::vector<uint32_t> next;
+    std::vector<unsigned char> busy;
+    std::vector<uint32_t> free_slots;
+    size_t capacity;
+    // never less than the number of this shard's sessions in the store,
+    // so that the common case of none skips the store and its lock. exact
+    // for a new store; sessions left in an old one are not listed per
+    // shard, so every shard starts from the store's total
+    size_t stored;
+    uint32_t head;
+    uint32_t tail;
+};
+
+s11nSHA::SessionManager::SessionManager()
+    : resident_count( 0 ), spill_count( 0 ), reload_count( 0 )
+{
+}
+
+s11nSHA::SessionManager::~SessionManager()
+{
+    this->close();
+}
+
+bool s11nSHA::SessionManager::open( const char *spill_path, size_t max_resident,
+                                    size_t spill_slots, unsigned int shards,
+                                    StateStore::Durability durability )
+{
+    this->close();
+
+    if( !this->spill_store.open( spill_path, spill_slots, durability ) )
+        return false;
+
+    if( shards == 0 )
+        shards = 1;
+    size_t capacity = ( max_resident + shards - 1 ) / shards;
+    if( capacity == 0 )
+        capacity = 1;
+    for( unsigned int i = 0; i < shards; ++i )
+        this->shards.push_back( new Shard( capacity, this->spill_store.size() ) );
+
+    this->resident_count = 0;
+    this->spill_count = 0;
+    this->reload_count = 0;
+    return true;
+}
+
+bool s11nSHA::SessionManager::close()
+{
+    bool ok = true;
+
+    for( size_t i = 0; i < this->shards.size(); ++i )
+    {
+        Shard& shard = *this->shards[i];
+        while( shard.tail != NIL )
+            if( !this->spill( shard, shard.tail ) )
+            {
+                ok = false;
+                this->remove( shard, shard.tail );
+            }
+        delete this->shards[i];
+    }
+    this->shards.clear();
+    this->spill_store.close();
+    return ok;
+}
+
+s11nSHA::SessionManager::Shard&
+s11nSHA::SessionManager::shard_of( uint64_t id ) const
+{
+    return *this->shards[mix64( id ) % this->shards.size()];
+}
+
+void s11nSHA::SessionManager::load( const Shard& shard, uint32_t slot,
+                                    SHA1& sha1_object )
+{
+    const slab& s = *shard.slabs[slot / SESSION_SLAB];
+    size_t i = slot % SESSION_SLAB;
+
+    for( unsigned int w = 0; w < DIGEST_INTS; ++w )
+        sha1_object.state[w] = s.state[w][i];
+    sha1_object.total[0] = s.total[0][i];
+    sha1_object.total[1] = s.total[1][i];
+    std::memcpy( sha1_object.buffer, s.buffer[i], BLOCK_BYTES );
+}
+
+void s11nSHA::SessionManager::store( Shard& shard, uint32_t slot,
+                                     const SHA1& sha1_object )
+{
+    slab& s = *shard.slabs[slot / SESSION_SLAB];
+    size_t i = slot % SESSION_SLAB;
+
+    for( unsigned int w = 0; w < DIGEST_INTS; ++w )
+        s.state[w][i] = sha1_object.state[w];
+    s.total[0][i] = sha1_object.total[0];
+    s.total[1][i] = sha1_object.total[1];
+    std::memcpy( s.buffer[i], sha1_object.buffer, BLOCK_BYTES );
+}
+
+void s11nSHA::SessionManager::unlink( Shard& shard, uint32_t slot )
+{
+    uint32_t p = shard.prev[slot], n = shard.next[slot];
+
+    if( p != NIL )
+        shard.next[p] = n;
+    else
+        shard.head = n;
+    if( n != NIL )
+        shard.prev[n] = p;
+    else
+        shard.tail = p;
+    shard.prev[slot] = shard.next[slot] = NIL;
+}
+
+// move slot (linked or not) to the front of the LRU list
+void s11nSHA::SessionManager::touch( Shard& shard, uint32_t slot )
+{
+    if( shard.head == slot )
+        return;
+    if( shard.prev[slot] != NIL )
+        this->unlink( shard, slot );
+
+    shard.next[slot] = shard.head;
+    if( shard.head != NIL )
+        shard.prev[shard.head] = slot;
+    shard.head = slot;
+    if( shard.tail == NIL )
+        shard.tail = slot;
+}
+
+// drop a resident session and return its slot to the pool
+void s11nSHA::SessionManager::remove( Shard& shard, uint32_t slot )
+{
+    this->unlink( shard, slot );
+    shard.index.erase( shard.keys[slot] );
+    shard.busy[slot] = 0;
+    shard.free_slots.push_back( slot );
+    --this->resident_count;
+    shard.released.notify_all();
+}
+
+// write an idle resident session to the store and take it out of memory;
+// the slot is left unlinked for the caller
+bool s11nSHA::SessionManager::spill( Shard& shard, uint32_t slot )
+{
+    SHA1 sha1;
+    load( shard, slot, sha1 );
+    {
+        std::lock_guard<std::mutex> guard( this->spill_lock );
+        if( !this->spill_store.put( shard.keys[slot], sha1 ) )
+            return false;
+    }
+
+    this->unlink( shard, slot );
+    shard.index.erase( shard.keys[slot] );
+    ++shard.stored;
+    --this->resident_count;
+    ++this->spill_count;
+    return true;
+}
+
+long s11nSHA::SessionManager::allocate( Shard& shard )
+{
+    if( !shard.free_slots.empty() )
+    {
+        uint32_t slot = shard.free_slots.back();
+        shard.free_slots.pop_back();
+        return slot;
+    }
+
+    if( shard.keys.size() < shard.capacity )
+    {
+        uint32_t slot = (uint32_t) shard.keys.size();
+        if( slot % SESSION_SLAB == 0 )
+        {
+            void *p;
+            if( posix_memalign( &p, CACHE_LINE, sizeof( slab ) ) != 0 )
+                return -1;
+            shard.slabs.push_back( (slab*) p );
+        }
+        shard.keys.push_back( 0 );
+        shard.prev.push_back( NIL );
+        shard.next.push_back( NIL );
+        shard.busy.push_back( 0 );
+        return slot;
+    }
+
+    for( uint32_t slot = shard.tail; slot != NIL; slot = shard.prev[slot] )
+        if( !shard.busy[slot] )
+            return this->spill( shard, slot ) ? (long) slot : -1;
+
+    return -1;
+}
+
+long s11nSHA::SessionManager::find( Shard& shard, uint64_t id, bool load )
+{
+    std::unordered_map<uint64_t, uint32_t>::const_iterator it =
+        shard.index.find( id );
+    if( it != shard.index.end() )
+        return it->second;
+    if( !load || shard.stored == 0 )
+        return -1;
+
+    SHA1 sha1;
+    {
+        std::lock_guard<std::mutex> guard( this->spill_lock );
+        if( !this->spill_store.get( id, sha1 ) )
+            return -1;
+    }
+
+    long slot = this->allocate( shard );
+    if( slot < 0 )
+        return -1;
+    {
+        std::lock_guard<std::mutex> guard( this->spill_lock );
+        this->spill_store.erase( id );
+    }
+    --shard.stored;
+
+    store( shard, (uint32_t) slot, sha1 );
+    shard.keys[slot] = id;
+    shard.busy[slot] = 0;
+    shard.index[id] = (uint32_t) slot;
+    this->touch( shard, (uint32_t) slot );
+    ++this->resident_count;
+    ++this->reload_count;
+    return slot;
+}
+
+// the slot may be evicted and reused while we sleep, so look the session
+// up again after every wakeup
+long s11nSHA::SessionManager::acquire( Shard& shard,
+                                       std::unique_lock<std::mutex>& guard,
+                                       uint64_t id )
+{
+    for( ;; )
+    {
+        long slot = this->find( shard, id, true );
+        if( slot < 0 )
+            return -1;
+        if( !shard.busy[slot] )
+        {
+            shard.busy[slot] = 1;
+            this->touch( shard, (uint32_t) slot );
+            return slot;
+        }
+        shard.released.wait( guard );
+    }
+}
+
+void s11nSHA::SessionManager::release( Shard& shard, uint32_t slot )
+{
+    shard.busy[slot] = 0;
+    shard.released.notify_all();
+}
+
+bool s11nSHA::SessionManager::begin( uint64_t id )
+{
+    Shard& shard = this->shard_of( id );
+    std::lock_guard<std::mutex> guard( shard.lock );
+
+    if( shard.index.count( id ) )
+        return false;
+    if( shard.stored > 0 )
+    {
+        SHA1 spilled;
+        std::lock_guard<std::mutex> spill_guard( this->spill_lock );
+        if( this->spill_store.get( id, spilled ) )
+            return false;
+    }
+
+    long slot = this->allocate( shard );
+    if( slot < 0 )
+        return false;
+
+    store( shard, (uint32_t) slot, SHA1() );
+    shard.keys[slot] = id;
+    shard.busy[slot] = 0;
+    shard.index[id] = (uint32_t) slot;
+    this->touch( shard, (uint32_t) slot );
+    ++this->resident_count;
+    return true;
+}
+
+bool s11nSHA::SessionManager::update( uint64_t id, const unsigned char *input,
+                                      size_t length )
+{
+    Shard& shard = this->shard_of( id );
+    std::unique_lock<std::mutex> guard( shard.lock );
+
+    long slot = this->acquire( shard, guard, id );
+    if( slot < 0 )
+        return false;
+
+    // compress outside the shard lock; the busy mark keeps the slot ours
+    SHA1 sha1;
+    load( shard, (uint32_t) slot, sha1 );
+    guard.unlock();
+    sha1.update( input, length );
+    guard.lock();
+    store( shard, (uint32_t) slot, sha1 );
+    this->release( shard, (uint32_t) slot );
+    return true;
+}
+
+bool s11nSHA::SessionManager::final( uint64_t id,
+                                     unsigned char digest[DIGEST_SIZE] )
+{
+    Shard& shard = this->shard_of( id );
+    std::unique_lock<std::mutex> guard( shard.lock );
+
+    long slot = this->acquire( shard, guard, id );
+    if( slot < 0 )
+        return false;
+
+    SHA1 sha1;
+    load( shard, (uint32_t) slot, sha1 );
+    this->remove( shard, (uint32_t) slot );
+    guard.unlock();
+    sha1.final( digest );
+    return true;
+}
+
+bool s11nSHA::SessionManager::abort( uint64_t id )
+{
+    Shard& shard = this->shard_of( id );
+    std::unique_lock<std::mutex> guard( shard.lock );
+
+    for( ;; )
+    {
+        long slot = this->find( shard, id, false );
+        if( slot < 0 )
+        {
+            if( shard.stored == 0 )
+                return false;
+            std::lock_guard<std::mutex> spill_guard( this->spill_lock );
+            if( !this->spill_store.erase( id ) )
+                return false;
+            --shard.stored;
+            return true;
+        }
+        if( !shard.busy[slot] )
+        {
+            this->remove( shard, (uint32_t) slot );
+            return true;
+        }
+        shard.released.wait( guard );
+    }
+}
+
+bool s11nSHA::SessionManager::snapshot( uint64_t id, SHA1& sha1_object )
+{
+    Shard& shard = this->shard_of( id );
+    std::unique_lock<std::mutex> guard( shard.lock );
+
+    for( ;; )
+    {
+        long slot = this->find( shard, id, false );
+        if( slot < 0 )
+        {
+            if( shard.stored == 0 )
+                return false;
+            std::lock_guard<std::mutex> spill_guard( this->spill_lock );
+            return this->spill_store.get( id, sha1_object );
+        }
+        if( !shard.busy[slot] )
+        {
+            load( shard, (uint32_t) slot, sha1_object );
+            return true;
+        }
+        shard.released.wait( guard );
+    }
+}
+
+size_t s11nSHA::SessionManager::resident() const
+{
+    return this->resident_count;
+}
+
+size_t s11nSHA::SessionManager::spilled() const
+{
+    std::lock_guard<std::mutex> guard( this->spill_lock );
+    return this->spill_store.size();
+}
+
+uint64_t s11nSHA::SessionManager::spills() const
+{
+    return this->spill_count;
+}
+
+uint64_t s11nSHA::SessionManager::reloads() const
+{
+    return this->reload_count;
+}
@@ -0,0 +1,133 @@
+/**
+ *  Resumable hashing sessions: many s11nSHA::SHA1 streams keyed by a 64 bit
+ *  upload id, held in memory up to a bound and spilled to a StateStore
+ *  (least recently used first) beyond it.
+ *
+ *  Resident contexts live in slabs laid out as struct-of-arrays (all word
+ *  0 of the state together, all totals together, block buffers apart) and
+ *  aligned to cache lines; a session only claims a slab slot, never a heap
+ *  object. Sessions are spread over shards with their own lock, pool and
+ *  LRU list, and a shard lock is only held to find a session and copy its
+ *  96 bytes of state in or out, never while compressing, so updates to
+ *  different sessions run in parallel. Updates to the same session are
+ *  serialized. The store has a single lock, which is only taken when a
+ *  shard evicts a session or may have one of its sessions spilled.
+ *
+ *  close() spills every resident session, so the store can be reopened
+ *  after a restart and the uploads continued.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_SESSION_HPP
+#define S11NSHA_SESSION_HPP
+
+// uint64_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// std::atomic
+#include <atomic>
+
+// std::mutex
+#include <mutex>
+
+// std::vector
+#include <vector>
+
+// s11nSHA::SHA1, DIGEST_SIZE
+#include "s11nsha.hpp"
+
+// s11nSHA::StateStore
+#include "s11nsha_store.hpp"
+
+namespace s11nSHA
+{
+    const unsigned int SESSION_SLAB = 64;  // contexts per slab
+
+    class SessionManager
+    {
+    public:
+        SessionManager();
+        ~SessionManager();
+
+        // keep at most max_resident sessions in memory and spill the rest to
+        // the store at spill_path (created with spill_slots slots if new).
+        // sessions left in an existing store are picked up again
+        bool open( const char *spill_path, size_t max_resident,
+                   size_t spill_slots, unsigned int shards = 16,
+                   StateStore::Durability durability = StateStore::DURABLE_NONE );
+
+        // spill every resident session and close the store; also done by
+        // the destructor. no other call may be in progress. false if the
+        // store ran out of room and some sessions were lost
+        bool close();
+
+        // start session id; false if it exists or there is no room for it
+        bool begin( uint64_t id );
+
+        // append input to session id, reloading it from the store if it was
+        // spilled; false if there is no such session
+        bool update( uint64_t id, const unsigned char *input, size_t length );
+
+        // compute the digest of session id and forget the session
+        bool final( uint64_t id, unsigned char digest[DIGEST_SIZE] );
+
+        // forget session id without computing anything
+        bool abort( uint64_t id );
+
+        // copy of the current state of session id, e.g. to marshall it
+        bool snapshot( uint64_t id, SHA1& sha1_object );
+
+        size_t resident() const;   // sessions in memory
+        size_t spilled() const;    // sessions in the store
+        uint64_t spills() const;   // evictions to the store so far
+        uint64_t reloads() const;  // sessions brought back from the store
+
+    private:
+        SessionManager( const SessionManager& );
+        SessionManager& operator=( const SessionManager& );
+
+        struct Shard;
+
+        Shard& shard_of( uint64_t id ) const;
+
+        // slot of resident session id, loading it from the store if needed;
+        // -1 if there is no such session (or no room to load it). called
+        // with the shard locked
+        long find( Shard& shard, uint64_t id, bool load );
+
+        // a free slot, evicting the least recently used idle session if
+        // the shard is full; -1 if nothing can be evicted
+        long allocate( Shard& shard );
+
+        // wait (shard lock held in guard) until session id is resident and
+        // idle, then mark it busy; -1 if there is no such session
+        long acquire( Shard& shard, std::unique_lock<std::mutex>& guard,
+                      uint64_t id );
+
+        void release( Shard& shard, uint32_t slot );
+        bool spill( Shard& shard, uint32_t slot );
+        void remove( Shard& shard, uint32_t slot );
+        void unlink( Shard& shard, uint32_t slot );
+        void touch( Shard& shard, uint32_t slot );
+
+        static void load( const Shard& shard, uint32_t slot, SHA1& sha1_object );
+        static void store( Shard& shard, uint32_t slot, const SHA1& sha1_object );
+
+        std::vector<Shard*> shards;
+        StateStore spill_store;
+        mutable std::mutex spill_lock;
+        std::atomic<size_t> resident_count;
+        std::atomic<uint64_t> spill_count;
+        std::atomic<uint64_t> reload_count;
+    };
+
+} // end of namespace s11nSHA
+
+#endif
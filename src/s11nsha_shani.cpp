@@ -0,0 +1,200 @@
+// g++ -Wall -c -std=c++0x s11nsha_shani.cpp
+// SHA-1 compression using the x86 SHA extensions; see s11nsha_kernels.hpp
+
+#include "s11nsha_kernels.hpp"
+
+#ifdef S11NSHA_X86
+
+// _mm_sha1rnds4_epu32, _mm_shuffle_epi8, _mm_extract_epi32
+#include <immintrin.h>
+
+// ABCD lives in one register in reverse word order, E in the top word of
+// another; four rounds are done per sha1rnds4 and the message schedule is
+// expanded four words at a time by sha1msg1/sha1msg2 as the rounds go.
+__attribute__((target("sha,sse4.1,ssse3")))
+void s11nSHA::process_shani( uint32_t state[DIGEST_INTS],
+                             const unsigned char *data, size_t blocks )
+{
+    __m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+    __m128i MSG0, MSG1, MSG2, MSG3;
+    const __m128i MASK = _mm_set_epi64x( 0x0001020304050607ULL,
+                                         0x08090a0b0c0d0e0fULL );
+
+    ABCD = _mm_loadu_si128( (const __m128i*) state );
+    E0 = _mm_set_epi32( (int) state[4], 0, 0, 0 );
+    ABCD = _mm_shuffle_epi32( ABCD, 0x1B );
+
+    while( blocks-- > 0 )
+    {
+        ABCD_SAVE = ABCD;
+        E0_SAVE = E0;
+
+        // rounds 0-3
+        MSG0 = _mm_loadu_si128( (const __m128i*) ( data +  0 ) );
+        MSG0 = _mm_shuffle_epi8( MSG0, MASK );
+        E0 = _mm_add_epi32( E0, MSG0 );
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 0 );
+
+        // rounds 4-7
+        MSG1 = _mm_loadu_si128( (const __m128i*) ( data + 16 ) );
+        MSG1 = _mm_shuffle_epi8( MSG1, MASK );
+        E1 = _mm_sha1nexte_epu32( E1, MSG1 );
+        E0 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E1, 0 );
+        MSG0 = _mm_sha1msg1_epu32( MSG0, MSG1 );
+
+        // rounds 8-11
+        MSG2 = _mm_loadu_si128( (const __m128i*) ( data + 32 ) );
+        MSG2 = _mm_shuffle_epi8( MSG2, MASK );
+        E0 = _mm_sha1nexte_epu32( E0, MSG2 );
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 0 );
+        MSG1 = _mm_sha1msg1_epu32( MSG1, MSG2 );
+        MSG0 = _mm_xor_si128( MSG0, MSG2 );
+
+        // rounds 12-15
+        MSG3 = _mm_loadu_si128( (const __m128i*) ( data + 48 ) );
+        MSG3 = _mm_shuffle_epi8( MSG3, MASK );
+        E1 = _mm_sha1nexte_epu32( E1, MSG3 );
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32( MSG0, MSG3 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E1, 0 );
+        MSG2 = _mm_sha1msg1_epu32( MSG2, MSG3 );
+        MSG1 = _mm_xor_si128( MSG1, MSG3 );
+
+        // rounds 16-19
+        E0 = _mm_sha1nexte_epu32( E0, MSG0 );
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32( MSG1, MSG0 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 0 );
+        MSG3 = _mm_sha1msg1_epu32( MSG3, MSG0 );
+        MSG2 = _mm_xor_si128( MSG2, MSG0 );
+
+        // rounds 20-23
+        E1 = _mm_sha1nexte_epu32( E1, MSG1 );
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32( MSG2, MSG1 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E1, 1 );
+        MSG0 = _mm_sha1msg1_epu32( MSG0, MSG1 );
+        MSG3 = _mm_xor_si128( MSG3, MSG1 );
+
+        // rounds 24-27
+        E0 = _mm_sha1nexte_epu32( E0, MSG2 );
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32( MSG3, MSG2 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 1 );
+        MSG1 = _mm_sha1msg1_epu32( MSG1, MSG2 );
+        MSG0 = _mm_xor_si128( MSG0, MSG2 );
+
+        // rounds 28-31
+        E1 = _mm_sha1nexte_epu32( E1, MSG3 );
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32( MSG0, MSG3 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E1, 1 );
+        MSG2 = _mm_sha1msg1_epu32( MSG2, MSG3 );
+        MSG1 = _mm_xor_si128( MSG1, MSG3 );
+
+        // rounds 32-35
+        E0 = _mm_sha1nexte_epu32( E0, MSG0 );
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32( MSG1, MSG0 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 1 );
+        MSG3 = _mm_sha1msg1_epu32( MSG3, MSG0 );
+        MSG2 = _mm_xor_si128( MSG2, MSG0 );
+
+        // rounds 36-39
+        E1 = _mm_sha1nexte_epu32( E1, MSG1 );
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32( MSG2, MSG1 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E1, 1 );
+        MSG0 = _mm_sha1msg1_epu32( MSG0, MSG1 );
+        MSG3 = _mm_xor_si128( MSG3, MSG1 );
+
+        // rounds 40-43
+        E0 = _mm_sha1nexte_epu32( E0, MSG2 );
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32( MSG3, MSG2 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 2 );
+        MSG1 = _mm_sha1msg1_epu32( MSG1, MSG2 );
+        MSG0 = _mm_xor_si128( MSG0, MSG2 );
+
+        // rounds 44-47
+        E1 = _mm_sha1nexte_epu32( E1, MSG3 );
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32( MSG0, MSG3 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E1, 2 );
+        MSG2 = _mm_sha1msg1_epu32( MSG2, MSG3 );
+        MSG1 = _mm_xor_si128( MSG1, MSG3 );
+
+        // rounds 48-51
+        E0 = _mm_sha1nexte_epu32( E0, MSG0 );
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32( MSG1, MSG0 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 2 );
+        MSG3 = _mm_sha1msg1_epu32( MSG3, MSG0 );
+        MSG2 = _mm_xor_si128( MSG2, MSG0 );
+
+        // rounds 52-55
+        E1 = _mm_sha1nexte_epu32( E1, MSG1 );
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32( MSG2, MSG1 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E1, 2 );
+        MSG0 = _mm_sha1msg1_epu32( MSG0, MSG1 );
+        MSG3 = _mm_xor_si128( MSG3, MSG1 );
+
+        // rounds 56-59
+        E0 = _mm_sha1nexte_epu32( E0, MSG2 );
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32( MSG3, MSG2 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 2 );
+        MSG1 = _mm_sha1msg1_epu32( MSG1, MSG2 );
+        MSG0 = _mm_xor_si128( MSG0, MSG2 );
+
+        // rounds 60-63
+        E1 = _mm_sha1nexte_epu32( E1, MSG3 );
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32( MSG0, MSG3 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E1, 3 );
+        MSG2 = _mm_sha1msg1_epu32( MSG2, MSG3 );
+        MSG1 = _mm_xor_si128( MSG1, MSG3 );
+
+        // rounds 64-67
+        E0 = _mm_sha1nexte_epu32( E0, MSG0 );
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32( MSG1, MSG0 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 3 );
+        MSG3 = _mm_sha1msg1_epu32( MSG3, MSG0 );
+        MSG2 = _mm_xor_si128( MSG2, MSG0 );
+
+        // rounds 68-71
+        E1 = _mm_sha1nexte_epu32( E1, MSG1 );
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32( MSG2, MSG1 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E1, 3 );
+        MSG3 = _mm_xor_si128( MSG3, MSG1 );
+
+        // rounds 72-75
+        E0 = _mm_sha1nexte_epu32( E0, MSG2 );
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32( MSG3, MSG2 );
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 3 );
+
+        // rounds 76-79
+        E1 = _mm_sha1nexte_epu32( E1, MSG3 );
+        E0 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E1, 3 );
+
+        // add the saved state back in
+        E0 = _mm_sha1nexte_epu32( E0, E0_SAVE );
+        ABCD = _mm_add_epi32( ABCD, ABCD_SAVE );
+
+        data += BLOCK_BYTES;
+    }
+
+    ABCD = _mm_shuffle_epi32( ABCD, 0x1B );
+    _mm_storeu_si128( (__m128i*) state, ABCD );
+    state[4] = (uint32_t) _mm_extract_epi32( E0, 3 );
+}
+
+#endif // S11NSHA_X86
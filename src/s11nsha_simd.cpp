@@ -0,0 +1,269 @@
+// g++ -Wall -c -std=c++0x s11nsha_simd.cpp
+// SHA-1 compression with a SIMD message schedule; see s11nsha_kernels.hpp
+//
+// the rounds themselves stay scalar, but the big endian loads and the
+// W[16..79] expansion are done four words at a time in vector registers
+// and stored with K already added, so every round is a single load of
+// W[t] + K. the schedule for the next group of four words is computed
+// while the current group of rounds runs, keeping both units busy.
+//
+// W[16..31] are computed as
+//   W[t..t+3] = ROL1( W[t-3..t] ^ W[t-8..t-5] ^ W[t-14..t-11] ^ W[t-16..t-13] )
+// with W[t] not yet known when W[t+3] is computed; that lane is done with 0
+// in its place and patched with ROL1(W[t]) afterwards. from W[32] on the
+// equivalent recurrence
+//   W[t] = ROL2( W[t-6] ^ W[t-16] ^ W[t-28] ^ W[t-32] )
+// has no dependency inside a vector.
+
+#include "s11nsha_kernels.hpp"
+
+#ifdef S11NSHA_X86
+
+// _mm_alignr_epi8, _mm_shuffle_epi8, _mm256_alignr_epi8
+#include <immintrin.h>
+
+#define S(x,n) ((x << n) | (x >> (32 - n)))
+
+#define F1(x,y,z) (z ^ (x & (y ^ z)))
+#define F2(x,y,z) (x ^ y ^ z)
+#define F3(x,y,z) ((x & y) | (z & (x | y)))
+
+#define P(F,a,b,c,d,e,x)                                                \
+{                                                                       \
+    e += S(a,5) + F(b,c,d) + x; b = S(b,30);                            \
+}
+
+// K for schedule vector j (words 4j..4j+3)
+#define KV(j) ( (j) < 5 ? K0 : (j) < 10 ? K1 : (j) < 15 ? K2 : K3 )
+
+// 80 rounds reading W[t] + K through WK(t); SCHED(j) computes schedule
+// vector j, four vectors ahead of the rounds that consume it
+#define SIMD_ROUNDS( SCHED )                                              \
+{                                                                         \
+    SCHED( 4); P( F1, A, B, C, D, E, WK( 0) ); P( F1, E, A, B, C, D, WK( 1) );\
+                P( F1, D, E, A, B, C, WK( 2) ); P( F1, C, D, E, A, B, WK( 3) );\
+    SCHED( 5); P( F1, B, C, D, E, A, WK( 4) ); P( F1, A, B, C, D, E, WK( 5) );\
+                P( F1, E, A, B, C, D, WK( 6) ); P( F1, D, E, A, B, C, WK( 7) );\
+    SCHED( 6); P( F1, C, D, E, A, B, WK( 8) ); P( F1, B, C, D, E, A, WK( 9) );\
+                P( F1, A, B, C, D, E, WK(10) ); P( F1, E, A, B, C, D, WK(11) );\
+    SCHED( 7); P( F1, D, E, A, B, C, WK(12) ); P( F1, C, D, E, A, B, WK(13) );\
+                P( F1, B, C, D, E, A, WK(14) ); P( F1, A, B, C, D, E, WK(15) );\
+    SCHED( 8); P( F1, E, A, B, C, D, WK(16) ); P( F1, D, E, A, B, C, WK(17) );\
+                P( F1, C, D, E, A, B, WK(18) ); P( F1, B, C, D, E, A, WK(19) );\
+    SCHED( 9); P( F2, A, B, C, D, E, WK(20) ); P( F2, E, A, B, C, D, WK(21) );\
+                P( F2, D, E, A, B, C, WK(22) ); P( F2, C, D, E, A, B, WK(23) );\
+    SCHED(10); P( F2, B, C, D, E, A, WK(24) ); P( F2, A, B, C, D, E, WK(25) );\
+                P( F2, E, A, B, C, D, WK(26) ); P( F2, D, E, A, B, C, WK(27) );\
+    SCHED(11); P( F2, C, D, E, A, B, WK(28) ); P( F2, B, C, D, E, A, WK(29) );\
+                P( F2, A, B, C, D, E, WK(30) ); P( F2, E, A, B, C, D, WK(31) );\
+    SCHED(12); P( F2, D, E, A, B, C, WK(32) ); P( F2, C, D, E, A, B, WK(33) );\
+                P( F2, B, C, D, E, A, WK(34) ); P( F2, A, B, C, D, E, WK(35) );\
+    SCHED(13); P( F2, E, A, B, C, D, WK(36) ); P( F2, D, E, A, B, C, WK(37) );\
+                P( F2, C, D, E, A, B, WK(38) ); P( F2, B, C, D, E, A, WK(39) );\
+    SCHED(14); P( F3, A, B, C, D, E, WK(40) ); P( F3, E, A, B, C, D, WK(41) );\
+                P( F3, D, E, A, B, C, WK(42) ); P( F3, C, D, E, A, B, WK(43) );\
+    SCHED(15); P( F3, B, C, D, E, A, WK(44) ); P( F3, A, B, C, D, E, WK(45) );\
+                P( F3, E, A, B, C, D, WK(46) ); P( F3, D, E, A, B, C, WK(47) );\
+    SCHED(16); P( F3, C, D, E, A, B, WK(48) ); P( F3, B, C, D, E, A, WK(49) );\
+                P( F3, A, B, C, D, E, WK(50) ); P( F3, E, A, B, C, D, WK(51) );\
+    SCHED(17); P( F3, D, E, A, B, C, WK(52) ); P( F3, C, D, E, A, B, WK(53) );\
+                P( F3, B, C, D, E, A, WK(54) ); P( F3, A, B, C, D, E, WK(55) );\
+    SCHED(18); P( F3, E, A, B, C, D, WK(56) ); P( F3, D, E, A, B, C, WK(57) );\
+                P( F3, C, D, E, A, B, WK(58) ); P( F3, B, C, D, E, A, WK(59) );\
+    SCHED(19); P( F2, A, B, C, D, E, WK(60) ); P( F2, E, A, B, C, D, WK(61) );\
+                P( F2, D, E, A, B, C, WK(62) ); P( F2, C, D, E, A, B, WK(63) );\
+                P( F2, B, C, D, E, A, WK(64) ); P( F2, A, B, C, D, E, WK(65) );\
+                P( F2, E, A, B, C, D, WK(66) ); P( F2, D, E, A, B, C, WK(67) );\
+                P( F2, C, D, E, A, B, WK(68) ); P( F2, B, C, D, E, A, WK(69) );\
+                P( F2, A, B, C, D, E, WK(70) ); P( F2, E, A, B, C, D, WK(71) );\
+                P( F2, D, E, A, B, C, WK(72) ); P( F2, C, D, E, A, B, WK(73) );\
+                P( F2, B, C, D, E, A, WK(74) ); P( F2, A, B, C, D, E, WK(75) );\
+                P( F2, E, A, B, C, D, WK(76) ); P( F2, D, E, A, B, C, WK(77) );\
+                P( F2, C, D, E, A, B, WK(78) ); P( F2, B, C, D, E, A, WK(79) );\
+}
+
+#define NO_SCHED(j)
+
+#define V128_ROL(x,n) _mm_or_si128( _mm_slli_epi32( x, n ),               \
+                                    _mm_srli_epi32( x, 32 - n ) )
+
+#define SCHED_SSSE3(j)                                                  \
+{                                                                       \
+    if( (j) < 8 )                                                       \
+    {                                                                   \
+        tmp = _mm_xor_si128(                                            \
+                _mm_xor_si128( _mm_srli_si128( Wv[((j) - 1) & 7], 4 ),  \
+                               Wv[((j) - 2) & 7] ),                     \
+                _mm_xor_si128( _mm_alignr_epi8( Wv[((j) - 3) & 7],      \
+                                                Wv[((j) - 4) & 7], 8 ), \
+                               Wv[((j) - 4) & 7] ) );                   \
+        tmp = V128_ROL( tmp, 1 );                                       \
+        Wv[(j) & 7] = _mm_xor_si128( tmp,                               \
+                        V128_ROL( _mm_slli_si128( tmp, 12 ), 1 ) );     \
+    }                                                                   \
+    else                                                                \
+    {                                                                   \
+        tmp = _mm_xor_si128(                                            \
+                _mm_xor_si128( _mm_alignr_epi8( Wv[((j) - 1) & 7],      \
+                                                Wv[((j) - 2) & 7], 8 ), \
+                               Wv[((j) - 4) & 7] ),                     \
+                _mm_xor_si128( Wv[((j) - 7) & 7], Wv[(j) & 7] ) );      \
+        Wv[(j) & 7] = V128_ROL( tmp, 2 );                               \
+    }                                                                   \
+    _mm_store_si128( (__m128i*) ( WK + 4 * (j) ),                       \
+                     _mm_add_epi32( Wv[(j) & 7], KV(j) ) );             \
+}
+
+__attribute__((target("ssse3")))
+void s11nSHA::process_ssse3( uint32_t state[DIGEST_INTS],
+                             const unsigned char *data, size_t blocks )
+{
+    const __m128i BSWAP = _mm_set_epi8( 12, 13, 14, 15,  8,  9, 10, 11,
+                                         4,  5,  6,  7,  0,  1,  2,  3 );
+    const __m128i K0 = _mm_set1_epi32( 0x5A827999 );
+    const __m128i K1 = _mm_set1_epi32( 0x6ED9EBA1 );
+    const __m128i K2 = _mm_set1_epi32( (int) 0x8F1BBCDC );
+    const __m128i K3 = _mm_set1_epi32( (int) 0xCA62C1D6 );
+    __m128i Wv[8], tmp;
+    alignas(16) uint32_t WK[80];
+    uint32_t A, B, C, D, E;
+
+    #define WK(t) WK[t]
+
+    for( ; blocks > 0; --blocks, data += BLOCK_BYTES )
+    {
+        for( unsigned int j = 0; j < 4; ++j )
+        {
+            Wv[j] = _mm_shuffle_epi8(
+                      _mm_loadu_si128( (const __m128i*) ( data + 16 * j ) ),
+                      BSWAP );
+            _mm_store_si128( (__m128i*) ( WK + 4 * j ),
+                             _mm_add_epi32( Wv[j], K0 ) );
+        }
+
+        A = state[0]; B = state[1]; C = state[2]; D = state[3]; E = state[4];
+
+        SIMD_ROUNDS( SCHED_SSSE3 )
+
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+    }
+
+    #undef WK
+}
+
+#define V256_ROL(x,n) _mm256_or_si256( _mm256_slli_epi32( x, n ),         \
+                                       _mm256_srli_epi32( x, 32 - n ) )
+
+// same as SCHED_SSSE3, for two blocks at once: the byte shifts and alignr
+// work on each 128 bit half separately, so the low half carries the
+// schedule of the first block and the high half that of the second
+#define SCHED_AVX2(j)                                                   \
+{                                                                       \
+    if( (j) < 8 )                                                       \
+    {                                                                   \
+        tmp = _mm256_xor_si256(                                         \
+                _mm256_xor_si256( _mm256_srli_si256( Wv[((j) - 1) & 7], 4 ), \
+                                  Wv[((j) - 2) & 7] ),                  \
+                _mm256_xor_si256( _mm256_alignr_epi8( Wv[((j) - 3) & 7], \
+                                                      Wv[((j) - 4) & 7], 8 ), \
+                                  Wv[((j) - 4) & 7] ) );                \
+        tmp = V256_ROL( tmp, 1 );                                       \
+        Wv[(j) & 7] = _mm256_xor_si256( tmp,                            \
+                        V256_ROL( _mm256_slli_si256( tmp, 12 ), 1 ) );  \
+    }                                                                   \
+    else                                                                \
+    {                                                                   \
+        tmp = _mm256_xor_si256(                                         \
+                _mm256_xor_si256( _mm256_alignr_epi8( Wv[((j) - 1) & 7], \
+                                                      Wv[((j) - 2) & 7], 8 ), \
+                                  Wv[((j) - 4) & 7] ),                  \
+                _mm256_xor_si256( Wv[((j) - 7) & 7], Wv[(j) & 7] ) );   \
+        Wv[(j) & 7] = V256_ROL( tmp, 2 );                               \
+    }                                                                   \
+    _mm256_store_si256( (__m256i*) WK[j],                               \
+                        _mm256_add_epi32( Wv[(j) & 7], KV(j) ) );       \
+}
+
+__attribute__((target("avx2")))
+void s11nSHA::process_avx2( uint32_t state[DIGEST_INTS],
+                            const unsigned char *data, size_t blocks )
+{
+    const __m256i BSWAP = _mm256_set_epi8( 12, 13, 14, 15,  8,  9, 10, 11,
+                                            4,  5,  6,  7,  0,  1,  2,  3,
+                                           12, 13, 14, 15,  8,  9, 10, 11,
+                                            4,  5,  6,  7,  0,  1,  2,  3 );
+    const __m256i K0 = _mm256_set1_epi32( 0x5A827999 );
+    const __m256i K1 = _mm256_set1_epi32( 0x6ED9EBA1 );
+    const __m256i K2 = _mm256_set1_epi32( (int) 0x8F1BBCDC );
+    const __m256i K3 = _mm256_set1_epi32( (int) 0xCA62C1D6 );
+    __m256i Wv[8], tmp;
+    alignas(32) uint32_t WK[20][8];
+    uint32_t A, B, C, D, E;
+
+    for( ; blocks >= 2; blocks -= 2, data += 2 * BLOCK_BYTES )
+    {
+        for( unsigned int j = 0; j < 4; ++j )
+        {
+            __m128i lo = _mm_loadu_si128( (const __m128i*) ( data + 16 * j ) );
+            __m128i hi = _mm_loadu_si128(
+                           (const __m128i*) ( data + BLOCK_BYTES + 16 * j ) );
+            Wv[j] = _mm256_shuffle_epi8(
+                      _mm256_inserti128_si256( _mm256_castsi128_si256( lo ),
+                                               hi, 1 ), BSWAP );
+            _mm256_store_si256( (__m256i*) WK[j],
+                                _mm256_add_epi32( Wv[j], K0 ) );
+        }
+
+        // first block, expanding the schedule of both as the rounds go
+        #define WK(t) WK[(t) >> 2][(t) & 3]
+
+        A = state[0]; B = state[1]; C = state[2]; D = state[3]; E = state[4];
+
+        SIMD_ROUNDS( SCHED_AVX2 )
+
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+
+        #undef WK
+
+        // second block, schedule already in place
+        #define WK(t) WK[(t) >> 2][4 + ( (t) & 3 )]
+
+        A = state[0]; B = state[1]; C = state[2]; D = state[3]; E = state[4];
+
+        SIMD_ROUNDS( NO_SCHED )
+
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+
+        #undef WK
+    }
+
+    if( blocks > 0 )
+        process_ssse3( state, data, blocks );
+}
+
+#undef SCHED_AVX2
+#undef V256_ROL
+#undef SCHED_SSSE3
+#undef V128_ROL
+#undef NO_SCHED
+#undef SIMD_ROUNDS
+#undef KV
+#undef P
+#undef F3
+#undef F2
+#undef F1
+#undef S
+
+#endif // S11NSHA_X86
@@ -0,0 +1,248 @@
+// g++ -Wall -c -std=c++0x s11nsha_splice.cpp
+// implementation of s11nsha_splice.hpp
+
+// splice, tee, F_SETPIPE_SZ need this before any libc header
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "s11nsha_splice.hpp"
+
+// std::vector
+#include <vector>
+
+// errno, EINTR, EINVAL
+#include <cerrno>
+
+// splice, tee, fcntl, F_SETPIPE_SZ, F_GETPIPE_SZ
+#include <fcntl.h>
+
+// fstat, S_ISFIFO
+#include <sys/stat.h>
+
+// pipe, read, write, close
+#include <unistd.h>
+
+namespace
+{
+    // feeds the hash and takes the checkpoint once the bytes before
+    // checkpoint_at have all gone in
+    struct Hasher
+    {
+        Hasher( const s11nSHA::SpliceOptions& options, s11nSHA::SpliceStats& stats )
+            : options( options ), stats( stats ) {}
+
+        void update( const unsigned char *data, size_t length )
+        {
+            sha1.update( data, length );
+            stats.bytes += length;
+            if( stats.bytes == options.checkpoint_at )
+            {
+                s11nSHA::marshall( stats.checkpoint, sha1 );
+                stats.checkpointed = true;
+            }
+        }
+
+        // bytes to move next so that a checkpoint lands on a boundary
+        size_t next( uint64_t length, size_t limit ) const
+        {
+            uint64_t want = length - stats.bytes;
+            if( stats.bytes < options.checkpoint_at
+                && options.checkpoint_at - stats.bytes < want )
+                want = options.checkpoint_at - stats.bytes;
+            return want < limit ? (size_t) want : limit;
+        }
+
+        s11nSHA::SHA1 sha1;
+        const s11nSHA::SpliceOptions& options;
+        s11nSHA::SpliceStats& stats;
+    };
+
+    bool read_exact( int fd, unsigned char *buf, size_t length )
+    {
+        while( length > 0 )
+        {
+            ssize_t n = read( fd, buf, length );
+            if( n < 0 && errno == EINTR )
+                continue;
+            if( n <= 0 )
+                return false;
+            buf += n;
+            length -= (size_t) n;
+        }
+        return true;
+    }
+
+    bool write_exact( int fd, const unsigned char *buf, size_t length )
+    {
+        while( length > 0 )
+        {
+            ssize_t n = write( fd, buf, length );
+            if( n < 0 && errno == EINTR )
+                continue;
+            if( n <= 0 )
+                return false;
+            buf += n;
+            length -= (size_t) n;
+        }
+        return true;
+    }
+
+    // splice exactly length bytes out of a pipe
+    bool splice_exact( int pipe_fd, int out_fd, size_t length )
+    {
+        while( length > 0 )
+        {
+            ssize_t n = splice( pipe_fd, NULL, out_fd, NULL, length,
+                                SPLICE_F_MOVE | SPLICE_F_MORE );
+            if( n < 0 && errno == EINTR )
+                continue;
+            if( n <= 0 )
+                return false;
+            length -= (size_t) n;
+        }
+        return true;
+    }
+
+    bool copy_loop( int in_fd, int out_fd, uint64_t length, Hasher& hasher,
+                    size_t buffer_bytes )
+    {
+        std::vector<unsigned char> buf( buffer_bytes );
+        while( hasher.stats.bytes < length )
+        {
+            ssize_t n = read( in_fd, &buf[0], hasher.next( length, buf.size() ) );
+            if( n < 0 && errno == EINTR )
+                continue;
+            if( n < 0 )
+                return false;
+            if( n == 0 )
+                break;
+            if( !write_exact( out_fd, &buf[0], (size_t) n ) )
+                return false;
+            hasher.update( &buf[0], (size_t) n );
+        }
+        return true;
+    }
+
+    void close_pipe( int fds[2] )
+    {
+        if( fds[0] >= 0 )
+            close( fds[0] );
+        if( fds[1] >= 0 )
+            close( fds[1] );
+    }
+
+} // end of anonymous namespace
+
+bool s11nSHA::splice_sha1( int in_fd, int out_fd, uint64_t length,
+                           unsigned char digest[DIGEST_SIZE],
+                           const SpliceOptions& options, SpliceStats *stats )
+{
+    SpliceStats local;
+    Hasher hasher( options, local );
+    int data[2] = { -1, -1 }, copy[2] = { -1, -1 };
+    bool ok = true;
+
+    // a pipe on the input side is used as the data pipe directly
+    struct stat st;
+    bool in_pipe = fstat( in_fd, &st ) == 0 && S_ISFIFO( st.st_mode );
+
+    if( ( !in_pipe && pipe( data ) != 0 ) || pipe( copy ) != 0 )
+    {
+        close_pipe( data );
+        return false;
+    }
+    if( in_pipe )
+        data[0] = -1;
+
+    int source = in_pipe ? in_fd : data[0];
+    if( !in_pipe )
+        fcntl( data[1], F_SETPIPE_SZ, (int) options.pipe_bytes );
+    fcntl( copy[1], F_SETPIPE_SZ, (int) options.pipe_bytes );
+    int capacity = fcntl( copy[1], F_GETPIPE_SZ );
+    size_t limit = capacity > 0 ? (size_t) capacity : 4096 * 16;
+
+    std::vector<unsigned char> buf( limit );
+    bool done = false;
+
+    while( ok && !done && local.bytes < length )
+    {
+        size_t want = hasher.next( length, limit );
+        ssize_t n;
+
+        if( in_pipe )
+        {
+            // tee() straight off the input pipe; it waits for data
+            n = tee( in_fd, copy[1], want, 0 );
+        }
+        else
+            n = splice( in_fd, NULL, data[1], NULL, want,
+                        SPLICE_F_MOVE | SPLICE_F_MORE );
+
+        if( n < 0 && errno == EINTR )
+            continue;
+        if( n < 0 && !local.spliced && errno == EINVAL )
+        {
+            ok = copy_loop( in_fd, out_fd, length, hasher, limit );
+            break;
+        }
+        if( n <= 0 )
+        {
+            ok = n == 0;
+            break;
+        }
+
+        // duplicate what sits in the data pipe, forward it, then hash the
+        // copy. tee() may duplicate less than asked; the forwarded part is
+        // consumed before the next tee() so nothing is duplicated twice
+        size_t pending = (size_t) n;
+        while( ok && pending > 0 )
+        {
+            size_t teed = pending;
+            if( !in_pipe )
+            {
+                ssize_t t = tee( source, copy[1], pending, 0 );
+                if( t < 0 && errno == EINTR )
+                    continue;
+                if( t <= 0 )
+                {
+                    ok = false;
+                    break;
+                }
+                teed = (size_t) t;
+            }
+
+            if( !splice_exact( source, out_fd, teed ) )
+            {
+                // out_fd cannot be spliced to (e.g. O_APPEND): nothing was
+                // forwarded yet, so drop the copy, hand over what the data
+                // pipe holds by hand and carry on without splice()
+                ok = errno == EINVAL && !local.spliced
+                     && read_exact( copy[0], &buf[0], teed );
+                if( ok && !in_pipe )
+                    ok = read_exact( source, &buf[0], pending )
+                         && write_exact( out_fd, &buf[0], pending );
+                if( ok && !in_pipe )
+                    hasher.update( &buf[0], pending );
+                if( ok )
+                    ok = copy_loop( in_fd, out_fd, length, hasher, limit );
+                done = true;
+                break;
+            }
+            local.spliced = true;
+
+            ok = read_exact( copy[0], &buf[0], teed );
+            if( ok )
+                hasher.update( &buf[0], teed );
+            pending -= teed;
+        }
+    }
+
+    close_pipe( data );
+    close_pipe( copy );
+
+    hasher.sha1.final( digest );
+    if( stats != NULL )
+        *stats = local;
+    return ok;
+}
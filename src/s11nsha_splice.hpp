@@ -0,0 +1,69 @@
+/**
+ *  Hash while forwarding: move bytes from one fd to another with splice()
+ *  and hash the very same pages on the side, e.g. for a proxy that checks
+ *  the SHA1 of the bodies it relays.
+ *
+ *  Data is spliced from in_fd into a pipe, duplicated into a second pipe
+ *  with tee(), which shares pages instead of copying them, and spliced
+ *  from the first pipe to out_fd. The forwarded bytes never enter user
+ *  space; the only copy is the read() from the second pipe that feeds
+ *  SHA1::update(). If the kernel refuses to splice these fds, e.g. for
+ *  some special files, a plain read()/write() loop is used instead.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_SPLICE_HPP
+#define S11NSHA_SPLICE_HPP
+
+// uint64_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// s11nSHA::SHA1, DIGEST_SIZE, FIXED_S11N_BYTES
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    // length that means: forward until in_fd reaches end of file
+    const uint64_t SPLICE_TO_EOF = ~(uint64_t) 0;
+
+    struct SpliceOptions
+    {
+        SpliceOptions() : pipe_bytes( 1024*1024 ),
+                          checkpoint_at( SPLICE_TO_EOF ) {}
+
+        size_t pipe_bytes;       // requested pipe capacity, the most bytes
+                                 // moved per splice()
+        uint64_t checkpoint_at;  // offset at which to marshall the state
+                                 // of the bytes forwarded so far
+    };
+
+    struct SpliceStats
+    {
+        SpliceStats() : bytes( 0 ), spliced( false ), checkpointed( false ) {}
+
+        uint64_t bytes;      // bytes forwarded and hashed
+        bool spliced;        // false if the read()/write() fallback ran
+        bool checkpointed;   // checkpoint holds the state at checkpoint_at
+        unsigned char checkpoint[FIXED_S11N_BYTES];  // see marshall()
+    };
+
+    // forward length bytes (or up to end of file) from in_fd to out_fd and
+    // hash them. the fds are left open and blocking fds are expected; a
+    // short input is not an error, stats->bytes says how much was moved.
+    // returns false if a read, write or splice fails, in which case an
+    // unknown number of bytes may already have reached out_fd
+    bool splice_sha1( int in_fd, int out_fd, uint64_t length,
+                      unsigned char digest[DIGEST_SIZE],
+                      const SpliceOptions& options = SpliceOptions(),
+                      SpliceStats *stats = NULL );
+
+} // end of namespace s11nSHA
+
+#endif
@@ -0,0 +1,277 @@
+// g++ -Wall -c -std=c++0x s11nsha_store.cpp
+// implementation of s11nsha_store.hpp
+
+#include "s11nsha_store.hpp"
+
+// open, O_RDWR, O_CREAT
+#include <fcntl.h>
+
+// mmap, msync, munmap
+#include <sys/mman.h>
+
+// fstat
+#include <sys/stat.h>
+
+// ftruncate, fdatasync, close, sysconf
+#include <unistd.h>
+
+namespace
+{
+    const unsigned char STORE_MAGIC[4] = { 'S', '1', 'S', 'T' };
+
+    // slot flags
+    const uint32_t SLOT_EMPTY = 0;
+    const uint32_t SLOT_USED = 1;
+    const uint32_t SLOT_DELETED = 2;
+
+    // offsets inside the header and inside a slot
+    const size_t HEADER_VERSION = 4;
+    const size_t HEADER_SLOTS = 8;
+    const size_t HEADER_USED = 16;
+    const size_t SLOT_KEY = 0;
+    const size_t SLOT_FLAGS = 8;
+    const size_t SLOT_RECORD = 16;
+
+    void put_uint32( unsigned char *p, uint32_t n )
+    {
+        p[0] = (unsigned char) ( n >> 24 );
+        p[1] = (unsigned char) ( n >> 16 );
+        p[2] = (unsigned char) ( n >>  8 );
+        p[3] = (unsigned char) ( n       );
+    }
+
+    uint32_t get_uint32( const unsigned char *p )
+    {
+        return ( (uint32_t) p[0] << 24 ) | ( (uint32_t) p[1] << 16 )
+             | ( (uint32_t) p[2] <<  8 ) | ( (uint32_t) p[3]       );
+    }
+
+    void put_uint64( unsigned char *p, uint64_t n )
+    {
+        put_uint32( p, (uint32_t) ( n >> 32 ) );
+        put_uint32( p + 4, (uint32_t) n );
+    }
+
+    uint64_t get_uint64( const unsigned char *p )
+    {
+        return ( (uint64_t) get_uint32( p ) << 32 ) | get_uint32( p + 4 );
+    }
+
+    // session ids are often sequential; spread them over the table
+    uint64_t mix( uint64_t key )
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key;
+    }
+}
+
+static_assert( 16 + s11nSHA::FIXED_S11N_BYTES <= s11nSHA::STORE_SLOT_BYTES,
+               "marshall() record does not fit a store slot" );
+
+s11nSHA::StateStore::StateStore()
+    : fd( -1 ), map( NULL ), map_bytes( 0 ), slots( 0 ),
+      durability( DURABLE_NONE )
+{
+}
+
+s11nSHA::StateStore::~StateStore()
+{
+    close();
+}
+
+bool s11nSHA::StateStore::open( const char *path, size_t slots,
+                                Durability durability )
+{
+    struct stat st;
+    size_t wanted = 1;
+
+    close();
+
+    while( wanted < slots )
+        wanted <<= 1;
+
+    if( ( fd = ::open( path, O_RDWR | O_CREAT, 0644 ) ) < 0 )
+        return false;
+
+    if( fstat( fd, &st ) != 0 )
+    {
+        close();
+        return false;
+    }
+
+    bool created = ( st.st_size == 0 );
+    if( created )
+    {
+        map_bytes = STORE_SLOT_BYTES * ( wanted + 1 );
+        if( ftruncate( fd, (off_t) map_bytes ) != 0 )
+        {
+            close();
+            return false;
+        }
+    }
+    else
+        map_bytes = (size_t) st.st_size;
+
+    if( map_bytes < STORE_SLOT_BYTES )
+    {
+        close();
+        return false;
+    }
+
+    void *p = mmap( NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if( p == MAP_FAILED )
+    {
+        map = NULL;
+        close();
+        return false;
+    }
+    map = (unsigned char*) p;
+
+    if( created )
+    {
+        std::memcpy( map, STORE_MAGIC, sizeof( STORE_MAGIC ) );
+        put_uint32( map + HEADER_VERSION, STORE_VERSION );
+        put_uint64( map + HEADER_SLOTS, wanted );
+        put_uint64( map + HEADER_USED, 0 );
+    }
+
+    // a store written by someone else, or truncated, is not ours to touch
+    this->slots = (size_t) get_uint64( map + HEADER_SLOTS );
+    if( std::memcmp( map, STORE_MAGIC, sizeof( STORE_MAGIC ) ) != 0 ||
+        get_uint32( map + HEADER_VERSION ) != STORE_VERSION ||
+        this->slots == 0 || ( this->slots & ( this->slots - 1 ) ) != 0 ||
+        map_bytes / STORE_SLOT_BYTES - 1 < this->slots )
+    {
+        close();
+        return false;
+    }
+
+    this->durability = durability;
+    return true;
+}
+
+void s11nSHA::StateStore::close()
+{
+    if( map != NULL )
+        munmap( map, map_bytes );
+    if( fd >= 0 )
+        ::close( fd );
+
+    fd = -1;
+    map = NULL;
+    map_bytes = 0;
+    slots = 0;
+}
+
+unsigned char *s11nSHA::StateStore::lookup( uint64_t key, bool insert ) const
+{
+    if( map == NULL )
+        return NULL;
+
+    unsigned char *reuse = NULL;
+    size_t mask = slots - 1;
+    size_t i = (size_t) mix( key ) & mask;
+
+    for( size_t probes = 0; probes < slots; ++probes, i = ( i + 1 ) & mask )
+    {
+        unsigned char *slot = map + STORE_SLOT_BYTES * ( i + 1 );
+        uint32_t flags = get_uint32( slot + SLOT_FLAGS );
+
+        if( flags == SLOT_EMPTY )
+            return insert ? ( reuse ? reuse : slot ) : NULL;
+
+        if( flags == SLOT_DELETED )
+        {
+            if( reuse == NULL )
+                reuse = slot;
+        }
+        else if( get_uint64( slot + SLOT_KEY ) == key )
+            return slot;
+    }
+
+    return insert ? reuse : NULL;
+}
+
+bool s11nSHA::StateStore::commit( const unsigned char *slot )
+{
+    if( durability == DURABLE_MSYNC )
+    {
+        // msync wants a page aligned start; cover the slot and the header
+        size_t page = (size_t) sysconf( _SC_PAGESIZE );
+        size_t offset = (size_t) ( slot - map ) & ~( page - 1 );
+        size_t length = (size_t) ( slot - map ) + STORE_SLOT_BYTES - offset;
+
+        return msync( map + offset, length, MS_SYNC ) == 0 &&
+               msync( map, STORE_SLOT_BYTES, MS_SYNC ) == 0;
+    }
+
+    if( durability == DURABLE_FDATASYNC )
+        return fdatasync( fd ) == 0;
+
+    return true;
+}
+
+bool s11nSHA::StateStore::put( uint64_t key, const SHA1& sha1_object )
+{
+    unsigned char *slot = lookup( key, true );
+
+    if( slot == NULL )
+        return false;
+
+    // record first, then mark the slot used
+    marshall( slot + SLOT_RECORD, sha1_object );
+
+    if( get_uint32( slot + SLOT_FLAGS ) != SLOT_USED )
+    {
+        put_uint64( slot + SLOT_KEY, key );
+        put_uint32( slot + SLOT_FLAGS, SLOT_USED );
+        put_uint64( map + HEADER_USED, get_uint64( map + HEADER_USED ) + 1 );
+    }
+
+    return commit( slot );
+}
+
+bool s11nSHA::StateStore::get( uint64_t key, SHA1& sha1_object ) const
+{
+    const unsigned char *slot = lookup( key, false );
+
+    if( slot == NULL )
+        return false;
+
+    return unmarshall( slot + SLOT_RECORD, FIXED_S11N_BYTES, sha1_object );
+}
+
+bool s11nSHA::StateStore::erase( uint64_t key )
+{
+    unsigned char *slot = lookup( key, false );
+
+    if( slot == NULL )
+        return false;
+
+    put_uint32( slot + SLOT_FLAGS, SLOT_DELETED );
+    put_uint64( map + HEADER_USED, get_uint64( map + HEADER_USED ) - 1 );
+
+    return commit( slot );
+}
+
+bool s11nSHA::StateStore::sync()
+{
+    if( map == NULL )
+        return false;
+
+    return msync( map, map_bytes, MS_SYNC ) == 0;
+}
+
+size_t s11nSHA::StateStore::size() const
+{
+    return map ? (size_t) get_uint64( map + HEADER_USED ) : 0;
+}
+
+size_t s11nSHA::StateStore::capacity() const
+{
+    return slots;
+}
@@ -0,0 +1,98 @@
+/**
+ *  Persistent store of s11nSHA::SHA1 states in a memory mapped file
+ *
+ *  The file is an open addressing hash table of fixed size slots keyed by
+ *  a 64 bit session id. put() writes the state in place in the mapping and
+ *  get() unmarshalls it straight from there, so reopening a store after a
+ *  restart costs one mmap() instead of one deserialization per session.
+ *
+ *  Layout (integers big endian, BLOCK_BYTES = 64):
+ *      header : magic "S1ST", uint32 version, uint64 slot count,
+ *               uint64 used slots, padding to STORE_SLOT_BYTES
+ *      slot   : uint64 key, uint32 flags, 4 reserved bytes, one
+ *               FIXED_S11N_BYTES marshall() record, padding
+ *
+ *  A StateStore is not thread safe; guard it externally if shared.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_STORE_HPP
+#define S11NSHA_STORE_HPP
+
+// uint64_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// s11nSHA::SHA1, FIXED_S11N_BYTES
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    const unsigned int STORE_VERSION = 1;
+    const unsigned int STORE_SLOT_BYTES = 128;
+
+    class StateStore
+    {
+    public:
+        // when put()/erase() changes reach the disk
+        enum Durability
+        {
+            DURABLE_NONE,       // whenever the kernel writes back the pages
+            DURABLE_MSYNC,      // msync() of the changed slot before return
+            DURABLE_FDATASYNC   // fdatasync() of the file before return
+        };
+
+        StateStore();
+        ~StateStore();
+
+        // open the store at path, creating it with room for `slots` sessions
+        // (rounded up to a power of two) if it does not exist. an existing
+        // store keeps its own size. false on I/O error or a foreign file
+        bool open( const char *path, size_t slots,
+                   Durability durability = DURABLE_NONE );
+
+        // unmap and close; also done by the destructor
+        void close();
+
+        // write the state of session `key` in place; false if the store is
+        // full or not open
+        bool put( uint64_t key, const SHA1& sha1_object );
+
+        // restore the state of session `key`; false if there is none
+        bool get( uint64_t key, SHA1& sha1_object ) const;
+
+        // forget session `key`; false if there is none
+        bool erase( uint64_t key );
+
+        // flush every change to disk, regardless of durability policy
+        bool sync();
+
+        size_t size() const;      // sessions stored
+        size_t capacity() const;  // slots in the file
+
+    private:
+        StateStore( const StateStore& );
+        StateStore& operator=( const StateStore& );
+
+        // slot holding key, or the slot to insert it into; NULL if the
+        // key is absent and (for insert) the table is full
+        unsigned char *lookup( uint64_t key, bool insert ) const;
+
+        bool commit( const unsigned char *slot );
+
+        int fd;
+        unsigned char *map;
+        size_t map_bytes;
+        size_t slots;
+        Durability durability;
+    };
+
+} // end of namespace s11nSHA
+
+#endif
@@ -0,0 +1,178 @@
+// g++ -Wall -c -std=c++0x s11nsha_stream.cpp
+// implementation of s11nsha_stream.hpp
+
+#include "s11nsha_stream.hpp"
+
+s11nSHA::HashingStreambuf::HashingStreambuf( std::streambuf *target )
+    : target( target )
+{
+    // writes gather in buffer until it is full; the get area starts empty
+    setp( buffer, buffer + STREAM_BUFFER_BYTES );
+    setg( buffer, buffer, buffer );
+}
+
+s11nSHA::HashingStreambuf::~HashingStreambuf()
+{
+    this->sync();
+}
+
+const s11nSHA::SHA1& s11nSHA::HashingStreambuf::sha1()
+{
+    this->flush_put();
+    this->hash_consumed();
+    return this->state;
+}
+
+void s11nSHA::HashingStreambuf::final( unsigned char digest[DIGEST_SIZE] )
+{
+    this->sync();
+    this->hash_consumed();
+    this->state.final( digest );
+}
+
+bool s11nSHA::HashingStreambuf::flush_put()
+{
+    std::streamsize n = pptr() - pbase();
+    if( n == 0 )
+        return true;
+
+    std::streamsize sent = n;
+    if( this->target != NULL )
+        sent = this->target->sputn( pbase(), n );
+    if( sent > 0 )
+        this->state.update( (const unsigned char*) pbase(), (size_t) sent );
+
+    // keep what the target did not take
+    std::memmove( pbase(), pbase() + sent, (size_t) ( n - sent ) );
+    setp( buffer, buffer + STREAM_BUFFER_BYTES );
+    pbump( (int) ( n - sent ) );
+    return sent == n;
+}
+
+void s11nSHA::HashingStreambuf::hash_consumed()
+{
+    std::streamsize n = gptr() - eback();
+    if( n > 0 )
+        this->state.update( (const unsigned char*) eback(), (size_t) n );
+    setg( gptr(), gptr(), egptr() );
+}
+
+s11nSHA::HashingStreambuf::int_type
+s11nSHA::HashingStreambuf::overflow( int_type c )
+{
+    if( !this->flush_put() )
+        return traits_type::eof();
+    if( !traits_type::eq_int_type( c, traits_type::eof() ) )
+    {
+        *pptr() = traits_type::to_char_type( c );
+        pbump( 1 );
+    }
+    return traits_type::not_eof( c );
+}
+
+// small writes are gathered, large ones go to the target untouched and are
+// hashed straight from the caller's buffer
+std::streamsize s11nSHA::HashingStreambuf::xsputn( const char *s,
+                                                   std::streamsize n )
+{
+    if( n < epptr() - pptr() )
+    {
+        std::memcpy( pptr(), s, (size_t) n );
+        pbump( (int) n );
+        return n;
+    }
+
+    if( !this->flush_put() )
+        return 0;
+
+    std::streamsize sent = n;
+    if( this->target != NULL )
+        sent = this->target->sputn( s, n );
+    if( sent > 0 )
+        this->state.update( (const unsigned char*) s, (size_t) sent );
+    return sent;
+}
+
+int s11nSHA::HashingStreambuf::sync()
+{
+    if( !this->flush_put() )
+        return -1;
+    return this->target != NULL ? this->target->pubsync() : 0;
+}
+
+s11nSHA::HashingStreambuf::int_type s11nSHA::HashingStreambuf::underflow()
+{
+    if( gptr() < egptr() )
+        return traits_type::to_int_type( *gptr() );
+
+    this->hash_consumed();
+    if( this->target == NULL )
+        return traits_type::eof();
+
+    std::streamsize n = this->target->sgetn( buffer, STREAM_BUFFER_BYTES );
+    setg( buffer, buffer, buffer + ( n > 0 ? n : 0 ) );
+    return n > 0 ? traits_type::to_int_type( *gptr() ) : traits_type::eof();
+}
+
+// buffered bytes first, then large reads straight into the caller's buffer
+std::streamsize s11nSHA::HashingStreambuf::xsgetn( char *s, std::streamsize n )
+{
+    std::streamsize done = egptr() - gptr();
+    if( done > n )
+        done = n;
+    std::memcpy( s, gptr(), (size_t) done );
+    gbump( (int) done );
+
+    if( done == n )
+        return n;
+
+    this->hash_consumed();
+    if( this->target == NULL )
+        return done;
+
+    std::streamsize left = n - done;
+    if( left < (std::streamsize) STREAM_BUFFER_BYTES )
+    {
+        while( done < n && !traits_type::eq_int_type( this->underflow(),
+                                                      traits_type::eof() ) )
+        {
+            std::streamsize take = egptr() - gptr();
+            if( take > n - done )
+                take = n - done;
+            std::memcpy( s + done, gptr(), (size_t) take );
+            gbump( (int) take );
+            done += take;
+        }
+        return done;
+    }
+
+    std::streamsize got = this->target->sgetn( s + done, left );
+    if( got > 0 )
+    {
+        this->state.update( (const unsigned char*) s + done, (size_t) got );
+        done += got;
+    }
+    return done;
+}
+
+s11nSHA::HashingOStream::HashingOStream( std::streambuf *target )
+    : std::ostream( NULL ), buf( target )
+{
+    this->init( &this->buf );
+}
+
+void s11nSHA::HashingOStream::final( unsigned char digest[DIGEST_SIZE] )
+{
+    this->buf.final( digest );
+}
+
+s11nSHA::HashingIStream::HashingIStream( std::streambuf *source )
+    : std::istream( NULL ), buf( source )
+{
+    this->init( &this->buf );
+}
+
+void s11nSHA::HashingIStream::final( unsigned char digest[DIGEST_SIZE] )
+{
+    this->buf.final( digest );
+}
@@ -0,0 +1,102 @@
+/**
+ *  iostream adapters that hash data on its way through: a streambuf that
+ *  wraps a destination (or source) streambuf and hands every chunk written
+ *  to (or read from) it to s11nSHA::SHA1::update(), so a pipeline gets its
+ *  digest in the same pass that writes or reads the data.
+ *
+ *  Large writes and reads go straight between the caller's buffer and the
+ *  wrapped streambuf and are hashed in place; only small ones are gathered
+ *  in a local buffer first. Use one object in one direction only.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_STREAM_HPP
+#define S11NSHA_STREAM_HPP
+
+// std::istream
+#include <istream>
+
+// std::ostream
+#include <ostream>
+
+// std::streambuf
+#include <streambuf>
+
+// s11nSHA::SHA1, DIGEST_SIZE
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    const unsigned int STREAM_BUFFER_BYTES = 1024*16;
+
+    class HashingStreambuf : public std::streambuf
+    {
+    public:
+        // target receives what is written or supplies what is read; a NULL
+        // target on the output side just hashes and discards
+        explicit HashingStreambuf( std::streambuf *target = NULL );
+
+        // forwards whatever is still gathered to target, like a filebuf
+        // writes out its buffer when it is destroyed
+        ~HashingStreambuf();
+
+        // digest of everything written so far (flushed first), or of
+        // everything consumed by the reader so far; then restart
+        void final( unsigned char digest[DIGEST_SIZE] );
+
+        // running state, e.g. to marshall it half way through a stream
+        const SHA1& sha1();
+
+    protected:
+        int_type overflow( int_type c );
+        std::streamsize xsputn( const char *s, std::streamsize n );
+        int_type underflow();
+        std::streamsize xsgetn( char *s, std::streamsize n );
+        int sync();
+
+    private:
+        HashingStreambuf( const HashingStreambuf& );
+        HashingStreambuf& operator=( const HashingStreambuf& );
+
+        // hash and forward the put area; false if the target refused it
+        bool flush_put();
+
+        // hash the part of the get area the reader has consumed
+        void hash_consumed();
+
+        std::streambuf *target;
+        SHA1 state;
+        char buffer[STREAM_BUFFER_BYTES];
+    };
+
+    // ostream writing through a HashingStreambuf
+    class HashingOStream : public std::ostream
+    {
+    public:
+        explicit HashingOStream( std::streambuf *target = NULL );
+
+        void final( unsigned char digest[DIGEST_SIZE] );
+
+    private:
+        HashingStreambuf buf;
+    };
+
+    // istream reading through a HashingStreambuf
+    class HashingIStream : public std::istream
+    {
+    public:
+        explicit HashingIStream( std::streambuf *source );
+
+        void final( unsigned char digest[DIGEST_SIZE] );
+
+    private:
+        HashingStreambuf buf;
+    };
+
+} // end of namespace s11nSHA
+
+#endif
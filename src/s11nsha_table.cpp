@@ -0,0 +1,314 @@
+// g++ -Wall -c -std=c++0x s11nsha_table.cpp
+// implementation of s11nsha_table.hpp
+
+#include "s11nsha_table.hpp"
+
+// std::this_thread::yield
+#include <thread>
+
+// std::bad_alloc
+#include <new>
+
+// posix_memalign, free
+#include <cstdlib>
+
+namespace
+{
+    const size_t CACHE_LINE = 64;
+    const size_t RETIRE_BATCH = 64;  // removals between reclaim() calls
+
+    uint64_t mix64( uint64_t x )
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    // where a thread starts looking for a free announcement slot, so that
+    // threads do not all fight over the first one
+    std::atomic<unsigned int> next_hint( 0 );
+    thread_local unsigned int epoch_hint = next_hint++;
+
+} // end of anonymous namespace
+
+// one cache line (or two) per session, so writers of different sessions
+// never share one
+struct alignas( 64 ) s11nSHA::SessionTable::Node
+{
+    uint64_t id;
+    size_t slot;
+    std::atomic<bool> owned;  // stays set once the node is removed
+    SHA1 sha1;
+};
+
+struct s11nSHA::SessionTable::Slot
+{
+    std::atomic<uint64_t> key;
+    std::atomic<Node*> node;
+};
+
+// announces the epoch a thread entered at for as long as it may hold a
+// pointer to a node; a node removed at epoch r is only freed once every
+// announced epoch is past r
+class s11nSHA::SessionTable::Guard
+{
+public:
+    Guard( SessionTable& table ) : table( table )
+    {
+        for( unsigned int i = epoch_hint;; ++i )
+        {
+            std::atomic<uint64_t>& a = table.announced[i % TABLE_EPOCH_SLOTS];
+            uint64_t idle = 0;
+            if( a.compare_exchange_strong( idle, table.epoch.load() ) )
+            {
+                this->slot = &a;
+                return;
+            }
+            if( i - epoch_hint >= TABLE_EPOCH_SLOTS )
+                std::this_thread::yield();
+        }
+    }
+
+    ~Guard()
+    {
+        this->slot->store( 0, std::memory_order_release );
+    }
+
+private:
+    SessionTable& table;
+    std::atomic<uint64_t> *slot;
+};
+
+s11nSHA::SessionTable::SessionTable( size_t capacity )
+    : longest( 0 ), live( 0 ), epoch( 1 )
+{
+    size_t n = 16;
+    while( n < capacity )
+        n <<= 1;
+
+    this->slots = new Slot[n];
+    this->mask = n - 1;
+    for( size_t i = 0; i < n; ++i )
+    {
+        this->slots[i].key.store( SESSION_ID_EMPTY, std::memory_order_relaxed );
+        this->slots[i].node.store( NULL, std::memory_order_relaxed );
+    }
+    for( unsigned int i = 0; i < TABLE_EPOCH_SLOTS; ++i )
+        this->announced[i].store( 0, std::memory_order_relaxed );
+}
+
+s11nSHA::SessionTable::~SessionTable()
+{
+    for( size_t i = 0; i <= this->mask; ++i )
+    {
+        Node *node = this->slots[i].node.load( std::memory_order_relaxed );
+        if( node != NULL )
+            this->retired.push_back( std::make_pair( (uint64_t) 0, node ) );
+    }
+    for( size_t i = 0; i < this->retired.size(); ++i )
+    {
+        this->retired[i].second->~Node();
+        free( this->retired[i].second );
+    }
+    delete[] this->slots;
+}
+
+s11nSHA::SessionTable::Node *s11nSHA::SessionTable::lookup( uint64_t id ) const
+{
+    size_t i = mix64( id ) & this->mask;
+
+    // no session sits further than longest from its home slot; without
+    // this bound a miss would walk every tombstone up to an empty slot
+    size_t limit = this->longest.load( std::memory_order_acquire );
+    for( size_t probes = 0; probes <= limit; ++probes, i = ( i + 1 ) & this->mask )
+    {
+        uint64_t key = this->slots[i].key.load( std::memory_order_acquire );
+        if( key == SESSION_ID_EMPTY )
+            return NULL;
+        if( key != id )
+            continue;
+
+        // the slot may have been recycled for another id since we read key
+        Node *node = this->slots[i].node.load( std::memory_order_acquire );
+        if( node != NULL && node->id == id )
+            return node;
+    }
+    return NULL;
+}
+
+s11nSHA::SessionTable::Node *s11nSHA::SessionTable::own( uint64_t id )
+{
+    for( ;; )
+    {
+        {
+            Guard guard( *this );
+            Node *node = this->lookup( id );
+            if( node == NULL )
+                return NULL;
+
+            // an owned node cannot be removed by anyone else, so it stays
+            // valid after the guard is gone
+            bool owned = false;
+            if( node->owned.compare_exchange_strong( owned, true,
+                                                     std::memory_order_acquire ) )
+                return node;
+        }
+        std::this_thread::yield();
+    }
+}
+
+bool s11nSHA::SessionTable::begin( uint64_t id )
+{
+    if( id == SESSION_ID_EMPTY || id == SESSION_ID_DELETED )
+        return false;
+
+    std::lock_guard<std::mutex> lock( this->stripes[mix64( id ) % TABLE_LOCK_STRIPES] );
+    {
+        Guard guard( *this );
+        if( this->lookup( id ) != NULL )
+            return false;
+    }
+
+    // claim the first free or deleted slot; begin() of other ids may be
+    // racing for the same one
+    size_t i = mix64( id ) & this->mask;
+    size_t probes = 0;
+    for( ; probes <= this->mask; ++probes, i = ( i + 1 ) & this->mask )
+    {
+        uint64_t key = this->slots[i].key.load( std::memory_order_acquire );
+        if( ( key == SESSION_ID_EMPTY || key == SESSION_ID_DELETED ) &&
+            this->slots[i].key.compare_exchange_strong( key, id ) )
+            break;
+    }
+    if( probes > this->mask )
+        return false;
+
+    // raised before the node is published, so a lookup that can see the
+    // node also probes far enough to reach it
+    size_t seen = this->longest.load( std::memory_order_relaxed );
+    while( seen < probes &&
+           !this->longest.compare_exchange_weak( seen, probes, std::memory_order_release ) )
+        ;
+
+    void *p;
+    if( posix_memalign( &p, CACHE_LINE, sizeof( Node ) ) != 0 )
+    {
+        this->slots[i].key.store( SESSION_ID_DELETED, std::memory_order_release );
+        return false;
+    }
+    Node *node = new( p ) Node;
+    node->id = id;
+    node->slot = i;
+    node->owned.store( false, std::memory_order_relaxed );
+    this->slots[i].node.store( node, std::memory_order_release );
+    ++this->live;
+    return true;
+}
+
+void s11nSHA::SessionTable::remove( Node *node )
+{
+    {
+        std::lock_guard<std::mutex> lock( this->stripes[mix64( node->id ) % TABLE_LOCK_STRIPES] );
+        this->slots[node->slot].node.store( NULL, std::memory_order_release );
+        this->slots[node->slot].key.store( SESSION_ID_DELETED, std::memory_order_release );
+    }
+    --this->live;
+
+    // threads that entered at or before this epoch may still hold node
+    uint64_t removed_at = this->epoch.fetch_add( 1 );
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock( this->retire_lock );
+        this->retired.push_back( std::make_pair( removed_at, node ) );
+        full = this->retired.size() >= RETIRE_BATCH;
+    }
+    if( full )
+        this->reclaim();
+}
+
+size_t s11nSHA::SessionTable::reclaim()
+{
+    uint64_t oldest = this->epoch.load();
+    for( unsigned int i = 0; i < TABLE_EPOCH_SLOTS; ++i )
+    {
+        uint64_t a = this->announced[i].load();
+        if( a != 0 && a < oldest )
+            oldest = a;
+    }
+
+    std::lock_guard<std::mutex> lock( this->retire_lock );
+    size_t kept = 0;
+    for( size_t i = 0; i < this->retired.size(); ++i )
+    {
+        if( this->retired[i].first < oldest )
+        {
+            this->retired[i].second->~Node();
+            free( this->retired[i].second );
+        }
+        else
+            this->retired[kept++] = this->retired[i];
+    }
+    this->retired.resize( kept );
+    return kept;
+}
+
+bool s11nSHA::SessionTable::update( uint64_t id, const unsigned char *input,
+                                    size_t length )
+{
+    Node *node = this->own( id );
+    if( node == NULL )
+        return false;
+
+    node->sha1.update( input, length );
+    node->owned.store( false, std::memory_order_release );
+    return true;
+}
+
+bool s11nSHA::SessionTable::final( uint64_t id,
+                                   unsigned char digest[DIGEST_SIZE] )
+{
+    Node *node = this->own( id );
+    if( node == NULL )
+        return false;
+
+    node->sha1.final( digest );
+    this->remove( node );
+    return true;
+}
+
+bool s11nSHA::SessionTable::abort( uint64_t id )
+{
+    Node *node = this->own( id );
+    if( node == NULL )
+        return false;
+
+    this->remove( node );
+    return true;
+}
+
+bool s11nSHA::SessionTable::snapshot( uint64_t id, SHA1& sha1_object )
+{
+    Node *node = this->own( id );
+    if( node == NULL )
+        return false;
+
+    sha1_object = node->sha1;
+    node->owned.store( false, std::memory_order_release );
+    return true;
+}
+
+size_t s11nSHA::SessionTable::size() const
+{
+    return this->live;
+}
+
+size_t s11nSHA::SessionTable::capacity() const
+{
+    return this->mask + 1;
+}
+
+size_t s11nSHA::SessionTable::max_probes() const
+{
+    return this->longest.load( std::memory_order_relaxed ) + 1;
+}
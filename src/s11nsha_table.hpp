@@ -0,0 +1,123 @@
+/**
+ *  Concurrent session table: maps 64 bit session ids to s11nSHA::SHA1
+ *  states for many threads appending to different uploads at once.
+ *
+ *  Lookups never lock: the table is open addressing over atomic keys and
+ *  atomic node pointers. Each session has one writer at a time, enforced
+ *  by an ownership flag in its node, so update() touches no shared cache
+ *  line except the slot it reads. Only begin() and the removal step of
+ *  final()/abort() take a lock, striped by id, to keep ids unique.
+ *  Finished sessions are unlinked at once but freed later, by epoch based
+ *  reclamation, once no thread can still be looking at them.
+ *
+ *  The table does not grow; removed sessions leave tombstones that later
+ *  sessions reuse. Tombstones never turn back into empty slots, so a
+ *  lookup does not stop at the first empty slot only: it also stops after
+ *  the longest distance any session was ever placed from its home slot,
+ *  which keeps misses cheap however much churn the table has seen. Ids
+ *  SESSION_ID_EMPTY and SESSION_ID_DELETED are reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_TABLE_HPP
+#define S11NSHA_TABLE_HPP
+
+// uint64_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// std::atomic
+#include <atomic>
+
+// std::mutex
+#include <mutex>
+
+// std::pair
+#include <utility>
+
+// std::vector
+#include <vector>
+
+// s11nSHA::SHA1, DIGEST_SIZE
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    const uint64_t SESSION_ID_EMPTY = ~(uint64_t) 0;
+    const uint64_t SESSION_ID_DELETED = ~(uint64_t) 1;
+
+    const unsigned int TABLE_EPOCH_SLOTS = 256;  // threads inside at once
+    const unsigned int TABLE_LOCK_STRIPES = 64;
+
+    class SessionTable
+    {
+    public:
+        // room for `capacity` sessions, rounded up to a power of two
+        explicit SessionTable( size_t capacity = 1024*64 );
+        ~SessionTable();
+
+        // start session id; false if it exists, the id is reserved or the
+        // table is full
+        bool begin( uint64_t id );
+
+        // append input to session id, waiting for its current writer (if
+        // any) to finish first; false if there is no such session
+        bool update( uint64_t id, const unsigned char *input, size_t length );
+
+        // compute the digest of session id and remove the session
+        bool final( uint64_t id, unsigned char digest[DIGEST_SIZE] );
+
+        // remove session id without computing anything
+        bool abort( uint64_t id );
+
+        // copy of the current state of session id
+        bool snapshot( uint64_t id, SHA1& sha1_object );
+
+        size_t size() const;      // live sessions
+        size_t capacity() const;  // slots
+
+        // most slots a lookup probes: one more than the longest distance a
+        // session was ever placed from its home slot
+        size_t max_probes() const;
+
+        // free removed sessions no thread can still reach; also done from
+        // time to time by final() and abort(). returns how many are left
+        size_t reclaim();
+
+    private:
+        SessionTable( const SessionTable& );
+        SessionTable& operator=( const SessionTable& );
+
+        struct Node;
+        struct Slot;
+        class Guard;
+
+        // node of live session id, or NULL; call inside a Guard
+        Node *lookup( uint64_t id ) const;
+
+        // take ownership of session id; NULL if there is no such session
+        Node *own( uint64_t id );
+
+        // unlink an owned node and hand it to reclamation
+        void remove( Node *node );
+
+        Slot *slots;
+        size_t mask;
+        std::atomic<size_t> longest;  // probe distance, only ever grows
+        std::atomic<size_t> live;
+        std::atomic<uint64_t> epoch;
+        std::atomic<uint64_t> announced[TABLE_EPOCH_SLOTS];
+        std::mutex stripes[TABLE_LOCK_STRIPES];
+        std::mutex retire_lock;
+        std::vector<std::pair<uint64_t, Node*> > retired;
+    };
+
+} // end of namespace s11nSHA
+
+#endif
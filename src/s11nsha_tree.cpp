@@ -0,0 +1,379 @@
+// g++ -Wall -c -std=c++0x -pthread s11nsha_tree.cpp
+// implementation of s11nsha_tree.hpp
+
+#include "s11nsha_tree.hpp"
+
+// s11nSHA::update_multi, MB_MAX_LANES
+#include "s11nsha_mb.hpp"
+
+// std::thread
+#include <thread>
+
+// errno, EINTR
+#include <cerrno>
+
+// open, O_RDONLY
+#include <fcntl.h>
+
+// mmap, madvise, munmap
+#include <sys/mman.h>
+
+// fstat, S_ISREG
+#include <sys/stat.h>
+
+// read, close
+#include <unistd.h>
+
+namespace
+{
+    const unsigned char LEAF_PREFIX = 0x00;
+    const unsigned char PARENT_PREFIX = 0x01;
+    const unsigned char ROOT_PREFIX = 0x02;
+    const unsigned int TREE_HEADER_BYTES = 12;
+
+    // most leaves hashed per parallel round, so the digest scratch stays
+    // small however large the input
+    const size_t LEAVES_PER_ROUND = 4096;
+
+    // non-regular files are read in pieces of this size
+    const size_t TREE_READ_BYTES = 1024*1024*4;
+
+    void parent( const unsigned char left[s11nSHA::DIGEST_SIZE],
+                 const unsigned char right[s11nSHA::DIGEST_SIZE],
+                 unsigned char digest[s11nSHA::DIGEST_SIZE] )
+    {
+        s11nSHA::SHA1 sha1;
+        sha1.update( &PARENT_PREFIX, 1 );
+        sha1.update( left, s11nSHA::DIGEST_SIZE );
+        sha1.update( right, s11nSHA::DIGEST_SIZE );
+        sha1.final( digest );
+    }
+
+    // leaf digests of count whole chunks, MB_MAX_LANES at a time so the
+    // multi-buffer kernels get to run the lanes side by side
+    void hash_leaf_range( const unsigned char *data, size_t chunk_bytes,
+                          size_t count, unsigned char *digests )
+    {
+        s11nSHA::SHA1 contexts[s11nSHA::MB_MAX_LANES];
+        s11nSHA::SHA1 *ptrs[s11nSHA::MB_MAX_LANES];
+        const unsigned char *inputs[s11nSHA::MB_MAX_LANES];
+        size_t lengths[s11nSHA::MB_MAX_LANES];
+
+        for( size_t first = 0; first < count; first += s11nSHA::MB_MAX_LANES )
+        {
+            size_t n = count - first;
+            if( n > s11nSHA::MB_MAX_LANES )
+                n = s11nSHA::MB_MAX_LANES;
+            for( size_t i = 0; i < n; ++i )
+            {
+                contexts[i].init();
+                contexts[i].update( &LEAF_PREFIX, 1 );
+                ptrs[i] = &contexts[i];
+                inputs[i] = data + ( first + i ) * chunk_bytes;
+                lengths[i] = chunk_bytes;
+            }
+            s11nSHA::update_multi( ptrs, inputs, lengths, n );
+            for( size_t i = 0; i < n; ++i )
+                contexts[i].final( digests + ( first + i ) * s11nSHA::DIGEST_SIZE );
+        }
+    }
+
+    void hash_leaves( const unsigned char *data, size_t chunk_bytes,
+                      size_t count, unsigned char *digests,
+                      unsigned int threads )
+    {
+        if( threads > count )
+            threads = (unsigned int) count;
+        if( threads <= 1 )
+        {
+            hash_leaf_range( data, chunk_bytes, count, digests );
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        size_t first = 0;
+        for( unsigned int t = 0; t < threads; ++t )
+        {
+            size_t n = count / threads + ( t < count % threads ? 1 : 0 );
+            if( t + 1 == threads )
+                hash_leaf_range( data + first * chunk_bytes, chunk_bytes, n,
+                                 digests + first * s11nSHA::DIGEST_SIZE );
+            else
+                workers.push_back( std::thread( hash_leaf_range,
+                                   data + first * chunk_bytes, chunk_bytes, n,
+                                   digests + first * s11nSHA::DIGEST_SIZE ) );
+            first += n;
+        }
+        for( size_t t = 0; t < workers.size(); ++t )
+            workers[t].join();
+    }
+
+    unsigned int popcount64( uint64_t v )
+    {
+        unsigned int n = 0;
+        for( ; v; v &= v - 1 )
+            ++n;
+        return n;
+    }
+
+} // end of anonymous namespace
+
+s11nSHA::TreeSHA1::TreeSHA1( unsigned int chunk_shift )
+    : chunk_shift( TREE_DEFAULT_CHUNK_SHIFT ), threads( 1 )
+{
+    if( !this->init( chunk_shift ) )
+        this->init( TREE_DEFAULT_CHUNK_SHIFT );
+}
+
+bool s11nSHA::TreeSHA1::init( unsigned int chunk_shift )
+{
+    if( chunk_shift < TREE_MIN_CHUNK_SHIFT || chunk_shift > TREE_MAX_CHUNK_SHIFT )
+        return false;
+
+    this->chunk_shift = chunk_shift;
+    this->total = 0;
+    this->stack.clear();
+    this->leaf.init();
+    this->leaf.update( &LEAF_PREFIX, 1 );
+    return true;
+}
+
+void s11nSHA::TreeSHA1::set_threads( unsigned int threads )
+{
+    if( threads == 0 )
+        threads = std::thread::hardware_concurrency();
+    this->threads = threads ? threads : 1;
+}
+
+uint64_t s11nSHA::TreeSHA1::length() const
+{
+    return this->total;
+}
+
+// called with total already counting the leaf; completing leaf n merges
+// as many subtrees as n has trailing zero bits
+void s11nSHA::TreeSHA1::push_leaf( const unsigned char digest[DIGEST_SIZE] )
+{
+    this->stack.insert( this->stack.end(), digest, digest + DIGEST_SIZE );
+
+    for( uint64_t n = this->total >> this->chunk_shift; ( n & 1 ) == 0; n >>= 1 )
+    {
+        size_t top = this->stack.size() - 2 * DIGEST_SIZE;
+        unsigned char merged[DIGEST_SIZE];
+        parent( &this->stack[top], &this->stack[top + DIGEST_SIZE], merged );
+        this->stack.resize( top );
+        this->stack.insert( this->stack.end(), merged, merged + DIGEST_SIZE );
+    }
+}
+
+void s11nSHA::TreeSHA1::update( const unsigned char *input, size_t length )
+{
+    const size_t chunk_bytes = (size_t) 1 << this->chunk_shift;
+    const size_t mask = chunk_bytes - 1;
+    std::vector<unsigned char> digests;
+
+    while( length > 0 )
+    {
+        size_t open = (size_t) ( this->total & mask );
+
+        if( open > 0 || length < chunk_bytes )
+        {
+            size_t take = chunk_bytes - open;
+            if( take > length )
+                take = length;
+            this->leaf.update( input, take );
+            this->total += take;
+            input += take;
+            length -= take;
+
+            if( ( this->total & mask ) == 0 )
+            {
+                unsigned char digest[DIGEST_SIZE];
+                this->leaf.final( digest );
+                this->leaf.update( &LEAF_PREFIX, 1 );
+                this->push_leaf( digest );
+            }
+            continue;
+        }
+
+        // chunk aligned with at least one whole chunk to go: hash the leaves
+        // straight from input, the open leaf stays at just its prefix
+        size_t whole = length >> this->chunk_shift;
+        if( whole > LEAVES_PER_ROUND )
+            whole = LEAVES_PER_ROUND;
+        digests.resize( whole * DIGEST_SIZE );
+        hash_leaves( input, chunk_bytes, whole, &digests[0], this->threads );
+
+        for( size_t i = 0; i < whole; ++i )
+        {
+            this->total += chunk_bytes;
+            this->push_leaf( &digests[i * DIGEST_SIZE] );
+        }
+        input += whole * chunk_bytes;
+        length -= whole * chunk_bytes;
+    }
+}
+
+void s11nSHA::TreeSHA1::final( unsigned char digest[DIGEST_SIZE] )
+{
+    const uint64_t mask = ( (uint64_t) 1 << this->chunk_shift ) - 1;
+    unsigned char node[DIGEST_SIZE];
+
+    if( ( this->total & mask ) != 0 || this->total == 0 )
+        this->leaf.final( node );
+    else
+    {
+        std::memcpy( node, &this->stack[this->stack.size() - DIGEST_SIZE],
+                     DIGEST_SIZE );
+        this->stack.resize( this->stack.size() - DIGEST_SIZE );
+    }
+
+    while( !this->stack.empty() )
+    {
+        size_t top = this->stack.size() - DIGEST_SIZE;
+        parent( &this->stack[top], node, node );
+        this->stack.resize( top );
+    }
+
+    unsigned char trailer[10];
+    trailer[0] = ROOT_PREFIX;
+    trailer[1] = (unsigned char) this->chunk_shift;
+    for( int i = 0; i < 8; ++i )
+        trailer[2 + i] = (unsigned char) ( this->total >> ( 56 - 8 * i ) );
+
+    SHA1 root;
+    root.update( trailer, sizeof( trailer ) );
+    root.update( node, DIGEST_SIZE );
+    root.final( digest );
+
+    this->init( this->chunk_shift );
+}
+
+void s11nSHA::marshall_tree( std::string& s11n_tree_object,
+                             const TreeSHA1& tree_object )
+{
+    unsigned char leaf[COMPACT_S11N_MAX_BYTES];
+    size_t leaf_bytes = marshall_compact( leaf, sizeof( leaf ),
+                                          tree_object.leaf );
+
+    s11n_tree_object.clear();
+    s11n_tree_object.reserve( TREE_HEADER_BYTES + tree_object.stack.size()
+                              + leaf_bytes );
+    s11n_tree_object.push_back( 'S' );
+    s11n_tree_object.push_back( 'T' );
+    s11n_tree_object.push_back( (char) TREE_S11N_VERSION );
+    s11n_tree_object.push_back( (char) tree_object.chunk_shift );
+    for( int i = 0; i < 8; ++i )
+        s11n_tree_object.push_back( (char) ( tree_object.total >> ( 56 - 8 * i ) ) );
+    s11n_tree_object.append( tree_object.stack.begin(), tree_object.stack.end() );
+    s11n_tree_object.append( (const char*) leaf, leaf_bytes );
+}
+
+bool s11nSHA::unmarshall_tree( const unsigned char *s11n_tree_object,
+                               size_t length, TreeSHA1& tree_object )
+{
+    const unsigned char *p = s11n_tree_object;
+
+    if( length < TREE_HEADER_BYTES || p[0] != 'S' || p[1] != 'T'
+        || p[2] != TREE_S11N_VERSION
+        || p[3] < TREE_MIN_CHUNK_SHIFT || p[3] > TREE_MAX_CHUNK_SHIFT )
+        return false;
+
+    unsigned int chunk_shift = p[3];
+    uint64_t total = 0;
+    for( int i = 0; i < 8; ++i )
+        total = ( total << 8 ) | p[4 + i];
+
+    size_t stack_bytes = popcount64( total >> chunk_shift ) * DIGEST_SIZE;
+    if( length - TREE_HEADER_BYTES < stack_bytes )
+        return false;
+
+    // the open leaf must hold the prefix plus exactly the bytes of the
+    // current chunk, and nothing may follow it
+    SHA1 leaf;
+    const unsigned char *record = p + TREE_HEADER_BYTES + stack_bytes;
+    size_t record_bytes = length - TREE_HEADER_BYTES - stack_bytes;
+    if( unmarshall_compact( record, record_bytes, leaf ) != record_bytes )
+        return false;
+
+    unsigned char check[COMPACT_S11N_MAX_BYTES];
+    uint64_t open = total & ( ( (uint64_t) 1 << chunk_shift ) - 1 );
+    uint64_t leaf_length = 0;
+    // message length of the leaf record, decoded by re-marshalling it with
+    // a fixed 8 byte length field
+    if( marshall_compact( check, sizeof( check ), leaf, false ) < 10 )
+        return false;
+    for( int i = 0; i < 8; ++i )
+        leaf_length = ( leaf_length << 8 ) | check[2 + i];
+    if( leaf_length != open + 1 )
+        return false;
+
+    tree_object.chunk_shift = chunk_shift;
+    tree_object.total = total;
+    tree_object.stack.assign( p + TREE_HEADER_BYTES,
+                              p + TREE_HEADER_BYTES + stack_bytes );
+    tree_object.leaf = leaf;
+    return true;
+}
+
+void s11nSHA::calculate_tree( const unsigned char *input, size_t length,
+                              unsigned char digest[DIGEST_SIZE],
+                              unsigned int threads, unsigned int chunk_shift )
+{
+    TreeSHA1 tree( chunk_shift );
+    tree.set_threads( threads );
+    tree.update( input, length );
+    tree.final( digest );
+}
+
+bool s11nSHA::calculate_tree( const char *path,
+                              unsigned char digest[DIGEST_SIZE],
+                              unsigned int threads, unsigned int chunk_shift )
+{
+    TreeSHA1 tree( chunk_shift );
+    struct stat st;
+    bool ok = true;
+    int fd;
+
+    if( ( fd = open( path, O_RDONLY ) ) < 0 )
+        return false;
+
+    tree.set_threads( threads );
+
+    void *p = MAP_FAILED;
+    size_t size = 0;
+    if( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 &&
+        (uint64_t) st.st_size <= SIZE_MAX )
+    {
+        size = (size_t) st.st_size;
+        p = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+
+    if( p != MAP_FAILED )
+    {
+        // leaves are read in parallel from all over the mapping, so no
+        // MADV_SEQUENTIAL here
+        madvise( p, size, MADV_WILLNEED );
+        tree.update( (const unsigned char*) p, size );
+        munmap( p, size );
+    }
+    else
+    {
+        std::vector<unsigned char> buf( TREE_READ_BYTES );
+        for( ;; )
+        {
+            ssize_t n = read( fd, &buf[0], buf.size() );
+            if( n < 0 && errno == EINTR )
+                continue;
+            if( n < 0 )
+                ok = false;
+            if( n <= 0 )
+                break;
+            tree.update( &buf[0], (size_t) n );
+        }
+    }
+
+    tree.final( digest );
+    close( fd );
+    return ok;
+}
@@ -0,0 +1,117 @@
+/**
+ *  Tree mode (Merkle) SHA-1: the message is cut into fixed size chunks
+ *  whose leaf hashes are independent, so they can be computed on many
+ *  cores, and are then combined pairwise into a single root digest.
+ *
+ *  The result is NOT the plain SHA-1 of the message; both sides have to
+ *  agree on tree mode and on the chunk size.
+ *
+ *  Format, with C = 2^chunk_shift bytes and || for concatenation:
+ *      leaf   = SHA1( 0x00 || chunk )      for every C byte chunk and the
+ *                                          final partial one (or the empty
+ *                                          chunk of an empty message)
+ *      parent = SHA1( 0x01 || left || right )
+ *      root   = SHA1( 0x02 || chunk_shift byte || uint64 BE length || top )
+ *  The tree is left-balanced: completed leaves are merged like a binary
+ *  counter (two subtrees of the same height as soon as both exist), and
+ *  at the end the remaining subtrees are folded right to left, so the
+ *  shape depends on the message length alone.
+ *
+ *  Partial state (marshall_tree), all integers big endian:
+ *      magic "ST", version, chunk_shift, uint64 length, then one 20 byte
+ *      digest per pending subtree (popcount( length / C ) of them, oldest
+ *      first), then the marshall_compact() record of the open leaf
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_TREE_HPP
+#define S11NSHA_TREE_HPP
+
+// uint64_t
+#include <cstdint>
+
+// size_t
+#include <cstring>
+
+// std::string
+#include <string>
+
+// std::vector
+#include <vector>
+
+// s11nSHA::SHA1
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    const unsigned char TREE_S11N_VERSION = 1;
+    const unsigned int TREE_MIN_CHUNK_SHIFT = 10;  // 1 KiB
+    const unsigned int TREE_MAX_CHUNK_SHIFT = 30;  // 1 GiB
+    const unsigned int TREE_DEFAULT_CHUNK_SHIFT = 20;  // 1 MiB
+
+    class TreeSHA1
+    {
+    public:
+        TreeSHA1( unsigned int chunk_shift = TREE_DEFAULT_CHUNK_SHIFT );
+
+        // restart with a new chunk size; false (and no change) if it is
+        // outside [ TREE_MIN_CHUNK_SHIFT, TREE_MAX_CHUNK_SHIFT ]
+        bool init( unsigned int chunk_shift = TREE_DEFAULT_CHUNK_SHIFT );
+
+        // worker threads for update(); 0 = hardware concurrency, 1 (the
+        // default) keeps everything on the calling thread
+        void set_threads( unsigned int threads );
+
+        // process more input; whole chunks are hashed in parallel
+        void update( const unsigned char *input, size_t length );
+
+        // compute the root digest, then restart with the same chunk size
+        void final( unsigned char digest[DIGEST_SIZE] );
+
+        // bytes processed so far
+        uint64_t length() const;
+
+    private:
+        void push_leaf( const unsigned char digest[DIGEST_SIZE] );
+
+        unsigned int chunk_shift;
+        unsigned int threads;
+        uint64_t total;
+        SHA1 leaf;                        // open chunk, 0x00 prefix included
+        std::vector<unsigned char> stack; // DIGEST_SIZE per pending subtree
+
+        friend void marshall_tree( std::string& s11n_tree_object,
+                                   const TreeSHA1& tree_object );
+        friend bool unmarshall_tree( const unsigned char *s11n_tree_object,
+                                     size_t length, TreeSHA1& tree_object );
+    }; // end of class TreeSHA1
+
+    // serialize the partial tree so that hashing can resume elsewhere
+    void marshall_tree( std::string& s11n_tree_object,
+                        const TreeSHA1& tree_object );
+
+    // restore a partial tree written by above; returns false and leaves
+    // tree_object untouched if the record is truncated or inconsistent.
+    // the thread count of tree_object is kept
+    bool unmarshall_tree( const unsigned char *s11n_tree_object, size_t length,
+                          TreeSHA1& tree_object );
+
+    // tree hash of input in one call
+    void calculate_tree( const unsigned char *input, size_t length,
+                         unsigned char digest[DIGEST_SIZE],
+                         unsigned int threads = 0,
+                         unsigned int chunk_shift = TREE_DEFAULT_CHUNK_SHIFT );
+
+    // tree hash of file contents; regular files are mapped, anything else
+    // is read. returns false if path cannot be opened or read
+    bool calculate_tree( const char *path, unsigned char digest[DIGEST_SIZE],
+                         unsigned int threads = 0,
+                         unsigned int chunk_shift = TREE_DEFAULT_CHUNK_SHIFT );
+
+} // end of namespace s11nSHA
+
+#endif
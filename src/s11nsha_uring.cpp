@@ -0,0 +1,516 @@
+// g++ -Wall -c -std=c++0x s11nsha_uring.cpp
+// implementation of s11nsha_uring.hpp
+
+#include "s11nsha_uring.hpp"
+
+// std::max
+#include <algorithm>
+
+// std::vector
+#include <vector>
+
+// errno, EINTR, EAGAIN, EBUSY
+#include <cerrno>
+
+// posix_memalign, free
+#include <cstdlib>
+
+// open, fcntl, posix_fadvise, O_RDONLY, O_DIRECT
+#include <fcntl.h>
+
+// io_uring_params, io_uring_sqe, io_uring_cqe, IORING_*
+#include <linux/io_uring.h>
+
+// mmap, munmap
+#include <sys/mman.h>
+
+// fstat, S_ISREG
+#include <sys/stat.h>
+
+// SYS_io_uring_setup, SYS_io_uring_enter, SYS_io_uring_register
+#include <sys/syscall.h>
+
+// struct iovec
+#include <sys/uio.h>
+
+// syscall, close
+#include <unistd.h>
+
+namespace
+{
+    const size_t URING_ALIGN = 4096;  // O_DIRECT buffer/offset/length unit
+
+    // there is no liburing here: the three system calls are used directly
+    int uring_setup( unsigned int entries, io_uring_params *params )
+    {
+        return (int) syscall( SYS_io_uring_setup, entries, params );
+    }
+
+    int uring_enter( int fd, unsigned int to_submit, unsigned int min_complete )
+    {
+        return (int) syscall( SYS_io_uring_enter, fd, to_submit, min_complete,
+                              min_complete ? IORING_ENTER_GETEVENTS : 0,
+                              NULL, 0 );
+    }
+
+    int uring_register( int fd, unsigned int opcode, const void *arg,
+                        unsigned int count )
+    {
+        return (int) syscall( SYS_io_uring_register, fd, opcode, arg, count );
+    }
+
+    // the submission and completion rings shared with the kernel
+    struct ring
+    {
+        ring() : fd( -1 ), sq_map( MAP_FAILED ), cq_map( MAP_FAILED ),
+                 sqe_map( MAP_FAILED ), sq_bytes( 0 ), cq_bytes( 0 ),
+                 sqe_bytes( 0 ) {}
+
+        ~ring()
+        {
+            if( sqe_map != MAP_FAILED )
+                munmap( sqe_map, sqe_bytes );
+            if( cq_map != MAP_FAILED && cq_map != sq_map )
+                munmap( cq_map, cq_bytes );
+            if( sq_map != MAP_FAILED )
+                munmap( sq_map, sq_bytes );
+            if( fd >= 0 )
+                close( fd );
+        }
+
+        bool setup( unsigned int entries )
+        {
+            io_uring_params params;
+            memset( &params, 0, sizeof( params ) );
+            fd = uring_setup( entries, &params );
+            if( fd < 0 )
+                return false;
+
+            sq_bytes = params.sq_off.array + params.sq_entries * sizeof( uint32_t );
+            cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+            if( params.features & IORING_FEAT_SINGLE_MMAP )
+                sq_bytes = cq_bytes = std::max( sq_bytes, cq_bytes );
+
+            sq_map = mmap( NULL, sq_bytes, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+            if( sq_map == MAP_FAILED )
+                return false;
+            if( params.features & IORING_FEAT_SINGLE_MMAP )
+                cq_map = sq_map;
+            else
+            {
+                cq_map = mmap( NULL, cq_bytes, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING );
+                if( cq_map == MAP_FAILED )
+                    return false;
+            }
+            sqe_bytes = params.sq_entries * sizeof( io_uring_sqe );
+            sqe_map = mmap( NULL, sqe_bytes, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+            if( sqe_map == MAP_FAILED )
+                return false;
+
+            unsigned char *sq = (unsigned char*) sq_map;
+            unsigned char *cq = (unsigned char*) cq_map;
+            sq_tail = (unsigned int*) ( sq + params.sq_off.tail );
+            sq_mask = *(unsigned int*) ( sq + params.sq_off.ring_mask );
+            sq_array = (unsigned int*) ( sq + params.sq_off.array );
+            cq_head = (unsigned int*) ( cq + params.cq_off.head );
+            cq_tail = (unsigned int*) ( cq + params.cq_off.tail );
+            cq_mask = *(unsigned int*) ( cq + params.cq_off.ring_mask );
+            cqes = (io_uring_cqe*) ( cq + params.cq_off.cqes );
+            sqes = (io_uring_sqe*) sqe_map;
+            return true;
+        }
+
+        // next free submission entry, zeroed; the caller never has more
+        // entries outstanding than the ring holds
+        io_uring_sqe *next_sqe()
+        {
+            unsigned int tail = *sq_tail;
+            unsigned int index = tail & sq_mask;
+            io_uring_sqe *sqe = &sqes[index];
+            memset( sqe, 0, sizeof( *sqe ) );
+            sq_array[index] = index;
+            __atomic_store_n( sq_tail, tail + 1, __ATOMIC_RELEASE );
+            return sqe;
+        }
+
+        int fd;
+        void *sq_map, *cq_map, *sqe_map;
+        size_t sq_bytes, cq_bytes, sqe_bytes;
+        unsigned int *sq_tail, *sq_array, sq_mask;
+        unsigned int *cq_head, *cq_tail, cq_mask;
+        io_uring_sqe *sqes;
+        io_uring_cqe *cqes;
+    };
+
+    // a read that completed ahead of the bytes before it
+    struct landed
+    {
+        uint64_t offset;
+        size_t buffer;
+        size_t length;
+    };
+
+    // a file being hashed
+    struct job
+    {
+        size_t index;
+        int fd;
+        uint64_t size;    // bytes to hash, from fstat at open
+        uint64_t next;    // offset of the next read to submit
+        uint64_t hashed;  // bytes fed into sha1 so far
+        unsigned int in_flight;
+        bool failed;
+        std::vector<landed> waiting;
+        s11nSHA::SHA1 sha1;
+    };
+
+    // what buffer i is being used for while its read is in flight
+    struct read_op
+    {
+        job *owner;
+        uint64_t offset;
+        size_t length;   // bytes of the file wanted in the buffer
+        size_t request;  // bytes asked for, rounded up for O_DIRECT
+        size_t filled;   // bytes already in the buffer after short reads
+    };
+
+    // queue a read of whatever op still lacks into the rest of its buffer
+    void submit_read( ring& r, const read_op& op, unsigned char *buffer,
+                      size_t b, bool fixed )
+    {
+        io_uring_sqe *sqe = r.next_sqe();
+        sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = op.owner->fd;
+        sqe->off = op.offset + op.filled;
+        sqe->addr = (uint64_t) (uintptr_t) ( buffer + op.filled );
+        sqe->len = (uint32_t) ( op.request - op.filled );
+        sqe->buf_index = fixed ? (uint16_t) b : 0;
+        sqe->user_data = b;
+    }
+
+    // open path for hashing; 1 = job ready, 0 = already reported, -1 = error
+    int open_job( const char *path, size_t index, bool direct_io, job& j,
+                  const s11nSHA::UringCallback& done, size_t& hashed_ok )
+    {
+        int fd = -1;
+        if( direct_io )
+            fd = open( path, O_RDONLY | O_DIRECT | O_CLOEXEC );
+        if( fd < 0 )
+            fd = open( path, O_RDONLY | O_CLOEXEC );
+        if( fd < 0 )
+            return -1;
+
+        struct stat st;
+        if( fstat( fd, &st ) != 0 )
+        {
+            close( fd );
+            return -1;
+        }
+
+        if( !S_ISREG( st.st_mode ) || st.st_size == 0 )
+        {
+            // nothing to overlap: pipes and devices have no offsets to
+            // queue reads at, and an empty file is done already
+            close( fd );
+            s11nSHA::SHA1 sha1;
+            unsigned char digest[s11nSHA::DIGEST_SIZE];
+            if( !sha1.calculate( path, digest ) )
+                return -1;
+            ++hashed_ok;
+            done( index, true, digest );
+            return 0;
+        }
+
+        j.index = index;
+        j.fd = fd;
+        j.size = (uint64_t) st.st_size;
+        j.next = j.hashed = 0;
+        j.in_flight = 0;
+        j.failed = false;
+        j.waiting.clear();
+        j.sha1.init();
+        posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+        return 1;
+    }
+
+    size_t hash_files_blocking( const char *const paths[], size_t count,
+                                const s11nSHA::UringCallback& done )
+    {
+        size_t hashed_ok = 0;
+        unsigned char digest[s11nSHA::DIGEST_SIZE];
+        for( size_t i = 0; i < count; ++i )
+        {
+            s11nSHA::SHA1 sha1;
+            bool ok = sha1.calculate( paths[i], digest );
+            if( ok )
+                ++hashed_ok;
+            done( i, ok, digest );
+        }
+        return hashed_ok;
+    }
+
+} // end of anonymous namespace
+
+bool s11nSHA::uring_available()
+{
+    ring r;
+    return r.setup( 1 );
+}
+
+size_t s11nSHA::hash_files_uring( const char *const paths[], size_t count,
+                                  const UringCallback& done,
+                                  const UringOptions& options )
+{
+    unsigned int depth = options.queue_depth ? options.queue_depth : 1;
+    unsigned int open_files = options.open_files ? options.open_files : 1;
+    size_t buffer_bytes = options.buffer_bytes ? options.buffer_bytes : 1;
+    buffer_bytes = ( buffer_bytes + URING_ALIGN - 1 ) & ~( URING_ALIGN - 1 );
+
+    ring r;
+    if( count == 0 || !r.setup( depth ) )
+        return hash_files_blocking( paths, count, done );
+
+    // one buffer per queue slot, so the submission ring can never overflow
+    std::vector<unsigned char*> buffers( depth, (unsigned char*) NULL );
+    std::vector<size_t> free_buffers;
+    std::vector<read_op> ops( depth );
+    for( unsigned int i = 0; i < depth; ++i )
+    {
+        void *p;
+        if( posix_memalign( &p, URING_ALIGN, buffer_bytes ) != 0 )
+        {
+            for( unsigned int k = 0; k < i; ++k )
+                free( buffers[k] );
+            return hash_files_blocking( paths, count, done );
+        }
+        buffers[i] = (unsigned char*) p;
+        free_buffers.push_back( depth - 1 - i );
+    }
+
+    // registered buffers save the kernel mapping pages for every read, but
+    // count against RLIMIT_MEMLOCK; plain reads are used if that fails
+    bool fixed = false;
+    if( options.register_buffers )
+    {
+        std::vector<iovec> iov( depth );
+        for( unsigned int i = 0; i < depth; ++i )
+        {
+            iov[i].iov_base = buffers[i];
+            iov[i].iov_len = buffer_bytes;
+        }
+        fixed = uring_register( r.fd, IORING_REGISTER_BUFFERS,
+                                &iov[0], depth ) == 0;
+    }
+
+    std::vector<job> jobs( open_files );
+    std::vector<job*> active;
+    std::vector<job*> idle;
+    for( unsigned int i = 0; i < open_files; ++i )
+        idle.push_back( &jobs[i] );
+
+    size_t next_path = 0;
+    size_t hashed_ok = 0;
+    size_t turn = 0;         // round robin position in active
+    unsigned int queued = 0; // prepared but not yet submitted
+    unsigned int in_flight = 0;
+
+    for( ;; )
+    {
+        // keep open_files files on the go
+        while( !idle.empty() && next_path < count )
+        {
+            job *j = idle.back();
+            size_t index = next_path++;
+            int opened = open_job( paths[index], index, options.direct_io,
+                                   *j, done, hashed_ok );
+            if( opened < 0 )
+                done( index, false, NULL );
+            else if( opened > 0 )
+            {
+                idle.pop_back();
+                active.push_back( j );
+            }
+        }
+
+        if( active.empty() )
+            break;
+
+        // hand every free buffer to the next file that still has unread
+        // bytes, round robin, so one large file does not starve the others
+        for( size_t scanned = 0;
+             !free_buffers.empty() && scanned < active.size(); )
+        {
+            job *j = active[turn++ % active.size()];
+            if( j->failed || j->next >= j->size )
+            {
+                ++scanned;
+                continue;
+            }
+            scanned = 0;
+
+            size_t b = free_buffers.back();
+            free_buffers.pop_back();
+            uint64_t left = j->size - j->next;
+            size_t length = left < buffer_bytes ? (size_t) left : buffer_bytes;
+            // O_DIRECT lengths must be aligned too; the read just stops at EOF
+            size_t request = ( length + URING_ALIGN - 1 ) & ~( URING_ALIGN - 1 );
+            if( request > buffer_bytes )
+                request = buffer_bytes;
+
+            ops[b].owner = j;
+            ops[b].offset = j->next;
+            ops[b].length = length;
+            ops[b].request = request;
+            ops[b].filled = 0;
+            submit_read( r, ops[b], buffers[b], b, fixed );
+            j->next += length;
+            ++j->in_flight;
+            ++queued;
+        }
+
+        // submit what was prepared and wait for at least one completion
+        if( queued + in_flight == 0 )
+            break;
+        int submitted = uring_enter( r.fd, queued, 1 );
+        if( submitted < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            // the kernel is short of memory or the completion queue
+            // overflowed: reap what has completed, then try again
+            if( ( errno != EAGAIN && errno != EBUSY ) || in_flight == 0 )
+                break;
+            submitted = 0;
+        }
+        in_flight += (unsigned int) submitted;
+        queued -= (unsigned int) submitted;
+
+        unsigned int head = *r.cq_head;
+        unsigned int tail = __atomic_load_n( r.cq_tail, __ATOMIC_ACQUIRE );
+        for( ; head != tail; ++head )
+        {
+            const io_uring_cqe& cqe = r.cqes[head & r.cq_mask];
+            size_t b = (size_t) cqe.user_data;
+            read_op& op = ops[b];
+            job *j = op.owner;
+            --in_flight;
+
+            if( cqe.res > 0 )
+                op.filled += (size_t) cqe.res;
+
+            // a short read is a legal completion: ask again for the rest.
+            // an O_DIRECT remainder that does not start on a block boundary
+            // is read through the page cache instead
+            if( ( cqe.res > 0 || cqe.res == -EAGAIN || cqe.res == -EINTR )
+                && op.filled < op.length && !j->failed )
+            {
+                if( op.filled % URING_ALIGN != 0 )
+                {
+                    int flags = fcntl( j->fd, F_GETFL );
+                    if( flags >= 0 && ( flags & O_DIRECT ) )
+                        fcntl( j->fd, F_SETFL, flags & ~O_DIRECT );
+                }
+                submit_read( r, op, buffers[b], b, fixed );
+                ++queued;
+                continue;
+            }
+            --j->in_flight;
+
+            if( op.filled < op.length )
+            {
+                // error, or end of file before fstat's size: it shrank
+                j->failed = true;
+                free_buffers.push_back( b );
+            }
+            else
+            {
+                landed l = { op.offset, b, op.length };
+                j->waiting.push_back( l );
+            }
+
+            // feed everything that is now contiguous with what was hashed
+            for( bool fed = true; fed && !j->failed; )
+            {
+                fed = false;
+                for( size_t k = 0; k < j->waiting.size(); ++k )
+                {
+                    landed l = j->waiting[k];
+                    if( l.offset != j->hashed )
+                        continue;
+                    j->sha1.update( buffers[l.buffer], l.length );
+                    j->hashed += l.length;
+                    free_buffers.push_back( l.buffer );
+                    j->waiting[k] = j->waiting.back();
+                    j->waiting.pop_back();
+                    fed = true;
+                    break;
+                }
+            }
+
+            if( j->in_flight > 0 || ( !j->failed && j->hashed < j->size ) )
+                continue;
+
+            // the file is finished, one way or the other
+            for( size_t k = 0; k < j->waiting.size(); ++k )
+                free_buffers.push_back( j->waiting[k].buffer );
+            j->waiting.clear();
+            close( j->fd );
+            if( j->failed )
+                done( j->index, false, NULL );
+            else
+            {
+                unsigned char digest[DIGEST_SIZE];
+                j->sha1.final( digest );
+                ++hashed_ok;
+                done( j->index, true, digest );
+            }
+            for( size_t k = 0; k < active.size(); ++k )
+                if( active[k] == j )
+                {
+                    active.erase( active.begin() + k );
+                    break;
+                }
+            idle.push_back( j );
+        }
+        __atomic_store_n( r.cq_head, head, __ATOMIC_RELEASE );
+    }
+
+    // only reached with reads in flight if io_uring_enter failed outright:
+    // the kernel may still be writing into those buffers, so wait for
+    // every completion before a buffer is unregistered or freed
+    bool drained = true;
+    while( in_flight > 0 )
+    {
+        if( uring_enter( r.fd, 0, 1 ) < 0 && errno != EINTR
+            && errno != EAGAIN && errno != EBUSY )
+        {
+            drained = false;
+            break;
+        }
+        unsigned int head = *r.cq_head;
+        unsigned int tail = __atomic_load_n( r.cq_tail, __ATOMIC_ACQUIRE );
+        in_flight -= tail - head;
+        __atomic_store_n( r.cq_head, tail, __ATOMIC_RELEASE );
+    }
+
+    for( size_t k = 0; k < active.size(); ++k )
+    {
+        close( active[k]->fd );
+        done( active[k]->index, false, NULL );
+    }
+    for( ; next_path < count; ++next_path )
+        done( next_path, false, NULL );
+
+    // if even waiting failed, leaking the buffers is the only safe choice
+    if( drained )
+    {
+        if( fixed )
+            uring_register( r.fd, IORING_UNREGISTER_BUFFERS, NULL, 0 );
+        for( unsigned int i = 0; i < depth; ++i )
+            free( buffers[i] );
+    }
+    return hashed_ok;
+}
@@ -0,0 +1,61 @@
+/**
+ *  io_uring file hashing: hash many files at once with a shared queue of
+ *  asynchronous reads, feeding completed buffers (in file order) into one
+ *  s11nSHA::SHA1 per file and reporting each digest as its file finishes.
+ *
+ *  Linux only. If io_uring is unavailable (old kernel, seccomp) every file
+ *  is hashed with SHA1::calculate() instead, with the same callbacks.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef S11NSHA_URING_HPP
+#define S11NSHA_URING_HPP
+
+// size_t
+#include <cstring>
+
+// std::function
+#include <functional>
+
+// s11nSHA::SHA1, DIGEST_SIZE
+#include "s11nsha.hpp"
+
+namespace s11nSHA
+{
+    struct UringOptions
+    {
+        UringOptions() : queue_depth( 64 ), buffer_bytes( 1024*256 ),
+                         open_files( 32 ), register_buffers( false ),
+                         direct_io( false ) {}
+
+        unsigned int queue_depth;  // reads in flight, one buffer each
+        size_t buffer_bytes;       // bytes per read, rounded up to 4 KiB
+        unsigned int open_files;   // files hashed concurrently
+        bool register_buffers;     // IORING_REGISTER_BUFFERS + READ_FIXED
+        bool direct_io;            // O_DIRECT where the filesystem allows
+    };
+
+    // called once per path, in completion order, with its index in paths[];
+    // digest is only valid when ok is true
+    typedef std::function<void ( size_t index, bool ok,
+                                 const unsigned char digest[DIGEST_SIZE] )>
+            UringCallback;
+
+    // hash every file in paths[0 .. count); returns the number of files
+    // hashed successfully. non-regular files (pipes, devices) are hashed
+    // with a blocking SHA1::calculate(). a regular file is hashed up to
+    // the size it had when it was opened
+    size_t hash_files_uring( const char *const paths[], size_t count,
+                             const UringCallback& done,
+                             const UringOptions& options = UringOptions() );
+
+    // true if this kernel lets us set up an io_uring
+    bool uring_available();
+
+} // end of namespace s11nSHA
+
+#endif
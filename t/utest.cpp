@@ -2,7 +2,7 @@
 
  BUILD AND EXECUTE
  =================
- $ g++ -Wall -std=c++0x -O3 -I../src -o utest utest.cpp ../src/pushoversha1.cpp ../src/s11nsha.cpp -lcryptopp -lboost_serialization -lgtest
+ $ g++ -Wall -std=c++0x -O3 -I../src -o utest utest.cpp ../src/pushoversha1.cpp ../src/s11nsha.cpp ../src/s11nsha_dispatch.cpp ../src/s11nsha_shani.cpp ../src/s11nsha_simd.cpp ../src/s11nsha_mb.cpp ../src/s11nsha_batch.cpp ../src/s11nsha_store.cpp ../src/s11nsha_pipeline.cpp ../src/s11nsha_uring.cpp ../src/s11nsha_files.cpp ../src/s11nsha_tree.cpp ../src/s11nsha_session.cpp ../src/s11nsha_table.cpp ../src/s11nsha_prefix.cpp ../src/s11nsha_hmac.cpp ../src/s11nsha_pbkdf2.cpp ../src/s11nsha_stream.cpp ../src/s11nsha_incremental.cpp ../src/s11nsha_splice.cpp ../src/s11nsha_git.cpp ../src/s11nsha_cdc.cpp -lcryptopp -lboost_serialization -lgtest -pthread
  $ ./utest
 
  USEFUL FLAGS
@@ -15,6 +15,24 @@
 
 // classes to be tested
 #include "s11nsha.hpp"
+#include "s11nsha_kernels.hpp"
+#include "s11nsha_mb.hpp"
+#include "s11nsha_batch.hpp"
+#include "s11nsha_store.hpp"
+#include "s11nsha_pipeline.hpp"
+#include "s11nsha_uring.hpp"
+#include "s11nsha_files.hpp"
+#include "s11nsha_tree.hpp"
+#include "s11nsha_session.hpp"
+#include "s11nsha_table.hpp"
+#include "s11nsha_prefix.hpp"
+#include "s11nsha_hmac.hpp"
+#include "s11nsha_pbkdf2.hpp"
+#include "s11nsha_stream.hpp"
+#include "s11nsha_incremental.hpp"
+#include "s11nsha_splice.hpp"
+#include "s11nsha_git.hpp"
+#include "s11nsha_cdc.hpp"
 
 //std::cout, std::endl
 #include <iostream>
@@ -22,12 +40,45 @@
 // std::string
 #include <string>
 
+// std::ofstream
+#include <fstream>
+
+// std::vector
+#include <vector>
+
+// std::find
+#include <algorithm>
+
 // std::rand, std::srand
 #include <cstdlib>
 
+// std::remove
+#include <cstdio>
+
 // std::time
 #include <ctime>
 
+// std::thread
+#include <thread>
+
+// std::stringbuf
+#include <sstream>
+
+// std::set
+#include <set>
+
+// socketpair, shutdown
+#include <sys/socket.h>
+
+// pipe, read, write, close
+#include <unistd.h>
+
+// open, O_APPEND, AT_FDCWD
+#include <fcntl.h>
+
+// mkdir, chmod, utimensat
+#include <sys/stat.h>
+
 // CryptoPP::SHA1
 #include <cryptopp/sha.h>
 
@@ -140,6 +191,898 @@ TEST(s11nsha, updateAndfinalWithRandomStringArg)
     EXPECT_TRUE( s11n_hexencoded == crypto_hexencoded ); 
 }
 
+// scatter-gather update matches hashing the concatenation
+TEST(s11nsha, updateWithSegments)
+{
+    s11nSHA::SHA1 s11n_sha1;
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    unsigned char iov_digest[ s11nSHA::DIGEST_SIZE ];
+
+    std::srand(std::time(0));
+
+    for( int count = 0; count < 50; ++count )
+    {
+        std::string plain = generate_random_string(std::rand() % (1024*64));
+        s11n_sha1.calculate((byte*)plain.data(), plain.size(), s11n_digest);
+
+        // segments of every size, empty ones included, copied apart so
+        // that no two are adjacent in memory
+        std::vector<std::string> pieces;
+        for( size_t i = 0; i < plain.size(); )
+        {
+            size_t n = std::min<size_t>(std::rand() % 3 == 0 ? std::rand() % 300
+                                                             : std::rand() % 70, plain.size() - i);
+            pieces.push_back(plain.substr(i, n));
+            i += n;
+        }
+        std::vector<struct iovec> segments(pieces.size());
+        for( size_t i = 0; i < pieces.size(); ++i )
+        {
+            segments[i].iov_base = (void*) pieces[i].data();
+            segments[i].iov_len = pieces[i].size();
+        }
+
+        s11n_sha1.update(segments.empty() ? NULL : &segments[0], segments.size());
+        s11n_sha1.final(iov_digest);
+        EXPECT_EQ(0, std::memcmp(s11n_digest, iov_digest, sizeof(s11n_digest)));
+
+        // adjacent segments of one buffer are coalesced
+        size_t offset = 0;
+        for( size_t i = 0; i < segments.size(); ++i )
+        {
+            segments[i].iov_base = (void*) ( plain.data() + offset );
+            offset += segments[i].iov_len;
+        }
+        s11n_sha1.update(segments.empty() ? NULL : &segments[0], segments.size());
+        s11n_sha1.final(iov_digest);
+        EXPECT_EQ(0, std::memcmp(s11n_digest, iov_digest, sizeof(s11n_digest)));
+    }
+}
+
+// sha1 of file contents, mmap'd regular files and read() for the rest
+TEST(s11nsha, calculateWithFileArg)
+{
+    std::string path = "/tmp/s11nsha_file_" + generate_random_string(12);
+    s11nSHA::SHA1 s11n_sha1;
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    unsigned char file_digest[ s11nSHA::DIGEST_SIZE ];
+
+    std::srand(std::time(0));
+
+    for( int count = 1; count <= 5; ++count)
+    {
+        std::string plain = generate_random_string(std::rand() % (1024*1024*9));
+        std::ofstream(path.c_str(), std::ios::binary) << plain;
+
+        s11n_sha1.calculate((byte*)plain.data(), plain.size(), s11n_digest );
+        EXPECT_TRUE(s11n_sha1.calculate(path.c_str(), file_digest));
+        EXPECT_EQ(0, std::memcmp(s11n_digest, file_digest, sizeof(s11n_digest)));
+    }
+
+    // empty regular file and a character device take the read() path
+    std::ofstream(path.c_str(), std::ios::binary | std::ios::trunc);
+    s11n_sha1.calculate((byte*)"", 0, s11n_digest );
+    EXPECT_TRUE(s11n_sha1.calculate(path.c_str(), file_digest));
+    EXPECT_EQ(0, std::memcmp(s11n_digest, file_digest, sizeof(s11n_digest)));
+    EXPECT_TRUE(s11n_sha1.calculate("/dev/null", file_digest));
+    EXPECT_EQ(0, std::memcmp(s11n_digest, file_digest, sizeof(s11n_digest)));
+
+    std::remove(path.c_str());
+    EXPECT_FALSE(s11n_sha1.calculate(path.c_str(), file_digest));
+}
+
+// pipelined file hashing matches calculate(), for any ring geometry
+TEST(s11nsha, calculatePipelinedWithFileArg)
+{
+    std::string path = "/tmp/s11nsha_pipeline_" + generate_random_string(12);
+    s11nSHA::SHA1 s11n_sha1;
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    unsigned char file_digest[ s11nSHA::DIGEST_SIZE ];
+
+    std::srand(std::time(0));
+
+    for( int count = 1; count <= 5; ++count)
+    {
+        std::string plain = generate_random_string(std::rand() % (1024*1024*9));
+        std::ofstream(path.c_str(), std::ios::binary) << plain;
+        s11n_sha1.calculate((byte*)plain.data(), plain.size(), s11n_digest );
+
+        s11nSHA::PipelineOptions options;
+        options.buffers = count;
+        options.buffer_bytes = 4096 * (std::rand() % 300 + 1);
+        s11nSHA::PipelineStats stats;
+
+        EXPECT_TRUE(s11nSHA::calculate_pipelined(path.c_str(), file_digest, options, &stats));
+        EXPECT_EQ(0, std::memcmp(s11n_digest, file_digest, sizeof(s11n_digest)));
+        EXPECT_EQ(plain.size(), stats.bytes);
+        EXPECT_GE(stats.wall_seconds, stats.hash_seconds);
+    }
+
+    std::remove(path.c_str());
+    EXPECT_FALSE(s11nSHA::calculate_pipelined(path.c_str(), file_digest));
+}
+
+// io_uring file hashing matches calculate(), with and without fixed buffers and O_DIRECT
+TEST(s11nsha, hashFilesUring)
+{
+    const size_t files = 7;
+    std::string base = "/tmp/s11nsha_uring_" + generate_random_string(12);
+    std::vector<std::string> paths;
+    std::vector<const char*> path_ptrs;
+    unsigned char expected[ files ][ s11nSHA::DIGEST_SIZE ];
+    s11nSHA::SHA1 s11n_sha1;
+
+    std::srand(std::time(0));
+
+    for( size_t i = 0; i < files; ++i )
+    {
+        paths.push_back(base + "_" + std::to_string(i));
+        // include an empty file and a missing one
+        if( i == files - 1 )
+            continue;
+        std::string plain = i == 0 ? std::string() :
+                            generate_random_string(std::rand() % (1024*1024*3));
+        std::ofstream(paths[i].c_str(), std::ios::binary) << plain;
+        s11n_sha1.calculate((byte*)plain.data(), plain.size(), expected[i]);
+    }
+    for( size_t i = 0; i < files; ++i )
+        path_ptrs.push_back(paths[i].c_str());
+
+    for( int round = 0; round < 4; ++round )
+    {
+        s11nSHA::UringOptions options;
+        options.queue_depth = 1 + std::rand() % 16;
+        options.buffer_bytes = 4096 * (std::rand() % 64 + 1);
+        options.open_files = 1 + std::rand() % 4;
+        options.register_buffers = round & 1;
+        options.direct_io = round & 2;
+
+        std::vector<int> seen( files, 0 );
+        size_t hashed = s11nSHA::hash_files_uring(&path_ptrs[0], files,
+            [&]( size_t index, bool ok, const unsigned char *digest )
+            {
+                ++seen[index];
+                EXPECT_EQ(index != files - 1, ok);
+                if( ok )
+                {
+                    EXPECT_EQ(0, std::memcmp(expected[index], digest, s11nSHA::DIGEST_SIZE));
+                }
+            }, options);
+
+        EXPECT_EQ(files - 1, hashed);
+        for( size_t i = 0; i < files; ++i )
+            EXPECT_EQ(1, seen[i]);
+    }
+
+    for( size_t i = 0; i < files; ++i )
+        std::remove(paths[i].c_str());
+}
+
+// work stealing multi-file hashing matches calculate() and reports the missing file
+TEST(s11nsha, hashFilesParallel)
+{
+    const size_t files = 40;
+    std::string base = "/tmp/s11nsha_files_" + generate_random_string(12);
+    std::vector<std::string> paths;
+    std::vector<const char*> path_ptrs;
+    unsigned char expected[ files ][ s11nSHA::DIGEST_SIZE ];
+    s11nSHA::SHA1 s11n_sha1;
+
+    std::srand(std::time(0));
+
+    // a few large files among many small ones, and a missing one
+    for( size_t i = 0; i < files; ++i )
+    {
+        paths.push_back(base + "_" + std::to_string(i));
+        if( i == 7 )
+            continue;
+        size_t length = i % 10 == 0 ? 1024*1024 + std::rand() % (1024*1024*2)
+                                    : std::rand() % (1024*64);
+        std::string plain = generate_random_string(length);
+        std::ofstream(paths[i].c_str(), std::ios::binary) << plain;
+        s11n_sha1.calculate((byte*)plain.data(), plain.size(), expected[i]);
+    }
+    for( size_t i = 0; i < files; ++i )
+        path_ptrs.push_back(paths[i].c_str());
+
+    for( unsigned int threads = 1; threads <= 5; ++threads )
+    {
+        s11nSHA::HashFilesOptions options;
+        options.threads = threads;
+        options.large_file_bytes = 1024*1024;
+        options.batch_bytes = 1024*128;
+        options.batch_files = 4;
+
+        std::vector<s11nSHA::FileResult> results( files );
+        EXPECT_EQ(files - 1, s11nSHA::hash_files(&path_ptrs[0], files, &results[0], options));
+
+        for( size_t i = 0; i < files; ++i )
+        {
+            EXPECT_EQ(i != 7, results[i].ok);
+            if( results[i].ok )
+            {
+                EXPECT_EQ(0, std::memcmp(expected[i], results[i].digest, s11nSHA::DIGEST_SIZE));
+            }
+        }
+        EXPECT_EQ(ENOENT, results[7].error);
+    }
+
+    for( size_t i = 0; i < files; ++i )
+        std::remove(paths[i].c_str());
+}
+
+// tree hash is the same serial, parallel and resumed from a marshalled state
+TEST(s11nsha, treeHashParallelAndResume)
+{
+    s11nSHA::TreeSHA1 tree( 10 );
+    unsigned char serial[ s11nSHA::DIGEST_SIZE ];
+    unsigned char parallel[ s11nSHA::DIGEST_SIZE ];
+    unsigned char resumed[ s11nSHA::DIGEST_SIZE ];
+    std::string s11n_tree;
+
+    std::srand(std::time(0));
+
+    // hand computed: one chunk, so root = SHA1( 0x02 || shift || length || leaf )
+    unsigned char leaf[ s11nSHA::DIGEST_SIZE ];
+    unsigned char root_input[ 10 + s11nSHA::DIGEST_SIZE ] = { 0x02, 10, 0, 0, 0, 0, 0, 0, 0, 3 };
+    unsigned char leaf_input[ 4 ] = { 0x00, 'a', 'b', 'c' };
+    s11nSHA::SHA1 s11n_sha1;
+    s11n_sha1.calculate(leaf_input, sizeof(leaf_input), leaf);
+    std::memcpy(root_input + 10, leaf, sizeof(leaf));
+    s11n_sha1.calculate(root_input, sizeof(root_input), serial);
+    tree.update((const byte*)"abc", 3);
+    tree.final(parallel);
+    EXPECT_EQ(0, std::memcmp(serial, parallel, sizeof(serial)));
+
+    for( int count = 0; count < 10; ++count)
+    {
+        std::string plain = generate_random_string(std::rand() % (1024*300));
+        const byte *data = (const byte*)plain.data();
+
+        // byte at a time on one thread vs. one call on many
+        tree.set_threads(1);
+        for( size_t i = 0; i < plain.size(); ++i )
+            tree.update(data + i, 1);
+        tree.final(serial);
+        s11nSHA::calculate_tree(data, plain.size(), parallel, 1 + count % 6, 10);
+        EXPECT_EQ(0, std::memcmp(serial, parallel, sizeof(serial)));
+
+        // checkpoint at a random point and finish in a fresh object
+        size_t cut = plain.empty() ? 0 : std::rand() % plain.size();
+        tree.update(data, cut);
+        s11nSHA::marshall_tree(s11n_tree, tree);
+        s11nSHA::TreeSHA1 restored( 20 );
+        restored.set_threads(4);
+        EXPECT_TRUE(s11nSHA::unmarshall_tree((const byte*)s11n_tree.data(), s11n_tree.size(), restored));
+        EXPECT_EQ(cut, restored.length());
+        restored.update(data + cut, plain.size() - cut);
+        restored.final(resumed);
+        tree.init(10);
+        EXPECT_EQ(0, std::memcmp(serial, resumed, sizeof(serial)));
+
+        EXPECT_FALSE(s11nSHA::unmarshall_tree((const byte*)s11n_tree.data(), s11n_tree.size() - 1, restored));
+    }
+
+    // file version
+    std::string path = "/tmp/s11nsha_tree_" + generate_random_string(12);
+    std::string plain = generate_random_string(1024*1024*3 + 17);
+    std::ofstream(path.c_str(), std::ios::binary) << plain;
+    s11nSHA::calculate_tree((const byte*)plain.data(), plain.size(), serial, 1);
+    EXPECT_TRUE(s11nSHA::calculate_tree(path.c_str(), parallel, 4));
+    EXPECT_EQ(0, std::memcmp(serial, parallel, sizeof(serial)));
+    std::remove(path.c_str());
+    EXPECT_FALSE(s11nSHA::calculate_tree(path.c_str(), parallel));
+}
+
+// forks of cached prefixes hash like the whole message, with LRU hits and misses
+TEST(s11nsha, prefixCacheFork)
+{
+    s11nSHA::PrefixCache cache( 4 );
+    s11nSHA::SHA1 s11n_sha1, forked;
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    unsigned char forked_digest[ s11nSHA::DIGEST_SIZE ];
+
+    std::srand(std::time(0));
+
+    std::vector<std::string> prefixes;
+    for( int i = 0; i < 6; ++i )
+        prefixes.push_back(generate_random_string(std::rand() % 300));
+
+    // the same prefix again is a hit, and forks are independent copies
+    for( int round = 0; round < 2; ++round )
+        for( int i = 0; i < 3; ++i )
+        {
+            std::string body = generate_random_string(std::rand() % 1000);
+            std::string message = prefixes[i] + body;
+            cache.fork((byte*)prefixes[i].data(), prefixes[i].size(), forked);
+            forked.update((byte*)body.data(), body.size());
+            forked.final(forked_digest);
+            s11n_sha1.calculate((byte*)message.data(), message.size(), s11n_digest);
+            EXPECT_EQ(0, std::memcmp(s11n_digest, forked_digest, sizeof(s11n_digest)));
+        }
+    EXPECT_EQ(3u, cache.misses());
+    EXPECT_EQ(3u, cache.hits());
+
+    // identity keys, e.g. a git blob header for a given length
+    std::string header = std::string("blob 42") + '\0';
+    s11n_sha1.update((byte*)header.data(), header.size());
+    cache.insert("blob 42", s11n_sha1);
+    s11n_sha1.init();
+    EXPECT_TRUE(cache.find("blob 42", forked));
+    EXPECT_FALSE(cache.find("blob 43", forked));
+    EXPECT_EQ(4u, cache.size());
+
+    // bounded: the least recently used entries go first
+    for( int i = 3; i < 6; ++i )
+        cache.fork((byte*)prefixes[i].data(), prefixes[i].size(), forked);
+    EXPECT_EQ(4u, cache.size());
+    EXPECT_EQ(3u, cache.evictions());
+    EXPECT_TRUE(cache.find("blob 42", forked));
+    uint64_t misses = cache.misses();
+    cache.fork((byte*)prefixes[0].data(), prefixes[0].size(), forked);
+    EXPECT_EQ(misses + 1, cache.misses());
+
+    cache.clear();
+    EXPECT_EQ(0u, cache.size());
+}
+
+// HMAC-SHA1 matches the RFC 2202 vectors and resumes from a marshalled state
+TEST(s11nsha, hmacRfc2202AndResume)
+{
+    unsigned char mac[ s11nSHA::DIGEST_SIZE ];
+    unsigned char resumed_mac[ s11nSHA::DIGEST_SIZE ];
+    std::string hexencoded;
+
+    // RFC 2202 test cases 1, 2 and 6 (key longer than a block)
+    std::string key1(20, '\x0b'), key6(80, '\xaa');
+    s11nSHA::HMAC_SHA1 hmac((const byte*)key1.data(), key1.size());
+    hmac.calculate((const byte*)"Hi There", 8, mac);
+    ::encodeHex(hexencoded, mac, sizeof(mac));
+    EXPECT_EQ(0, hexencoded.compare("B617318655057264E28BC0B6FB378C8EF146BE00"));
+
+    hmac.set_key((const byte*)"Jefe", 4);
+    hmac.calculate((const byte*)"what do ya want for nothing?", 28, mac);
+    hexencoded.clear();
+    ::encodeHex(hexencoded, mac, sizeof(mac));
+    EXPECT_EQ(0, hexencoded.compare("EFFCDF6AE5EB2FA2D27416D5F184DF9C259A7C79"));
+
+    std::string data6 = "Test Using Larger Than Block-Size Key - Hash Key First";
+    hmac.set_key((const byte*)key6.data(), key6.size());
+    hmac.calculate((const byte*)data6.data(), data6.size(), mac);
+    hexencoded.clear();
+    ::encodeHex(hexencoded, mac, sizeof(mac));
+    EXPECT_EQ(0, hexencoded.compare("AA4AE5E15272D00E95705637CE8A3B55ED402112"));
+
+    // checkpoint a MAC stream half way through, in both archive formats
+    std::srand(std::time(0));
+    std::string plain = generate_random_string(std::rand() % (1024*64) + 1);
+    size_t cut = std::rand() % plain.size();
+    hmac.calculate((const byte*)plain.data(), plain.size(), mac);
+    for( int binary = 0; binary < 2; ++binary )
+    {
+        std::string s11n_hmac;
+        s11nSHA::HMAC_SHA1 resumed;
+        hmac.update((const byte*)plain.data(), cut);
+        s11nSHA::marshall(s11n_hmac, hmac, binary);
+        hmac.init();
+        s11nSHA::unmarshall(s11n_hmac, resumed, binary);
+        resumed.update((const byte*)plain.data() + cut, plain.size() - cut);
+        resumed.final(resumed_mac);
+        EXPECT_EQ(0, std::memcmp(mac, resumed_mac, sizeof(mac)));
+
+        // the key states travel along, so the next message works too
+        resumed.calculate((const byte*)"Hi", 2, resumed_mac);
+        hmac.calculate((const byte*)"Hi", 2, mac);
+        EXPECT_EQ(0, std::memcmp(mac, resumed_mac, sizeof(mac)));
+        hmac.calculate((const byte*)plain.data(), plain.size(), mac);
+    }
+}
+
+// PBKDF2-HMAC-SHA1 matches the RFC 6070 vectors, one password or many at once
+TEST(s11nsha, pbkdf2Rfc6070AndMulti)
+{
+    unsigned char key[ 25 ];
+    std::string hexencoded;
+
+    // RFC 6070 test vectors
+    struct { const char *password, *salt; uint32_t iterations; size_t length; const char *hex; } vectors[] = {
+        { "password", "salt", 1, 20, "0C60C80F961F0E71F3A9B524AF6012062FE037A6" },
+        { "password", "salt", 2, 20, "EA6C014DC72D6F8CCD1ED92ACE1D41F0D8DE8957" },
+        { "password", "salt", 4096, 20, "4B007901B765489ABEAD49D926F721D065A429C1" },
+        { "passwordPASSWORDpassword", "saltSALTsaltSALTsaltSALTsaltSALTsalt", 4096, 25,
+          "3D2EEC4FE41C849B80C8D83662C0E44A8B291A964CF2F07038" },
+    };
+    for( size_t v = 0; v < sizeof(vectors) / sizeof(vectors[0]); ++v )
+    {
+        s11nSHA::pbkdf2_hmac_sha1((const byte*)vectors[v].password, std::strlen(vectors[v].password),
+                                  (const byte*)vectors[v].salt, std::strlen(vectors[v].salt),
+                                  vectors[v].iterations, key, vectors[v].length);
+        hexencoded.clear();
+        ::encodeHex(hexencoded, key, vectors[v].length);
+        EXPECT_EQ(0, hexencoded.compare(vectors[v].hex));
+    }
+    EXPECT_FALSE(s11nSHA::pbkdf2_hmac_sha1_verify((const byte*)"password", 8, (const byte*)"salt", 4, 2,
+                                                  key, 0));
+
+    // one iteration is HMAC( password, salt || INT( 1 ) ), for salts on
+    // both sides of the padding boundaries
+    for( size_t salt_length = 0; salt_length < 140; ++salt_length )
+    {
+        std::string password = generate_random_string(std::rand() % 100);
+        std::string salt = generate_random_string(salt_length) + std::string("\0\0\0\1", 4);
+        unsigned char mac[ s11nSHA::DIGEST_SIZE ];
+        s11nSHA::HMAC_SHA1 hmac((const byte*)password.data(), password.size());
+        hmac.calculate((const byte*)salt.data(), salt.size(), mac);
+        s11nSHA::pbkdf2_hmac_sha1((const byte*)password.data(), password.size(),
+                                  (const byte*)salt.data(), salt_length, 1, key, s11nSHA::DIGEST_SIZE);
+        EXPECT_EQ(0, std::memcmp(mac, key, s11nSHA::DIGEST_SIZE));
+    }
+
+    // many candidates at once agree with one at a time, with keys spanning
+    // several blocks and passwords longer than a block
+    const size_t count = 37, length = 50;
+    std::vector<std::string> passwords(count), salts(count);
+    std::vector<const unsigned char*> password_ptrs(count), salt_ptrs(count);
+    std::vector<size_t> password_lengths(count), salt_lengths(count);
+    std::vector<unsigned char> keys(count * length);
+    std::vector<unsigned char*> key_ptrs(count);
+
+    std::srand(std::time(0));
+    for( size_t i = 0; i < count; ++i )
+    {
+        passwords[i] = generate_random_string(std::rand() % 100);
+        salts[i] = generate_random_string(std::rand() % 40);
+        password_ptrs[i] = (const byte*)passwords[i].data();
+        password_lengths[i] = passwords[i].size();
+        salt_ptrs[i] = (const byte*)salts[i].data();
+        salt_lengths[i] = salts[i].size();
+        key_ptrs[i] = &keys[i * length];
+    }
+    s11nSHA::pbkdf2_hmac_sha1_multi(&password_ptrs[0], &password_lengths[0], &salt_ptrs[0],
+                                    &salt_lengths[0], count, 100, &key_ptrs[0], length);
+    for( size_t i = 0; i < count; ++i )
+    {
+        EXPECT_TRUE(s11nSHA::pbkdf2_hmac_sha1_verify(password_ptrs[i], password_lengths[i],
+                    salt_ptrs[i], salt_lengths[i], 100, key_ptrs[i], length));
+        key_ptrs[i][length - 1] ^= 1;
+        EXPECT_FALSE(s11nSHA::pbkdf2_hmac_sha1_verify(password_ptrs[i], password_lengths[i],
+                     salt_ptrs[i], salt_lengths[i], 100, key_ptrs[i], length));
+    }
+}
+
+// streams hash exactly what they write or read, in one pass
+TEST(s11nsha, hashingStreamsSinglePass)
+{
+    s11nSHA::SHA1 s11n_sha1;
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    unsigned char stream_digest[ s11nSHA::DIGEST_SIZE ];
+
+    std::srand(std::time(0));
+
+    for( int count = 0; count < 5; ++count )
+    {
+        std::string plain = generate_random_string(std::rand() % (1024*200));
+        s11n_sha1.calculate((byte*)plain.data(), plain.size(), s11n_digest);
+
+        // writes of every size, single characters included
+        std::stringbuf sink;
+        s11nSHA::HashingOStream os(&sink);
+        for( size_t i = 0; i < plain.size(); )
+        {
+            size_t n = std::min<size_t>(std::rand() % 3 == 0 ? std::rand() % 40000
+                                                             : std::rand() % 10, plain.size() - i);
+            if( n == 1 )
+                os.put(plain[i]);
+            else
+                os.write(plain.data() + i, n);
+            i += n;
+        }
+        os.final(stream_digest);
+        EXPECT_TRUE(sink.str() == plain);
+        EXPECT_EQ(0, std::memcmp(s11n_digest, stream_digest, sizeof(s11n_digest)));
+
+        // reads of every size hash exactly what was consumed
+        std::stringbuf source(plain);
+        s11nSHA::HashingIStream is(&source);
+        std::string read_back;
+        std::vector<char> chunk(40000);
+        while( is )
+        {
+            if( std::rand() % 2 )
+            {
+                int c = is.get();
+                if( c != EOF )
+                    read_back += (char) c;
+            }
+            else
+            {
+                is.read(&chunk[0], std::rand() % chunk.size());
+                read_back.append(&chunk[0], is.gcount());
+            }
+        }
+        is.final(stream_digest);
+        EXPECT_TRUE(read_back == plain);
+        EXPECT_EQ(0, std::memcmp(s11n_digest, stream_digest, sizeof(s11n_digest)));
+    }
+
+    // a reader that stops early gets the digest of the prefix it read
+    std::string plain = generate_random_string(100000);
+    std::stringbuf source(plain);
+    s11nSHA::HashingIStream is(&source);
+    std::vector<char> chunk(777);
+    is.read(&chunk[0], chunk.size());
+    is.final(stream_digest);
+    s11n_sha1.calculate((byte*)plain.data(), chunk.size(), s11n_digest);
+    EXPECT_EQ(0, std::memcmp(s11n_digest, stream_digest, sizeof(s11n_digest)));
+
+    // without a target the ostream is a pure hashing sink
+    s11nSHA::HashingOStream sink_only;
+    sink_only << plain;
+    sink_only.final(stream_digest);
+    s11n_sha1.calculate((byte*)plain.data(), plain.size(), s11n_digest);
+    EXPECT_EQ(0, std::memcmp(s11n_digest, stream_digest, sizeof(s11n_digest)));
+}
+
+// a hashing ostream destroyed without final() still delivers every byte
+TEST(s11nsha, hashingStreamFlushesOnDestruction)
+{
+    std::srand(std::time(0));
+
+    for( int count = 0; count < 5; ++count )
+    {
+        // short enough to stay in the put area, up to just below its size
+        std::string plain = generate_random_string(std::rand() % s11nSHA::STREAM_BUFFER_BYTES);
+        std::stringbuf sink;
+        {
+            s11nSHA::HashingOStream os(&sink);
+            os << plain;
+        }
+        EXPECT_TRUE(sink.str() == plain);
+    }
+}
+
+// sidecar checkpoints let a grown file hash only what was appended
+TEST(s11nsha, incrementalFileHashResume)
+{
+    std::string path = "/tmp/s11nsha_incremental_" + generate_random_string(12);
+    std::string sidecar = path + ".s11n";
+    const uint64_t interval = 4096 * 4;
+    s11nSHA::SHA1 s11n_sha1;
+    s11nSHA::IncrementalStats stats;
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    unsigned char file_digest[ s11nSHA::DIGEST_SIZE ];
+
+    std::string plain = generate_random_string(100000);
+    std::ofstream(path.c_str(), std::ios::binary) << plain;
+    s11n_sha1.calculate((byte*)plain.data(), plain.size(), s11n_digest);
+    EXPECT_TRUE(s11nSHA::calculate_incremental(path.c_str(), file_digest, NULL, interval, &stats));
+    EXPECT_EQ(0, std::memcmp(s11n_digest, file_digest, sizeof(s11n_digest)));
+    EXPECT_EQ(0u, stats.resumed_from);
+    EXPECT_EQ(plain.size(), stats.hashed_bytes);
+
+    // untouched file: stored digest, nothing read
+    EXPECT_TRUE(s11nSHA::calculate_incremental(path.c_str(), file_digest, NULL, interval, &stats));
+    EXPECT_EQ(0, std::memcmp(s11n_digest, file_digest, sizeof(s11n_digest)));
+    EXPECT_TRUE(stats.unchanged);
+    EXPECT_EQ(0u, stats.hashed_bytes);
+
+    // appended file resumes from the last checkpoint
+    std::string tail = generate_random_string(50000);
+    std::ofstream(path.c_str(), std::ios::binary | std::ios::app) << tail;
+    plain += tail;
+    s11n_sha1.calculate((byte*)plain.data(), plain.size(), s11n_digest);
+    EXPECT_TRUE(s11nSHA::calculate_incremental(path.c_str(), file_digest, NULL, interval, &stats));
+    EXPECT_EQ(0, std::memcmp(s11n_digest, file_digest, sizeof(s11n_digest)));
+    EXPECT_FALSE(stats.unchanged);
+    EXPECT_EQ(interval * 6, stats.resumed_from);
+    EXPECT_EQ(plain.size() - interval * 6, stats.hashed_bytes);
+
+    // a rewrite inside the guard of the last checkpoint falls back to the one before
+    plain[interval * 9 - 100] ^= 1;
+    std::ofstream(path.c_str(), std::ios::binary) << plain;
+    s11n_sha1.calculate((byte*)plain.data(), plain.size(), s11n_digest);
+    EXPECT_TRUE(s11nSHA::calculate_incremental(path.c_str(), file_digest, NULL, interval, &stats));
+    EXPECT_EQ(0, std::memcmp(s11n_digest, file_digest, sizeof(s11n_digest)));
+    EXPECT_EQ(interval * 8, stats.resumed_from);
+
+    // a truncated file uses a checkpoint below its new size
+    plain.resize(20000);
+    std::ofstream(path.c_str(), std::ios::binary) << plain;
+    s11n_sha1.calculate((byte*)plain.data(), plain.size(), s11n_digest);
+    EXPECT_TRUE(s11nSHA::calculate_incremental(path.c_str(), file_digest, NULL, interval, &stats));
+    EXPECT_EQ(0, std::memcmp(s11n_digest, file_digest, sizeof(s11n_digest)));
+    EXPECT_EQ(interval, stats.resumed_from);
+
+    // a different interval ignores the sidecar
+    EXPECT_TRUE(s11nSHA::calculate_incremental(path.c_str(), file_digest, NULL, interval * 2, &stats));
+    EXPECT_EQ(0, std::memcmp(s11n_digest, file_digest, sizeof(s11n_digest)));
+    EXPECT_EQ(0u, stats.resumed_from);
+    EXPECT_EQ(plain.size(), stats.hashed_bytes);
+
+    std::remove(path.c_str());
+    std::remove(sidecar.c_str());
+    EXPECT_FALSE(s11nSHA::calculate_incremental(path.c_str(), file_digest));
+}
+
+// splice_sha1 forwards exactly what it hashes, through pipes or not
+TEST(s11nsha, spliceHashWhileForwarding)
+{
+    s11nSHA::SHA1 s11n_sha1;
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    unsigned char splice_digest[ s11nSHA::DIGEST_SIZE ];
+
+    std::srand(std::time(0));
+
+    // writes plain into fd in random pieces, then closes it
+    auto produce = [](int fd, const std::string& plain)
+    {
+        for( size_t i = 0; i < plain.size(); )
+        {
+            ssize_t n = write(fd, plain.data() + i,
+                              std::min<size_t>(std::rand() % 70000 + 1, plain.size() - i));
+            if( n <= 0 )
+                break;
+            i += n;
+        }
+        close(fd);
+    };
+    // reads fd until end of file
+    auto consume = [](int fd, std::string *received)
+    {
+        char chunk[8192];
+        ssize_t n;
+        while( ( n = read(fd, chunk, sizeof(chunk)) ) > 0 )
+            received->append(chunk, n);
+        close(fd);
+    };
+
+    for( int count = 0; count < 4; ++count )
+    {
+        std::string plain = generate_random_string(std::rand() % (1024*1024*3) + 1);
+        std::string received;
+        int in[2], out[2];
+
+        // socket to socket, or pipe to socket, with a checkpoint midway
+        if( count % 2 )
+            ASSERT_EQ(0, pipe(in));
+        else
+            ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, in));
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, out));
+        std::thread producer(produce, in[1], std::cref(plain));
+        std::thread consumer(consume, out[1], &received);
+
+        s11nSHA::SpliceOptions options;
+        options.pipe_bytes = 4096 * (std::rand() % 64 + 1);
+        options.checkpoint_at = std::rand() % plain.size();
+        s11nSHA::SpliceStats stats;
+        uint64_t length = count < 2 ? s11nSHA::SPLICE_TO_EOF : plain.size() / 2;
+        bool ok = s11nSHA::splice_sha1(in[0], out[0], length, splice_digest, options, &stats);
+        shutdown(out[0], SHUT_WR);
+        consumer.join();
+
+        // leave what was not forwarded to the producer
+        std::string rest;
+        consume(in[0], &rest);
+        producer.join();
+        close(out[0]);
+
+        EXPECT_TRUE(ok);
+        EXPECT_TRUE(stats.spliced);
+        plain.resize(std::min<uint64_t>(plain.size(), length));
+        EXPECT_EQ(plain.size(), stats.bytes);
+        EXPECT_TRUE(received == plain);
+        s11n_sha1.calculate((byte*)plain.data(), plain.size(), s11n_digest);
+        EXPECT_EQ(0, std::memcmp(s11n_digest, splice_digest, sizeof(s11n_digest)));
+
+        // the checkpoint resumes into the same digest
+        if( options.checkpoint_at < plain.size() )
+        {
+            EXPECT_TRUE(stats.checkpointed);
+            s11nSHA::SHA1 resumed;
+            EXPECT_TRUE(s11nSHA::unmarshall(stats.checkpoint, sizeof(stats.checkpoint), resumed));
+            resumed.update((byte*)plain.data() + options.checkpoint_at,
+                           plain.size() - options.checkpoint_at);
+            resumed.final(splice_digest);
+            EXPECT_EQ(0, std::memcmp(s11n_digest, splice_digest, sizeof(s11n_digest)));
+        }
+    }
+
+    // O_APPEND output refuses splice(); the copy loop takes over
+    std::string path = "/tmp/s11nsha_splice_" + generate_random_string(12);
+    std::string plain = generate_random_string(1024*1024 + 17);
+    std::ofstream(path.c_str(), std::ios::binary) << plain;
+    std::string copy_path = path + ".copy";
+    int in_fd = open(path.c_str(), O_RDONLY);
+    int out_fd = open(copy_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    s11nSHA::SpliceStats stats;
+    EXPECT_TRUE(s11nSHA::splice_sha1(in_fd, out_fd, s11nSHA::SPLICE_TO_EOF, splice_digest,
+                                     s11nSHA::SpliceOptions(), &stats));
+    close(in_fd);
+    close(out_fd);
+    EXPECT_FALSE(stats.spliced);
+    EXPECT_EQ(plain.size(), stats.bytes);
+    s11n_sha1.calculate((byte*)plain.data(), plain.size(), s11n_digest);
+    EXPECT_EQ(0, std::memcmp(s11n_digest, splice_digest, sizeof(s11n_digest)));
+    EXPECT_TRUE(s11n_sha1.calculate(copy_path.c_str(), splice_digest));
+    EXPECT_EQ(0, std::memcmp(s11n_digest, splice_digest, sizeof(s11n_digest)));
+    std::remove(path.c_str());
+    std::remove(copy_path.c_str());
+}
+
+// git blob and tree ids, with blob ids reused from the cache
+TEST(s11nsha, gitTreeWithBlobCache)
+{
+    unsigned char digest[ s11nSHA::DIGEST_SIZE ];
+    std::string hexencoded;
+
+    s11nSHA::git_blob_sha1((byte*)"hello world\n", 12, digest);
+    ::encodeHex(hexencoded, digest, sizeof(digest));
+    EXPECT_EQ("3B18E512DBA79E4C8300DD08AEB37F8E728B8DAD", hexencoded);
+    hexencoded.clear();
+    s11nSHA::git_blob_sha1((byte*)"", 0, digest);
+    ::encodeHex(hexencoded, digest, sizeof(digest));
+    EXPECT_EQ("E69DE29BB2D1D6434B8B29AE775AD8C2E48C5391", hexencoded);
+
+    // "a" sorts after "a-b" and "a.txt" as git compares it as "a/";
+    // empty directories and .git are left out
+    std::string root = "/tmp/s11nsha_git_" + generate_random_string(12);
+    const char *const files[] = { "a.txt", "a/b", "a-b", "run.sh", ".git/HEAD" };
+    const char *const contents[] = { "hello world\n", "b\n", "", "#!/bin/sh\n", "x" };
+    const char *const dirs[] = { "", "/a", "/empty", "/empty/deeper", "/.git" };
+    for( size_t i = 0; i < 5; ++i )
+        ASSERT_EQ(0, mkdir((root + dirs[i]).c_str(), 0755));
+    for( size_t i = 0; i < 5; ++i )
+        std::ofstream((root + "/" + files[i]).c_str(), std::ios::binary) << contents[i];
+    ASSERT_EQ(0, chmod((root + "/run.sh").c_str(), 0755));
+    ASSERT_EQ(0, symlink("a.txt", (root + "/link").c_str()));
+
+    // files older than the walk can be cached
+    struct timespec times[2];
+    times[0].tv_sec = times[1].tv_sec = std::time(0) - 100;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    for( size_t i = 0; i < 4; ++i )
+        utimensat(AT_FDCWD, (root + "/" + files[i]).c_str(), times, 0);
+    utimensat(AT_FDCWD, (root + "/link").c_str(), times, AT_SYMLINK_NOFOLLOW);
+
+    EXPECT_TRUE(s11nSHA::git_blob_sha1((root + "/a.txt").c_str(), digest));
+    hexencoded.clear();
+    ::encodeHex(hexencoded, digest, sizeof(digest));
+    EXPECT_EQ("3B18E512DBA79E4C8300DD08AEB37F8E728B8DAD", hexencoded);
+
+    s11nSHA::GitBlobCache cache;
+    s11nSHA::GitTreeOptions options;
+    options.threads = 4;
+    s11nSHA::GitTreeStats stats;
+    EXPECT_TRUE(s11nSHA::git_tree_sha1(root.c_str(), digest, &cache, options, &stats));
+    hexencoded.clear();
+    ::encodeHex(hexencoded, digest, sizeof(digest));
+    EXPECT_EQ("D904A420BFBDE2E06AC356F9031575E1BAB7DEA7", hexencoded);
+    EXPECT_EQ(5u, stats.blobs);
+    EXPECT_EQ(0u, stats.cached);
+    EXPECT_EQ(5u, cache.size());
+
+    // a second walk reads nothing, also after a save and load
+    std::string cache_path = root + ".cache";
+    EXPECT_TRUE(cache.save(cache_path.c_str()));
+    s11nSHA::GitBlobCache loaded;
+    EXPECT_TRUE(loaded.load(cache_path.c_str()));
+    EXPECT_TRUE(s11nSHA::git_tree_sha1(root.c_str(), digest, &loaded, options, &stats));
+    hexencoded.clear();
+    ::encodeHex(hexencoded, digest, sizeof(digest));
+    EXPECT_EQ("D904A420BFBDE2E06AC356F9031575E1BAB7DEA7", hexencoded);
+    EXPECT_EQ(5u, stats.cached);
+    EXPECT_EQ(0u, stats.hashed_bytes);
+    EXPECT_EQ(0u, loaded.prune());
+
+    // a changed file misses; its stale entry goes at the next prune
+    std::ofstream((root + "/a.txt").c_str(), std::ios::binary) << "hello git\n";
+    EXPECT_TRUE(s11nSHA::git_tree_sha1(root.c_str(), digest, &loaded, options, &stats));
+    hexencoded.clear();
+    ::encodeHex(hexencoded, digest, sizeof(digest));
+    EXPECT_EQ("78F3B2534007E54BE90BB193E5867CA3C27FC469", hexencoded);
+    EXPECT_EQ(4u, stats.cached);
+    EXPECT_EQ(10u, stats.hashed_bytes);
+    EXPECT_EQ(1u, loaded.prune());
+    EXPECT_EQ(4u, loaded.size());
+
+    EXPECT_FALSE(s11nSHA::git_tree_sha1((root + "/missing").c_str(), digest));
+    EXPECT_FALSE(loaded.load((root + "/missing").c_str()));
+
+    std::remove(cache_path.c_str());
+    std::remove((root + "/link").c_str());
+    for( size_t i = 0; i < 5; ++i )
+        std::remove((root + "/" + files[i]).c_str());
+    for( size_t i = 5; i-- > 0; )
+        std::remove((root + dirs[i]).c_str());
+}
+
+// content defined chunks survive insertions, threads and resumption
+TEST(s11nsha, contentDefinedChunking)
+{
+    std::vector<s11nSHA::Chunk> serial, parallel, resumed, shifted;
+    auto collect = [](std::vector<s11nSHA::Chunk> *out)
+    {
+        return [out](const s11nSHA::Chunk& chunk) { out->push_back(chunk); };
+    };
+    auto same = [](const s11nSHA::Chunk& a, const s11nSHA::Chunk& b)
+    {
+        return a.offset == b.offset && a.length == b.length
+            && std::memcmp(a.digest, b.digest, sizeof(a.digest)) == 0;
+    };
+
+    // fixed seed: the insertion check below depends on where cuts fall
+    std::srand(20240601);
+    std::string plain = generate_random_string(1024*1024*6 + std::rand() % 100000);
+    const byte *data = (const byte*) plain.data();
+
+    // small pieces on one thread
+    s11nSHA::Chunker chunker;
+    for( size_t i = 0; i < plain.size(); )
+    {
+        size_t n = std::min<size_t>(std::rand() % 50000, plain.size() - i);
+        chunker.update(data + i, n, collect(&serial));
+        i += n;
+    }
+    EXPECT_EQ(plain.size(), chunker.offset());
+    chunker.final(collect(&serial));
+
+    uint64_t offset = 0;
+    s11nSHA::SHA1 s11n_sha1;
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    for( size_t i = 0; i < serial.size(); ++i )
+    {
+        EXPECT_EQ(offset, serial[i].offset);
+        if( i + 1 < serial.size() )
+        {
+            EXPECT_GE(serial[i].length, 2048u);
+            EXPECT_LE(serial[i].length, 65536u);
+        }
+        s11n_sha1.calculate(data + offset, serial[i].length, s11n_digest);
+        EXPECT_EQ(0, std::memcmp(s11n_digest, serial[i].digest, sizeof(s11n_digest)));
+        offset += serial[i].length;
+    }
+    EXPECT_EQ(plain.size(), offset);
+    EXPECT_GT(serial.size(), plain.size() / 65536);
+
+    // one big update on four threads gives the same chunks
+    chunker.set_threads(4);
+    chunker.update(data, plain.size(), collect(&parallel));
+    chunker.final(collect(&parallel));
+    ASSERT_EQ(serial.size(), parallel.size());
+    for( size_t i = 0; i < serial.size(); ++i )
+        EXPECT_TRUE(same(serial[i], parallel[i]));
+
+    // marshall halfway, resume in another chunker
+    size_t half = plain.size() / 2;
+    std::string s11n_chunker;
+    chunker.update(data, half, collect(&resumed));
+    s11nSHA::marshall_chunker(s11n_chunker, chunker);
+    chunker.init();
+    s11nSHA::Chunker other(10);
+    EXPECT_FALSE(s11nSHA::unmarshall_chunker((byte*)s11n_chunker.data(), s11n_chunker.size() - 1, other));
+    EXPECT_TRUE(s11nSHA::unmarshall_chunker((byte*)s11n_chunker.data(), s11n_chunker.size(), other));
+    EXPECT_EQ(half, other.offset());
+    other.update(data + half, plain.size() - half, collect(&resumed));
+    other.final(collect(&resumed));
+    ASSERT_EQ(serial.size(), resumed.size());
+    for( size_t i = 0; i < serial.size(); ++i )
+        EXPECT_TRUE(same(serial[i], resumed[i]));
+
+    // bytes inserted in the middle only change the chunks around them
+    std::string edited = plain.substr(0, half) + "inserted" + plain.substr(half);
+    chunker.update((const byte*) edited.data(), edited.size(), collect(&shifted));
+    chunker.final(collect(&shifted));
+    std::set<std::string> digests;
+    for( size_t j = 0; j < shifted.size(); ++j )
+        digests.insert(std::string((const char*) shifted[j].digest, s11nSHA::DIGEST_SIZE));
+    size_t common = 0;
+    for( size_t i = 0; i < serial.size(); ++i )
+        common += digests.count(std::string((const char*) serial[i].digest, s11nSHA::DIGEST_SIZE));
+    EXPECT_GE(common + 3, serial.size());
+
+    EXPECT_FALSE(chunker.init(s11nSHA::CDC_MAX_AVG_SHIFT + 1));
+}
+
 // marshall and unmarshall SHA1 state
 TEST(s11nsha, marshallAndUnmarshallRandomStringArg)
 {
@@ -175,6 +1118,389 @@ TEST(s11nsha, marshallAndUnmarshallRandomStringArg)
     EXPECT_TRUE( s11n_hexencoded == s11n_hexencoded_new ); 
 }
 
+// fixed binary marshall/unmarshall round trip
+TEST(s11nsha, fixedMarshallAndUnmarshallRandomStringArg)
+{
+    s11nSHA::SHA1 s11n_sha1, s11n_sha1_new, s11n_sha1_boost;
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    unsigned char s11n_digest_new[ s11nSHA::DIGEST_SIZE ];
+    unsigned char s11n_digest_boost[ s11nSHA::DIGEST_SIZE ];
+
+    std::srand(std::time(0));
+
+    uint64_t r = (std::rand() % (1024*1024)) + 1;
+    std::string plain = generate_random_string(r);
+    s11n_sha1.update((byte*)plain.data(), plain.size());
+
+    unsigned char record[ s11nSHA::FIXED_S11N_BYTES ];
+    s11nSHA::marshall(record, s11n_sha1);
+    EXPECT_TRUE(s11nSHA::unmarshall(record, sizeof(record), s11n_sha1_new));
+
+    // the boost archive path restores the same state
+    std::string s11n_sha1_object;
+    s11nSHA::marshall(s11n_sha1_object, s11n_sha1, true);
+    s11nSHA::unmarshall(s11n_sha1_object, s11n_sha1_boost, true);
+
+    r = (std::rand() % (1024*1024)) + 1;
+    plain = generate_random_string(r);
+    s11n_sha1.update((byte*)plain.data(), plain.size());
+    s11n_sha1_new.update((byte*)plain.data(), plain.size());
+    s11n_sha1_boost.update((byte*)plain.data(), plain.size());
+
+    s11n_sha1.final( s11n_digest );
+    s11n_sha1_new.final( s11n_digest_new );
+    s11n_sha1_boost.final( s11n_digest_boost );
+    EXPECT_EQ(0, std::memcmp(s11n_digest, s11n_digest_new, sizeof(s11n_digest)));
+    EXPECT_EQ(0, std::memcmp(s11n_digest, s11n_digest_boost, sizeof(s11n_digest)));
+
+    // wrong length, magic or version is rejected
+    EXPECT_FALSE(s11nSHA::unmarshall(record, sizeof(record) - 1, s11n_sha1_new));
+    record[2] = s11nSHA::FIXED_S11N_VERSION + 1;
+    EXPECT_FALSE(s11nSHA::unmarshall(record, sizeof(record), s11n_sha1_new));
+    record[0] = 'X';
+    EXPECT_FALSE(s11nSHA::unmarshall(record, sizeof(record), s11n_sha1_new));
+}
+
+// compact marshall/unmarshall round trip, with both length encodings
+TEST(s11nsha, compactMarshallAndUnmarshallRandomStringArg)
+{
+    std::srand(std::time(0));
+
+    for( int count = 1; count <= 50; ++count)
+    {
+        bool varint = count % 2;
+        s11nSHA::SHA1 s11n_sha1, s11n_sha1_new;
+        unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+        unsigned char s11n_digest_new[ s11nSHA::DIGEST_SIZE ];
+
+        uint64_t r = std::rand() % (64*1024);
+        std::string plain = generate_random_string(r);
+        s11n_sha1.update((byte*)plain.data(), plain.size());
+
+        unsigned char record[ s11nSHA::COMPACT_S11N_MAX_BYTES ];
+        size_t size = s11nSHA::marshall_compact(record, sizeof(record), s11n_sha1, varint);
+        EXPECT_EQ(size, s11nSHA::compact_size(s11n_sha1, varint));
+        ASSERT_GT(size, 0u);
+        EXPECT_EQ(size, s11nSHA::unmarshall_compact(record, size, s11n_sha1_new));
+
+        // live bytes only: everything after state[] is the partial block
+        size_t length_bytes = varint ? (r < 128 ? 1 : r < 16384 ? 2 : 3) : 8;
+        EXPECT_EQ(2 + length_bytes + 20 + (r % 64), size);
+
+        // too small a buffer or a truncated record is rejected
+        EXPECT_EQ(0u, s11nSHA::marshall_compact(record, size - 1, s11n_sha1, varint));
+        EXPECT_EQ(0u, s11nSHA::unmarshall_compact(record, size - 1, s11n_sha1_new));
+
+        plain = generate_random_string(std::rand() % 1000);
+        s11n_sha1.update((byte*)plain.data(), plain.size());
+        s11n_sha1_new.update((byte*)plain.data(), plain.size());
+        s11n_sha1.final( s11n_digest );
+        s11n_sha1_new.final( s11n_digest_new );
+        EXPECT_EQ(0, std::memcmp(s11n_digest, s11n_digest_new, sizeof(s11n_digest)));
+    }
+}
+
+// batch marshall of many objects, restored in bulk and by key
+TEST(s11nsha, batchMarshallAndUnmarshall)
+{
+    const size_t count = 1000;
+    std::vector<s11nSHA::SHA1> objects(count);
+    std::vector<const s11nSHA::SHA1*> pointers(count);
+    std::vector<uint64_t> keys(count);
+
+    std::srand(std::time(0));
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        std::string plain = generate_random_string(std::rand() % 300);
+        objects[i].update((byte*)plain.data(), plain.size());
+        pointers[i] = &objects[i];
+        keys[i] = ( (uint64_t) std::rand() << 32 ) ^ ( i * 2654435761u );
+    }
+
+    std::string s11n_batch;
+    ASSERT_TRUE(s11nSHA::marshall_batch(s11n_batch, &pointers[0], &keys[0], count));
+
+    // refused up front, before any object is read
+    std::string too_big("x");
+    EXPECT_FALSE(s11nSHA::marshall_batch(too_big, NULL, NULL,
+                                         s11nSHA::BATCH_MAX_OBJECTS + 1));
+    EXPECT_TRUE(too_big.empty());
+
+    std::vector<s11nSHA::SHA1> restored(count);
+    std::vector<uint64_t> restored_keys(count);
+    EXPECT_EQ(count, s11nSHA::unmarshall_batch(s11n_batch, &restored[0],
+                                               &restored_keys[0], count));
+    EXPECT_EQ(0u, s11nSHA::unmarshall_batch(s11n_batch, &restored[0],
+                                            &restored_keys[0], count - 1));
+
+    s11nSHA::BatchReader reader;
+    ASSERT_TRUE(reader.open((const unsigned char*)s11n_batch.data(), s11n_batch.size()));
+    EXPECT_EQ(count, reader.size());
+
+    for( size_t i = 0; i < count; i += 7 )
+    {
+        s11nSHA::SHA1 s11n_sha1;
+        unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+        unsigned char s11n_digest_new[ s11nSHA::DIGEST_SIZE ];
+
+        ASSERT_TRUE(reader.find(keys[i], s11n_sha1));
+        s11n_sha1.final( s11n_digest_new );
+        s11nSHA::SHA1 original = objects[i];
+        original.final( s11n_digest );
+        EXPECT_EQ(0, std::memcmp(s11n_digest, s11n_digest_new, sizeof(s11n_digest)));
+    }
+
+    // keys come back sorted, with their objects
+    for( size_t i = 1; i < count; ++i )
+        EXPECT_LE(restored_keys[i - 1], restored_keys[i]);
+
+    uint64_t missing = 0;
+    while( std::find(keys.begin(), keys.end(), missing) != keys.end() )
+        ++missing;
+    s11nSHA::SHA1 unused;
+    EXPECT_FALSE(reader.find(missing, unused));
+    EXPECT_FALSE(reader.open((const unsigned char*)s11n_batch.data(), s11n_batch.size() / 2));
+}
+
+// mmap'd state store survives close and reopen
+TEST(s11nsha, stateStorePutGetReopen)
+{
+    std::string path = "/tmp/s11nsha_store_" + generate_random_string(12);
+    const size_t count = 500;
+    std::vector<s11nSHA::SHA1> objects(count);
+
+    std::srand(std::time(0));
+
+    {
+        s11nSHA::StateStore store;
+        ASSERT_TRUE(store.open(path.c_str(), 1000, s11nSHA::StateStore::DURABLE_MSYNC));
+        EXPECT_EQ(1024u, store.capacity());
+
+        for( size_t i = 0; i < count; ++i )
+        {
+            std::string plain = generate_random_string(std::rand() % 300);
+            objects[i].update((byte*)plain.data(), plain.size());
+            EXPECT_TRUE(store.put(1000 + i, objects[i]));
+        }
+
+        // updating a session rewrites its slot
+        std::string plain = generate_random_string(100);
+        objects[0].update((byte*)plain.data(), plain.size());
+        EXPECT_TRUE(store.put(1000, objects[0]));
+        EXPECT_EQ(count, store.size());
+
+        EXPECT_TRUE(store.erase(1001));
+        EXPECT_FALSE(store.erase(1001));
+        EXPECT_TRUE(store.sync());
+    }
+
+    s11nSHA::StateStore store;
+    ASSERT_TRUE(store.open(path.c_str(), 16));
+    EXPECT_EQ(1024u, store.capacity());
+    EXPECT_EQ(count - 1, store.size());
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        s11nSHA::SHA1 s11n_sha1;
+        unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+        unsigned char s11n_digest_new[ s11nSHA::DIGEST_SIZE ];
+
+        if( i == 1 )
+        {
+            EXPECT_FALSE(store.get(1000 + i, s11n_sha1));
+            continue;
+        }
+
+        ASSERT_TRUE(store.get(1000 + i, s11n_sha1));
+        s11n_sha1.final( s11n_digest_new );
+        objects[i].final( s11n_digest );
+        EXPECT_EQ(0, std::memcmp(s11n_digest, s11n_digest_new, sizeof(s11n_digest)));
+    }
+
+    store.close();
+    std::remove(path.c_str());
+
+    // a store refuses new sessions once every slot is taken
+    ASSERT_TRUE(store.open(path.c_str(), 4));
+    for( uint64_t key = 0; key < 4; ++key )
+        EXPECT_TRUE(store.put(key, objects[0]));
+    EXPECT_FALSE(store.put(4, objects[0]));
+    EXPECT_TRUE(store.put(3, objects[0]));
+    store.close();
+    std::remove(path.c_str());
+}
+
+// sessions spilled past the resident bound resume intact, also after a reopen
+TEST(s11nsha, sessionManagerSpillAndResume)
+{
+    std::string path = "/tmp/s11nsha_session_" + generate_random_string(12);
+    const size_t count = 300;
+    std::vector<std::string> plain(count);
+    std::vector<size_t> fed(count, 0);
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    unsigned char session_digest[ s11nSHA::DIGEST_SIZE ];
+    s11nSHA::SHA1 s11n_sha1;
+
+    std::srand(std::time(0));
+
+    for( size_t i = 0; i < count; ++i )
+        plain[i] = generate_random_string(std::rand() % 5000);
+
+    {
+        // far fewer resident slots than sessions, so most of them spill
+        s11nSHA::SessionManager sessions;
+        ASSERT_TRUE(sessions.open(path.c_str(), 40, 1024, 4));
+        for( size_t i = 0; i < count; ++i )
+            EXPECT_TRUE(sessions.begin(i));
+        EXPECT_FALSE(sessions.begin(0));
+        EXPECT_GE(40u, sessions.resident());
+        EXPECT_EQ(count, sessions.resident() + sessions.spilled());
+
+        // feed the first half of every message in random pieces and order
+        for( int round = 0; round < 4000; ++round )
+        {
+            size_t i = std::rand() % count;
+            size_t n = std::min<size_t>(std::rand() % 200, plain[i].size() / 2 - fed[i]);
+            EXPECT_TRUE(sessions.update(i, (byte*)plain[i].data() + fed[i], n));
+            fed[i] += n;
+        }
+        EXPECT_LT(0u, sessions.spills());
+        EXPECT_LT(0u, sessions.reloads());
+
+        // dropping a session frees its slot for good
+        EXPECT_TRUE(sessions.abort(count - 1));
+        EXPECT_FALSE(sessions.update(count - 1, (byte*)"x", 1));
+        EXPECT_TRUE(sessions.close());
+    }
+
+    // everything was spilled on close; finish the uploads from four threads
+    s11nSHA::SessionManager sessions;
+    ASSERT_TRUE(sessions.open(path.c_str(), 64, 16));
+    EXPECT_EQ(count - 1, sessions.spilled());
+
+    std::vector<std::thread> workers;
+    for( size_t t = 0; t < 4; ++t )
+        workers.push_back(std::thread([&, t]()
+        {
+            for( size_t i = t; i < count - 1; i += 4 )
+                while( fed[i] < plain[i].size() )
+                {
+                    size_t n = std::min<size_t>(std::rand() % 300 + 1, plain[i].size() - fed[i]);
+                    sessions.update(i, (byte*)plain[i].data() + fed[i], n);
+                    fed[i] += n;
+                }
+        }));
+    for( size_t t = 0; t < workers.size(); ++t )
+        workers[t].join();
+
+    for( size_t i = 0; i < count - 1; ++i )
+    {
+        ASSERT_TRUE(sessions.snapshot(i, s11n_sha1));
+        ASSERT_TRUE(sessions.final(i, session_digest));
+        s11n_sha1.calculate((byte*)plain[i].data(), plain[i].size(), s11n_digest);
+        EXPECT_EQ(0, std::memcmp(s11n_digest, session_digest, sizeof(s11n_digest)));
+    }
+    EXPECT_FALSE(sessions.final(0, session_digest));
+    EXPECT_EQ(0u, sessions.resident() + sessions.spilled());
+
+    sessions.close();
+    std::remove(path.c_str());
+}
+
+// concurrent writers to shared and private sessions lose no bytes
+TEST(s11nsha, sessionTableConcurrentUpdates)
+{
+    const size_t threads = 8;
+    const size_t shared = 4;
+    s11nSHA::SessionTable table( 256 );
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    unsigned char table_digest[ s11nSHA::DIGEST_SIZE ];
+    s11nSHA::SHA1 s11n_sha1;
+
+    EXPECT_EQ(256u, table.capacity());
+    EXPECT_FALSE(table.begin(s11nSHA::SESSION_ID_EMPTY));
+
+    // every thread appends one fixed byte at a time to a few shared
+    // sessions (so writers collide) and churns through private ones
+    for( uint64_t id = 0; id < shared; ++id )
+        EXPECT_TRUE(table.begin(id));
+    EXPECT_FALSE(table.begin(0));
+
+    std::vector<std::thread> workers;
+    std::vector<int> failures(threads, 0);
+    for( size_t t = 0; t < threads; ++t )
+        workers.push_back(std::thread([&, t]()
+        {
+            s11nSHA::SHA1 local;
+            unsigned char expected[ s11nSHA::DIGEST_SIZE ];
+            unsigned char actual[ s11nSHA::DIGEST_SIZE ];
+            for( uint64_t round = 0; round < 300; ++round )
+            {
+                uint64_t id = 1000 + t * 1000 + round;
+                std::string plain = generate_random_string(round % 200);
+                failures[t] += !table.begin(id);
+                for( size_t i = 0; i < plain.size(); i += 7 )
+                    table.update(id, (byte*)plain.data() + i, std::min<size_t>(7, plain.size() - i));
+                table.update(round % shared, (const byte*)"s", 1);
+                failures[t] += !table.final(id, actual);
+                local.calculate((byte*)plain.data(), plain.size(), expected);
+                failures[t] += std::memcmp(expected, actual, sizeof(actual)) != 0;
+                failures[t] += table.update(id, (const byte*)"x", 1);
+            }
+        }));
+    for( size_t t = 0; t < threads; ++t )
+    {
+        workers[t].join();
+        EXPECT_EQ(0, failures[t]);
+    }
+
+    // each shared session saw exactly threads * 300 / shared bytes of 's'
+    std::string expected_shared(threads * 300 / shared, 's');
+    s11n_sha1.calculate((byte*)expected_shared.data(), expected_shared.size(), s11n_digest);
+    for( uint64_t id = 0; id < shared; ++id )
+    {
+        s11nSHA::SHA1 copy;
+        EXPECT_TRUE(table.snapshot(id, copy));
+        EXPECT_TRUE(table.final(id, table_digest));
+        EXPECT_EQ(0, std::memcmp(s11n_digest, table_digest, sizeof(s11n_digest)));
+    }
+    EXPECT_EQ(0u, table.size());
+    EXPECT_EQ(0u, table.reclaim());
+    EXPECT_FALSE(table.abort(0));
+}
+
+// begin/final churn leaves tombstones but lookups stay short
+TEST(s11nsha, sessionTableChurnKeepsProbesBounded)
+{
+    s11nSHA::SessionTable table( 4096 );
+    unsigned char table_digest[ s11nSHA::DIGEST_SIZE ];
+    std::vector<uint64_t> live;
+
+    std::srand(12345);
+    for( size_t i = 0; i < 1024; ++i )
+    {
+        live.push_back(((uint64_t) std::rand() << 32) | std::rand());
+        EXPECT_TRUE(table.begin(live.back()));
+    }
+
+    // replace a random live session a million times: every slot of the
+    // table ends up a tombstone at some point
+    for( size_t round = 0; round < 1000000; ++round )
+    {
+        size_t k = std::rand() % live.size();
+        ASSERT_TRUE(table.final(live[k], table_digest));
+        live[k] = ((uint64_t) std::rand() << 32) | std::rand();
+        ASSERT_TRUE(table.begin(live[k]));
+    }
+
+    EXPECT_EQ(live.size(), table.size());
+    EXPECT_LT(table.max_probes(), 64u);
+    for( size_t k = 0; k < live.size(); ++k )
+        EXPECT_TRUE(table.update(live[k], (const byte*)"s", 1));
+    EXPECT_FALSE(table.update(1, (const byte*)"s", 1));
+}
+
 // sha1 of large data (size <= 1GB)
 TEST(s11nsha, updateAndfinalWithRandomStringArgDump)
 {
@@ -194,6 +1520,194 @@ TEST(s11nsha, updateAndfinalWithRandomStringArgDump)
     s11n_sha1.final( s11n_digest ); s11n_sha1.dump();
 }
 
+#ifdef S11NSHA_X86
+// SIMD kernels must leave the same state[] behind as the scalar kernel
+TEST(s11nsha, simdKernelsMatchScalar)
+{
+    struct { bool supported; s11nSHA::process_fn process; } kernels[] = {
+        { s11nSHA::cpu_has_ssse3(), s11nSHA::process_ssse3 },
+        { s11nSHA::cpu_has_avx2(),  s11nSHA::process_avx2  },
+        { s11nSHA::cpu_has_shani(), s11nSHA::process_shani }
+    };
+
+    std::srand(std::time(0));
+
+    for( int count = 1; count <= 100; ++count)
+    {
+        size_t blocks = std::rand() % 64 + 1;
+        std::string plain = generate_random_string(blocks * s11nSHA::BLOCK_BYTES);
+        uint32_t scalar[ s11nSHA::DIGEST_INTS ], simd[ s11nSHA::DIGEST_INTS ];
+        for( unsigned int i = 0; i < s11nSHA::DIGEST_INTS; ++i )
+            scalar[i] = std::rand();
+
+        uint32_t initial[ s11nSHA::DIGEST_INTS ];
+        std::memcpy(initial, scalar, sizeof(initial));
+        s11nSHA::process_scalar(scalar, (byte*)plain.data(), blocks);
+
+        for( unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k )
+        {
+            if( !kernels[k].supported )
+                continue;
+            std::memcpy(simd, initial, sizeof(simd));
+            kernels[k].process(simd, (byte*)plain.data(), blocks);
+            EXPECT_EQ(0, std::memcmp(scalar, simd, sizeof(scalar)));
+        }
+    }
+}
+#endif
+
+#ifdef S11NSHA_X86
+// every lane of the AVX2/AVX-512 kernels must match the scalar kernel
+TEST(s11nsha, multiBufferKernelsMatchScalar)
+{
+    std::srand(std::time(0));
+
+    std::string plain = generate_random_string(16 * s11nSHA::BLOCK_BYTES);
+    const unsigned char *data[16];
+    uint32_t scalar[16][ s11nSHA::DIGEST_INTS ];
+    uint32_t x8[ s11nSHA::DIGEST_INTS ][8], x16[ s11nSHA::DIGEST_INTS ][16];
+
+    for( unsigned int lane = 0; lane < 16; ++lane )
+    {
+        data[lane] = (byte*)plain.data() + lane * s11nSHA::BLOCK_BYTES;
+        for( unsigned int w = 0; w < s11nSHA::DIGEST_INTS; ++w )
+        {
+            scalar[lane][w] = x16[w][lane] = std::rand();
+            if( lane < 8 )
+                x8[w][lane] = scalar[lane][w];
+        }
+        s11nSHA::process_scalar(scalar[lane], data[lane], 1);
+    }
+
+    if( s11nSHA::cpu_has_avx2() )
+    {
+        s11nSHA::process_x8_avx2(x8, data);
+        for( unsigned int lane = 0; lane < 8; ++lane )
+            for( unsigned int w = 0; w < s11nSHA::DIGEST_INTS; ++w )
+                EXPECT_EQ(scalar[lane][w], x8[w][lane]);
+    }
+
+    if( s11nSHA::cpu_has_avx512() )
+    {
+        s11nSHA::process_x16_avx512(x16, data);
+        for( unsigned int lane = 0; lane < 16; ++lane )
+            for( unsigned int w = 0; w < s11nSHA::DIGEST_INTS; ++w )
+                EXPECT_EQ(scalar[lane][w], x16[w][lane]);
+    }
+}
+#endif
+
+// every supported kernel can be pinned and produces the same digest
+TEST(s11nsha, setKernelPinsKernel)
+{
+    const char *names[] = { "shani", "avx2", "ssse3", "scalar" };
+    std::string plain = generate_random_string(1024*1024 + 17);
+    unsigned char expected[ s11nSHA::DIGEST_SIZE ];
+    byte crypto_digest[ CryptoPP::SHA1::DIGESTSIZE ];
+    CryptoPP::SHA1().CalculateDigest(crypto_digest, (byte*)plain.data(), plain.size());
+
+    for( unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); ++i )
+    {
+        if( !s11nSHA::kernel_supported(names[i]) )
+        {
+            EXPECT_FALSE(s11nSHA::set_kernel(names[i]));
+            continue;
+        }
+
+        EXPECT_TRUE(s11nSHA::set_kernel(names[i]));
+        EXPECT_EQ(std::string(names[i]), s11nSHA::kernel_name());
+
+        s11nSHA::SHA1 s11n_sha1;
+        s11n_sha1.calculate((byte*)plain.data(), plain.size(), expected);
+        EXPECT_EQ(0, std::memcmp(expected, crypto_digest, sizeof(expected)));
+    }
+
+    EXPECT_TRUE(s11nSHA::kernel_supported("scalar"));
+    EXPECT_TRUE(s11nSHA::set_kernel("scalar"));
+    EXPECT_FALSE(s11nSHA::set_kernel("no-such-kernel"));
+    EXPECT_EQ(std::string("scalar"), s11nSHA::kernel_name());
+
+    // the multi-buffer kernels stay out of the way of a scalar pin
+    EXPECT_EQ(1u, s11nSHA::multi_lanes());
+    if( s11nSHA::set_kernel("avx2") )
+    {
+        EXPECT_GE(8u, s11nSHA::multi_lanes());
+    }
+
+    s11nSHA::reset_kernel();
+}
+
+// multi-buffer update of ragged streams must match per-stream update()
+TEST(s11nsha, updateMultiMatchesUpdate)
+{
+    const size_t count = 37;
+    s11nSHA::SHA1 multi[count], single[count];
+    s11nSHA::SHA1 *contexts[count];
+    std::string plain[count];
+    const unsigned char *inputs[count];
+    size_t lengths[count];
+
+    std::srand(std::time(0));
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        // leave some streams with a partial block before the multi update
+        std::string head = generate_random_string(std::rand() % 100);
+        multi[i].update((byte*)head.data(), head.size());
+        single[i].update((byte*)head.data(), head.size());
+
+        plain[i] = generate_random_string(std::rand() % (64*1024));
+        contexts[i] = &multi[i];
+        inputs[i] = (byte*)plain[i].data();
+        lengths[i] = plain[i].size();
+        single[i].update(inputs[i], lengths[i]);
+    }
+
+    s11nSHA::update_multi(contexts, inputs, lengths, count);
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        unsigned char multi_digest[ s11nSHA::DIGEST_SIZE ];
+        unsigned char single_digest[ s11nSHA::DIGEST_SIZE ];
+        multi[i].final( multi_digest );
+        single[i].final( single_digest );
+        EXPECT_EQ(0, std::memcmp(multi_digest, single_digest, sizeof(multi_digest)));
+    }
+}
+
+// batched one-shot hashing of many messages matches calculate() on each
+TEST(s11nsha, calculateBatchMatchesCalculate)
+{
+    const size_t count = 1000;
+    std::vector<std::string> plain(count);
+    std::vector<const unsigned char*> inputs(count);
+    std::vector<size_t> lengths(count);
+    std::vector<unsigned char> digests(count * s11nSHA::DIGEST_SIZE);
+    unsigned char s11n_digest[ s11nSHA::DIGEST_SIZE ];
+    s11nSHA::SHA1 s11n_sha1;
+
+    std::srand(std::time(0));
+
+    // mostly short keys around the padding boundaries, some long messages
+    for( size_t i = 0; i < count; ++i )
+    {
+        size_t length = i < 130 ? i : i % 50 == 0 ? std::rand() % 5000
+                                                  : 32 + std::rand() % 170;
+        plain[i] = generate_random_string(length);
+        inputs[i] = (const byte*)plain[i].data();
+        lengths[i] = length;
+    }
+
+    s11nSHA::calculate_batch(&inputs[0], &lengths[0], count,
+                             (unsigned char (*)[s11nSHA::DIGEST_SIZE]) &digests[0]);
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        s11n_sha1.calculate(inputs[i], lengths[i], s11n_digest);
+        EXPECT_EQ(0, std::memcmp(s11n_digest, &digests[i * s11nSHA::DIGEST_SIZE], sizeof(s11n_digest)));
+    }
+}
+
 int main (int argc, char** argv) {
     testing::InitGoogleTest(&argc, argv);
 